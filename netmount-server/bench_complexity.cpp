@@ -0,0 +1,406 @@
+// SPDX-License-Identifier: GPL-2.0-only
+// Copyright 2025-2026 Jaroslav Rohel, jaroslav.rohel@gmail.com
+
+// Benchmark of the worst-case complexity of the directory and name handling.
+// Generates adversarial inputs (many long names sharing an 8 character prefix, large directories, many
+// handles), measures the latency of single server operations for growing input sizes and estimates the scaling
+// exponent (latency ~ size^exponent) from the median latencies. Exits with an error if an exponent exceeds
+// the threshold. The worst latencies are only reported, a single outlier (e.g. a periodic listing refresh) would
+// make the estimate random.
+
+#include "fs.hpp"
+#include "logger.hpp"
+#include "utils.hpp"
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+namespace netmount_srv {
+
+namespace {
+
+constexpr double DEFAULT_MAX_EXPONENT = 1.7;
+// The 8.3 alias of a name colliding with N others probes the suffixes ~1 to ~N, FIND_FIRST is known to be quadratic.
+// The threshold catches a regression beyond it.
+constexpr double FIND_FIRST_COLLIDING_MAX_EXPONENT = 2.3;
+constexpr int WARMUP_COUNT = 2;     // repetitions of an operation that are not measured
+constexpr int REPEAT_COUNT = 25;    // measured repetitions of an operation
+constexpr int LOOKUP_SAMPLES = 64;  // number of looked up names in a directory
+// FIND_FIRST in a large colliding directory takes seconds, it is warmed up once and repeated less
+constexpr int FIND_FIRST_COLLIDING_REPEAT_COUNT = 3;
+const std::vector<unsigned int> DEFAULT_SIZES = {1000, 2000, 4000, 8000};
+
+using Clock = std::chrono::steady_clock;
+
+
+struct Measurement {
+    unsigned int size;
+    double median_us;  // median latency of one operation in microseconds
+    double p90_us;     // 90th percentile of the latency in microseconds
+    double worst_us;   // worst latency of one operation in microseconds
+};
+
+
+// Collects the latencies of operations. The first `warmup_count` measurements are not recorded.
+class Stopwatch {
+public:
+    explicit Stopwatch(unsigned int warmup_count = 0) : warmup_count(warmup_count) {}
+
+    template <typename Function>
+    auto measure(Function && function) {
+        const auto start = Clock::now();
+        if constexpr (std::is_void_v<decltype(function())>) {
+            function();
+            add(Clock::now() - start);
+        } else {
+            auto ret = function();
+            add(Clock::now() - start);
+            return ret;
+        }
+    }
+
+    Measurement get_measurement(unsigned int size) const {
+        if (samples_us.empty()) {
+            return {size, 0, 0, 0};
+        }
+        auto sorted = samples_us;
+        std::sort(sorted.begin(), sorted.end());
+        const auto percentile = [&sorted](double fraction) {
+            return sorted[static_cast<std::size_t>(fraction * (sorted.size() - 1) + 0.5)];
+        };
+        return {size, percentile(0.5), percentile(0.9), sorted.back()};
+    }
+
+private:
+    void add(Clock::duration duration) {
+        if (warmup_count > 0) {
+            --warmup_count;
+            return;
+        }
+        samples_us.push_back(std::chrono::duration<double, std::micro>(duration).count());
+    }
+
+    unsigned int warmup_count;
+    std::vector<double> samples_us;
+};
+
+
+// Creates empty files `names` in directory `dir`.
+void create_files(const std::filesystem::path & dir, const std::vector<std::string> & names) {
+    std::filesystem::create_directories(dir);
+    for (const auto & name : names) {
+        std::ofstream file(dir / name);
+        if (!file) {
+            throw std::runtime_error("Cannot create file: " + (dir / name).string());
+        }
+    }
+}
+
+
+// Returns `count` long names sharing the same 8 character prefix. All of them collide in the 8.3 name.
+std::vector<std::string> create_colliding_names(unsigned int count) {
+    std::vector<std::string> names;
+    names.reserve(count);
+    for (unsigned int i = 0; i < count; ++i) {
+        names.push_back(std::format("sharedprefix_{:06}.txt", i));
+    }
+    return names;
+}
+
+
+// Returns `count` valid 8.3 names, no conversion is needed.
+std::vector<std::string> create_short_names(unsigned int count) {
+    std::vector<std::string> names;
+    names.reserve(count);
+    for (unsigned int i = 0; i < count; ++i) {
+        names.push_back(std::format("f{:07}.txt", i));
+    }
+    return names;
+}
+
+
+std::unique_ptr<Drive> create_drive(const std::filesystem::path & root) {
+    auto drive = std::make_unique<Drive>();
+    drive->set_root(root);
+    drive->set_attrs_mode(AttrsMode::IGNORE);
+    return drive;
+}
+
+
+// FIND_FIRST in a directory whose long names share an 8 character prefix.
+// Each FIND_FIRST recreates the directory listing, the 8.3 aliases must be generated for all entries.
+Measurement bench_find_first_colliding_names(const std::filesystem::path & work_dir, unsigned int size) {
+    const auto root = work_dir / std::format("collide_{}", size);
+    create_files(root, create_colliding_names(size));
+
+    auto drive = create_drive(root);
+    const auto handle = drive->get_handle(root);
+    const auto mask = short_name_to_fcb("????????.???");
+    Stopwatch stopwatch(1);
+    for (int i = 0; i < 1 + FIND_FIRST_COLLIDING_REPEAT_COUNT; ++i) {
+        DosFileProperties properties;
+        uint16_t nth = 0;
+        stopwatch.measure([&] { drive->find_file(handle, mask, FAT_ARCHIVE, properties, nth); });
+    }
+    return stopwatch.get_measurement(size);
+}
+
+
+// FIND_NEXT for a mask matching only the last entry of the directory.
+// The search continues from `nth` and must skip all the other entries.
+Measurement bench_find_next_sparse_match(const std::filesystem::path & work_dir, unsigned int size) {
+    const auto root = work_dir / std::format("sparse_{}", size);
+    auto names = create_short_names(size - 1);
+    names.push_back("zlast.txt");
+    create_files(root, names);
+
+    auto drive = create_drive(root);
+    const auto handle = drive->get_handle(root);
+    const auto all_mask = short_name_to_fcb("????????.???");
+    const auto last_mask = short_name_to_fcb("z*.*");
+
+    DosFileProperties properties;
+    uint16_t nth = 0;
+    drive->find_file(handle, all_mask, FAT_ARCHIVE, properties, nth);  // FIND_FIRST creates the listing
+
+    Stopwatch stopwatch(WARMUP_COUNT);
+    for (int i = 0; i < WARMUP_COUNT + REPEAT_COUNT; ++i) {
+        uint16_t next_nth = nth;
+        stopwatch.measure([&] { drive->find_file(handle, last_mask, FAT_ARCHIVE, properties, next_nth); });
+    }
+    return stopwatch.get_measurement(size);
+}
+
+
+// FIND_NEXT enumeration of the whole directory, each FIND_NEXT is one measurement.
+Measurement bench_find_next_enumeration(const std::filesystem::path & work_dir, unsigned int size) {
+    const auto root = work_dir / std::format("enum_{}", size);
+    create_files(root, create_short_names(size));
+
+    auto drive = create_drive(root);
+    const auto handle = drive->get_handle(root);
+    const auto mask = short_name_to_fcb("????????.???");
+
+    DosFileProperties properties;
+    uint16_t nth = 0;
+    drive->find_file(handle, mask, FAT_ARCHIVE, properties, nth);  // FIND_FIRST creates the listing
+
+    Stopwatch stopwatch;
+    while (stopwatch.measure([&] { return drive->find_file(handle, mask, FAT_ARCHIVE, properties, nth); })) {
+    }
+    return stopwatch.get_measurement(size);
+}
+
+
+// Translation of a client path to the server path in a large directory (`get_server_name` lookup).
+Measurement bench_server_name_lookup(const std::filesystem::path & work_dir, unsigned int size) {
+    const auto root = work_dir / std::format("lookup_{}", size);
+    const auto names = create_short_names(size);
+    create_files(root, names);
+
+    auto drive = create_drive(root);
+    drive->create_server_path(names[0]);  // creates the listing
+
+    const unsigned int step = std::max(1U, size / LOOKUP_SAMPLES);
+    const unsigned int samples_per_pass = size / step;
+    Stopwatch stopwatch(WARMUP_COUNT * samples_per_pass);
+    for (int pass = 0; pass < WARMUP_COUNT + REPEAT_COUNT; ++pass) {
+        for (unsigned int i = step - 1; i < size; i += step) {
+            stopwatch.measure([&] { drive->create_server_path(names[i]); });
+        }
+    }
+    return stopwatch.get_measurement(size);
+}
+
+
+// Handle assignment with `size` handles in use (`get_handle`).
+Measurement bench_get_handle(const std::filesystem::path & work_dir, unsigned int size) {
+    const auto root = work_dir / std::format("handles_{}", size);
+    std::filesystem::create_directories(root);
+
+    auto drive = create_drive(root);
+    for (unsigned int i = 0; i < size; ++i) {
+        drive->get_handle(root / std::format("item{}", i));
+    }
+
+    Stopwatch stopwatch(2 * WARMUP_COUNT);
+    for (int i = 0; i < WARMUP_COUNT + REPEAT_COUNT; ++i) {
+        // an already assigned path and a new path
+        stopwatch.measure([&] { drive->get_handle(root / std::format("item{}", size - 1)); });
+        stopwatch.measure([&] { drive->get_handle(root / std::format("new{}", i)); });
+    }
+    return stopwatch.get_measurement(size);
+}
+
+
+// Returns the exponent `k` of the least squares fit of `median_us` = c * size^k.
+double estimate_exponent(const std::vector<Measurement> & measurements) {
+    double sum_x = 0, sum_y = 0, sum_xx = 0, sum_xy = 0;
+    for (const auto & measurement : measurements) {
+        const double x = std::log(static_cast<double>(measurement.size));
+        const double y = std::log(std::max(measurement.median_us, 0.001));
+        sum_x += x;
+        sum_y += y;
+        sum_xx += x * x;
+        sum_xy += x * y;
+    }
+    const double n = measurements.size();
+    const double denominator = n * sum_xx - sum_x * sum_x;
+    return denominator != 0 ? (n * sum_xy - sum_x * sum_y) / denominator : 0;
+}
+
+
+struct Scenario {
+    const char * name;
+    std::function<Measurement(const std::filesystem::path &, unsigned int)> function;
+    unsigned int max_size;  // limit given by the server implementation
+    double max_exponent;    // threshold of the scenario, 0 = the common threshold
+};
+
+
+void print_help(const char * program_name) {
+    print(
+        stdout,
+        "Usage:\n"
+        "{} [--help] [--sizes=<N1,N2,...>] [--max-exponent=<EXPONENT>] [--work-dir=<PATH>]\n\n"
+        "Options:\n"
+        "  --help                      Display this help\n"
+        "  --sizes=<N1,N2,...>         Input sizes (number of entries), at least two (default: 1000,2000,4000,8000)\n"
+        "  --max-exponent=<EXPONENT>   Fail if a scaling exponent exceeds this value (default: {}),\n"
+        "                              FIND_FIRST with colliding names has its own threshold {}\n"
+        "  --work-dir=<PATH>           Directory for generated files, removed at exit (default: system temp)\n",
+        program_name,
+        DEFAULT_MAX_EXPONENT,
+        FIND_FIRST_COLLIDING_MAX_EXPONENT);
+}
+
+}  // namespace
+
+}  // namespace netmount_srv
+
+
+using namespace netmount_srv;
+int main(int argc, char ** argv) {
+    std::vector<unsigned int> sizes = DEFAULT_SIZES;
+    double max_exponent = DEFAULT_MAX_EXPONENT;
+    std::filesystem::path work_dir =
+        std::filesystem::temp_directory_path() / std::format("netmount-bench-{}", static_cast<long>(getpid()));
+
+    for (int i = 1; i < argc; ++i) {
+        std::string_view arg(argv[i]);
+        if (arg == "--help") {
+            print_help(argv[0]);
+            return 0;
+        }
+        if (arg.starts_with("--sizes=")) {
+            sizes.clear();
+            const char * ptr = argv[i] + 8;
+            while (*ptr != '\0') {
+                char * end = nullptr;
+                const auto size = std::strtol(ptr, &end, 10);
+                if (size < 2 || size > 0xFFFE || (*end != ',' && *end != '\0')) {
+                    print(stdout, "Invalid size in \"{}\". Valid values are in the 2-{} range.\n", arg, 0xFFFE);
+                    return -1;
+                }
+                sizes.push_back(size);
+                ptr = *end == ',' ? end + 1 : end;
+            }
+            continue;
+        }
+        if (arg.starts_with("--max-exponent=")) {
+            char * end = nullptr;
+            max_exponent = std::strtod(argv[i] + 15, &end);
+            if (max_exponent <= 0 || *end != '\0') {
+                print(stdout, "Invalid maximum exponent \"{}\"\n", argv[i] + 15);
+                return -1;
+            }
+            continue;
+        }
+        if (arg.starts_with("--work-dir=")) {
+            work_dir = std::filesystem::path(arg.substr(11)) /
+                       std::format("netmount-bench-{}", static_cast<long>(getpid()));
+            continue;
+        }
+        print(stdout, "Unknown argument \"{}\"\n", arg);
+        return -1;
+    }
+    std::sort(sizes.begin(), sizes.end());
+    sizes.erase(std::unique(sizes.begin(), sizes.end()), sizes.end());
+    if (sizes.size() < 2) {
+        print(stdout, "At least two different sizes are needed to estimate the scaling exponent\n");
+        return -1;
+    }
+
+    global_log_level = LogLevel::ERROR;
+
+    const Scenario scenarios[] = {
+        // The 8.3 alias generation supports suffixes up to ~9999.
+        {"FIND_FIRST, long names with a shared 8 char prefix",
+         bench_find_first_colliding_names,
+         9999,
+         FIND_FIRST_COLLIDING_MAX_EXPONENT},
+        {"FIND_NEXT, only the last entry matches", bench_find_next_sparse_match, 0xFFFE, 0},
+        {"FIND_NEXT, enumeration of the directory", bench_find_next_enumeration, 0xFFFE, 0},
+        {"server name lookup in a large directory", bench_server_name_lookup, 0xFFFE, 0},
+        {"get_handle with many handles in use", bench_get_handle, 0xFFFE, 0},
+    };
+
+    bool failed = false;
+    try {
+        for (const auto & scenario : scenarios) {
+            print(stdout, "{}\n", scenario.name);
+            print(stdout, "{:>10} {:>14} {:>14} {:>14}\n", "entries", "median [us]", "p90 [us]", "worst [us]");
+            std::vector<Measurement> measurements;
+            for (const auto size : sizes) {
+                if (size > scenario.max_size) {
+                    continue;
+                }
+                const auto measurement = scenario.function(work_dir, size);
+                print(
+                    stdout,
+                    "{:>10} {:>14.1f} {:>14.1f} {:>14.1f}\n",
+                    size,
+                    measurement.median_us,
+                    measurement.p90_us,
+                    measurement.worst_us);
+                std::fflush(stdout);
+                measurements.push_back(measurement);
+            }
+            std::filesystem::remove_all(work_dir);
+
+            if (measurements.size() < 2) {
+                print(stdout, "  not enough sizes for this scenario\n\n");
+                continue;
+            }
+            const auto exponent = estimate_exponent(measurements);
+            const auto scenario_max_exponent = scenario.max_exponent > 0 ? scenario.max_exponent : max_exponent;
+            const bool ok = exponent <= scenario_max_exponent;
+            failed |= !ok;
+            print(
+                stdout,
+                "  scaling exponent {:.2f} (max {:.2f}): {}\n\n",
+                exponent,
+                scenario_max_exponent,
+                ok ? "OK" : "FAIL");
+        }
+    } catch (const std::exception & ex) {
+        print(stdout, "Benchmark failed: {}\n", ex.what());
+        std::error_code ec;
+        std::filesystem::remove_all(work_dir, ec);
+        return -1;
+    }
+
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,152 @@
+// SPDX-License-Identifier: GPL-2.0-only
+// Copyright 2025-2026 Jaroslav Rohel, jaroslav.rohel@gmail.com
+
+#include "content_cache.hpp"
+
+#include <string.h>
+
+#include <algorithm>
+#include <iterator>
+
+namespace netmount_srv {
+
+ContentCache::ContentCache(std::size_t capacity) : capacity(capacity) {}
+
+
+bool ContentCache::is_cacheable(std::uint64_t size) const noexcept {
+    // A single file must not take more than a quarter of the cache.
+    return size > 0 && size <= MAX_FILE_SIZE && size <= capacity / 4;
+}
+
+
+std::uint64_t ContentCache::hash_data(const std::vector<std::uint8_t> & data) noexcept {
+    // FNV-1a
+    std::uint64_t hash = 0xCBF29CE484222325ULL;
+    for (const auto byte : data) {
+        hash ^= byte;
+        hash *= 0x100000001B3ULL;
+    }
+    return hash;
+}
+
+
+std::int32_t ContentCache::read(const FileId & id, void * buffer, std::uint32_t offset, std::uint16_t len) {
+    std::lock_guard lock(mutex);
+    const auto file_it = files.find({id.dev, id.ino});
+    if (file_it == files.end()) {
+        ++statistics.misses;
+        return -1;
+    }
+    if (file_it->second.id != id) {
+        // The file was changed by another program on the server.
+        remove_file(file_it);
+        ++statistics.misses;
+        return -1;
+    }
+
+    const auto & file = file_it->second;
+    contents.splice(contents.begin(), contents, file.content);
+    const auto & data = file.content->data;
+    const auto res = offset < data.size() ? std::min<std::size_t>(len, data.size() - offset) : 0;
+    memcpy(buffer, data.data() + offset, res);
+
+    ++statistics.hits;
+    statistics.hit_bytes += res;
+    if (file.shared) {
+        statistics.shared_hit_bytes += res;
+    }
+    return static_cast<std::int32_t>(res);
+}
+
+
+void ContentCache::store(const FileId & id, std::vector<std::uint8_t> data) {
+    std::lock_guard lock(mutex);
+    const FileKey key{id.dev, id.ino};
+    const auto old_file_it = files.find(key);
+    if (old_file_it != files.end()) {
+        remove_file(old_file_it);
+    }
+
+    const auto hash = hash_data(data);
+    auto content = contents.end();
+    const auto [first, last] = contents_by_hash.equal_range(hash);
+    for (auto it = first; it != last; ++it) {
+        if (it->second->data == data) {
+            content = it->second;
+            break;
+        }
+    }
+
+    const bool shared = content != contents.end();
+    if (shared) {
+        contents.splice(contents.begin(), contents, content);
+    } else {
+        make_room(data.size());
+        used_bytes += data.size();
+        content = contents.insert(contents.begin(), Content{hash, std::move(data), {}});
+        contents_by_hash.emplace(hash, content);
+    }
+    content->files.push_back(key);
+    files.emplace(key, File{id, content, shared});
+}
+
+
+void ContentCache::invalidate(std::uint64_t dev, std::uint64_t ino) {
+    std::lock_guard lock(mutex);
+    const auto file_it = files.find({dev, ino});
+    if (file_it != files.end()) {
+        remove_file(file_it);
+    }
+}
+
+
+void ContentCache::remove_file(std::map<FileKey, File>::iterator file_it) {
+    const auto content = file_it->second.content;
+    auto & content_files = content->files;
+    content_files.erase(std::find(content_files.begin(), content_files.end(), file_it->first));
+    files.erase(file_it);
+    if (content_files.empty()) {
+        remove_content(content);
+    }
+}
+
+
+void ContentCache::remove_content(ContentList::iterator content) {
+    for (const auto & key : content->files) {
+        files.erase(key);
+    }
+    const auto [first, last] = contents_by_hash.equal_range(content->hash);
+    for (auto it = first; it != last; ++it) {
+        if (it->second == content) {
+            contents_by_hash.erase(it);
+            break;
+        }
+    }
+    used_bytes -= content->data.size();
+    contents.erase(content);
+}
+
+
+void ContentCache::make_room(std::size_t size) {
+    while (!contents.empty() && used_bytes + size > capacity) {
+        remove_content(std::prev(contents.end()));
+        ++statistics.evictions;
+    }
+}
+
+
+ContentCache::Statistics ContentCache::get_statistics() const {
+    std::lock_guard lock(mutex);
+    auto ret = statistics;
+    ret.files = files.size();
+    ret.contents = contents.size();
+    ret.bytes = used_bytes;
+    std::size_t files_bytes = 0;
+    for (const auto & [key, file] : files) {
+        files_bytes += file.id.size;
+    }
+    ret.shared_bytes = files_bytes - used_bytes;
+    return ret;
+}
+
+}  // namespace netmount_srv
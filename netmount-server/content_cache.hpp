@@ -0,0 +1,115 @@
+// SPDX-License-Identifier: GPL-2.0-only
+// Copyright 2025-2026 Jaroslav Rohel, jaroslav.rohel@gmail.com
+
+// Cache of file contents shared by the files with identical content.
+
+#ifndef _CONTENT_CACHE_HPP_
+#define _CONTENT_CACHE_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <map>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace netmount_srv {
+
+// Keeps the content of small files in memory. The cache is shared by all drives.
+// A file is identified by its device, inode, modification and change times and size. The file content
+// is stored under a hash of the data. Identical files (e.g. copies of the same runtime in many
+// directories) share one copy of the content, which stays cached as long as any of the files is used.
+// Contents with the same hash are compared byte by byte before they are shared, a hash collision
+// therefore never returns another file's data.
+// Contents are released in the least recently used order when the capacity is exceeded.
+// The cache is thread-safe, the storage workers of the drives use it concurrently.
+class ContentCache {
+public:
+    struct FileId {
+        std::uint64_t dev;
+        std::uint64_t ino;
+        std::int64_t mtime_ns;
+        std::int64_t ctime_ns;
+        std::uint64_t size;
+
+        bool operator==(const FileId &) const = default;
+    };
+
+    struct Statistics {
+        std::uint64_t hits{0};              // reads served from the cache
+        std::uint64_t misses{0};            // reads of cacheable files that were not cached
+        std::uint64_t hit_bytes{0};         // bytes served from the cache
+        std::uint64_t shared_hit_bytes{0};  // bytes served to files whose content was loaded through another file
+        std::uint64_t evictions{0};         // contents released to free space
+        std::size_t files{0};               // current number of cached files
+        std::size_t contents{0};            // current number of distinct contents
+        std::size_t bytes{0};               // current size of the contents
+        std::size_t shared_bytes{0};        // current size of the files above `bytes` (saved by sharing)
+    };
+
+    // Files larger than this are not cached.
+    constexpr static std::size_t MAX_FILE_SIZE = 4 * 1024 * 1024;
+
+    // `capacity` - maximum total size of the contents in bytes
+    explicit ContentCache(std::size_t capacity);
+
+    ContentCache(const ContentCache &) = delete;
+    ContentCache & operator=(const ContentCache &) = delete;
+
+    // Returns true if a file of `size` bytes can be cached.
+    bool is_cacheable(std::uint64_t size) const noexcept;
+
+    // Copies up to `len` bytes from `offset` of the file `id` to `buffer`.
+    // Returns the number of bytes copied, or -1 if the file is not cached.
+    std::int32_t read(const FileId & id, void * buffer, std::uint32_t offset, std::uint16_t len);
+
+    // Stores the content of the file `id`. If the same content is already cached, it is shared.
+    void store(const FileId & id, std::vector<std::uint8_t> data);
+
+    // Removes the file `dev`, `ino`. Used when the file is changed by the server.
+    void invalidate(std::uint64_t dev, std::uint64_t ino);
+
+    Statistics get_statistics() const;
+
+private:
+    using FileKey = std::pair<std::uint64_t, std::uint64_t>;  // device, inode
+
+    struct Content {
+        std::uint64_t hash;
+        std::vector<std::uint8_t> data;
+        std::vector<FileKey> files;  // files with this content
+    };
+    using ContentList = std::list<Content>;  // the most recently used first
+
+    struct File {
+        FileId id;
+        ContentList::iterator content;
+        bool shared;  // the content was already cached when the file was stored
+    };
+
+    // Returns a hash of `data`.
+    static std::uint64_t hash_data(const std::vector<std::uint8_t> & data) noexcept;
+
+    // Removes the file `file_it`, its content is released if no other file uses it.
+    void remove_file(std::map<FileKey, File>::iterator file_it);
+
+    // Releases the content and removes the files using it.
+    void remove_content(ContentList::iterator content);
+
+    // Releases the least recently used contents until `size` bytes fit into the capacity.
+    void make_room(std::size_t size);
+
+    mutable std::mutex mutex;
+    std::size_t capacity;
+    std::size_t used_bytes{0};
+    ContentList contents;
+    std::unordered_multimap<std::uint64_t, ContentList::iterator> contents_by_hash;
+    std::map<FileKey, File> files;
+    Statistics statistics;
+};
+
+}  // namespace netmount_srv
+
+#endif
@@ -0,0 +1,236 @@
+// SPDX-License-Identifier: GPL-2.0-only
+// Copyright 2025-2026 Jaroslav Rohel, jaroslav.rohel@gmail.com
+
+#include "front_coded_names.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <numeric>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+
+namespace netmount_srv {
+
+namespace {
+
+using string_type = FrontCodedNames::string_type;
+using unit_type = std::make_unsigned_t<string_type::value_type>;
+
+// Lengths are stored in 7 bits per string unit, the highest bit marks a continuation.
+void append_length(string_type & data, std::size_t value) {
+    while (value >= 0x80) {
+        data.push_back(static_cast<string_type::value_type>(0x80 | (value & 0x7F)));
+        value >>= 7;
+    }
+    data.push_back(static_cast<string_type::value_type>(value));
+}
+
+
+std::size_t read_length(const string_type & data, std::size_t & offset) noexcept {
+    std::size_t value = 0;
+    for (unsigned shift = 0;; shift += 7) {
+        const auto unit = static_cast<unit_type>(data[offset++]);
+        value |= static_cast<std::size_t>(unit & 0x7F) << shift;
+        if ((unit & 0x80) == 0) {
+            return value;
+        }
+    }
+}
+
+
+std::int64_t now_ns() noexcept {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+}  // namespace
+
+
+FrontCodedNames::FrontCodedNames(const std::vector<string_type> & names, Statistics & statistics)
+    : statistics(&statistics) {
+    const auto count = names.size();
+    sorted_to_list.resize(count);
+    std::iota(sorted_to_list.begin(), sorted_to_list.end(), 0);
+    std::sort(sorted_to_list.begin(), sorted_to_list.end(), [&names](std::uint16_t a, std::uint16_t b) {
+        return names[a] < names[b];
+    });
+
+    list_to_sorted.resize(count);
+    block_offsets.reserve((count + BLOCK_SIZE - 1) / BLOCK_SIZE);
+    const string_type * prev_name = nullptr;
+    for (std::size_t pos = 0; pos < count; ++pos) {
+        const auto & name = names[sorted_to_list[pos]];
+        list_to_sorted[sorted_to_list[pos]] = static_cast<std::uint16_t>(pos);
+        std::size_t prefix_len = 0;
+        if (pos % BLOCK_SIZE == 0) {
+            block_offsets.push_back(static_cast<std::uint32_t>(data.size()));
+        } else {
+            const auto max_prefix_len = std::min(prev_name->size(), name.size());
+            while (prefix_len < max_prefix_len && (*prev_name)[prefix_len] == name[prefix_len]) {
+                ++prefix_len;
+            }
+        }
+        append_length(data, prefix_len);
+        append_length(data, name.size() - prefix_len);
+        data.append(name, prefix_len);
+        raw_bytes += name.size() * sizeof(string_type::value_type);
+        prev_name = &name;
+    }
+    data.shrink_to_fit();
+    stored_bytes = get_memory_usage();
+
+    ++statistics.lists;
+    statistics.names += count;
+    statistics.raw_bytes += raw_bytes;
+    statistics.stored_bytes += stored_bytes;
+}
+
+
+FrontCodedNames::FrontCodedNames(FrontCodedNames && other) noexcept
+    : data(std::move(other.data)),
+      block_offsets(std::move(other.block_offsets)),
+      list_to_sorted(std::move(other.list_to_sorted)),
+      sorted_to_list(std::move(other.sorted_to_list)),
+      statistics(std::exchange(other.statistics, nullptr)),
+      raw_bytes(other.raw_bytes),
+      stored_bytes(other.stored_bytes) {}
+
+
+FrontCodedNames & FrontCodedNames::operator=(FrontCodedNames && other) noexcept {
+    if (this != &other) {
+        release_statistics();
+        data = std::move(other.data);
+        block_offsets = std::move(other.block_offsets);
+        list_to_sorted = std::move(other.list_to_sorted);
+        sorted_to_list = std::move(other.sorted_to_list);
+        statistics = std::exchange(other.statistics, nullptr);
+        raw_bytes = other.raw_bytes;
+        stored_bytes = other.stored_bytes;
+    }
+    return *this;
+}
+
+
+void FrontCodedNames::release_statistics() noexcept {
+    if (!statistics) {
+        return;
+    }
+    --statistics->lists;
+    statistics->names -= sorted_to_list.size();
+    statistics->raw_bytes -= raw_bytes;
+    statistics->stored_bytes -= stored_bytes;
+    statistics = nullptr;
+}
+
+
+string_type FrontCodedNames::decode(std::size_t sorted_pos) const {
+    const auto block = sorted_pos / BLOCK_SIZE;
+    std::size_t offset = block_offsets[block];
+    string_type name;
+    for (auto pos = block * BLOCK_SIZE;; ++pos) {
+        const auto prefix_len = read_length(data, offset);
+        const auto suffix_len = read_length(data, offset);
+        name.resize(prefix_len);
+        name.append(data, offset, suffix_len);
+        offset += suffix_len;
+        if (pos == sorted_pos) {
+            return name;
+        }
+    }
+}
+
+
+void FrontCodedNames::record_decode(std::int64_t start_ns, std::size_t steps) const noexcept {
+    const auto time_ns = static_cast<std::uint64_t>(now_ns() - start_ns);
+    ++statistics->decodes;
+    statistics->decode_steps += steps;
+    statistics->decode_time_ns += time_ns;
+    statistics->max_decode_time_ns = std::max(statistics->max_decode_time_ns, time_ns);
+}
+
+
+string_type FrontCodedNames::get(std::size_t index) const {
+    const auto start_ns = now_ns();
+    const auto sorted_pos = list_to_sorted[index];
+    auto name = decode(sorted_pos);
+    record_decode(start_ns, sorted_pos % BLOCK_SIZE + 1);
+    return name;
+}
+
+
+bool FrontCodedNames::equals(std::size_t index, const string_type & name) const {
+    return decode(list_to_sorted[index]) == name;
+}
+
+
+std::int32_t FrontCodedNames::find(const string_type & name) const {
+    if (block_offsets.empty()) {
+        return -1;
+    }
+    const auto start_ns = now_ns();
+
+    // The first name of a block is stored in full, find the last block starting with a name not above `name`.
+    const auto block_head = [this](std::size_t block) {
+        std::size_t offset = block_offsets[block];
+        read_length(data, offset);  // prefix length, always 0
+        const auto len = read_length(data, offset);
+        return std::basic_string_view<string_type::value_type>(data.data() + offset, len);
+    };
+    std::size_t low = 0;
+    std::size_t high = block_offsets.size();
+    while (high - low > 1) {
+        const auto mid = (low + high) / 2;
+        if (block_head(mid) <= name) {
+            low = mid;
+        } else {
+            high = mid;
+        }
+    }
+
+    // Decode the block until `name` or a name above it is reached.
+    std::int32_t ret = -1;
+    std::size_t steps = 0;
+    std::size_t offset = block_offsets[low];
+    const auto end_pos = std::min((low + 1) * BLOCK_SIZE, sorted_to_list.size());
+    string_type decoded;
+    for (auto pos = low * BLOCK_SIZE; pos < end_pos; ++pos) {
+        const auto prefix_len = read_length(data, offset);
+        const auto suffix_len = read_length(data, offset);
+        decoded.resize(prefix_len);
+        decoded.append(data, offset, suffix_len);
+        offset += suffix_len;
+        ++steps;
+        if (decoded == name) {
+            if (sorted_to_list[pos] != NO_INDEX) {
+                ret = sorted_to_list[pos];
+            }
+            break;
+        }
+        if (decoded > name) {
+            break;
+        }
+    }
+    record_decode(start_ns, steps);
+    return ret;
+}
+
+
+void FrontCodedNames::erase(std::size_t index) {
+    sorted_to_list[list_to_sorted[index]] = NO_INDEX;
+    list_to_sorted.erase(list_to_sorted.begin() + index);
+    for (auto & list_index : sorted_to_list) {
+        if (list_index != NO_INDEX && list_index > index) {
+            --list_index;
+        }
+    }
+}
+
+
+std::size_t FrontCodedNames::get_memory_usage() const noexcept {
+    return data.capacity() * sizeof(string_type::value_type) + block_offsets.capacity() * sizeof(std::uint32_t) +
+           (list_to_sorted.capacity() + sorted_to_list.capacity()) * sizeof(std::uint16_t);
+}
+
+}  // namespace netmount_srv
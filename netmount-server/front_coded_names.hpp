@@ -0,0 +1,95 @@
+// SPDX-License-Identifier: GPL-2.0-only
+// Copyright 2025-2026 Jaroslav Rohel, jaroslav.rohel@gmail.com
+
+// Compressed store of the file names of a directory listing.
+
+#ifndef _FRONT_CODED_NAMES_HPP_
+#define _FRONT_CODED_NAMES_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <vector>
+
+namespace netmount_srv {
+
+// Keeps the names of a directory listing front-coded. The names are sorted and split into blocks of
+// BLOCK_SIZE names. The first name of a block is stored in full, each following name as the length of the prefix
+// shared with the previous name and the rest of the name. Names of large directories often share long prefixes
+// (e.g. "IMG_2024_05_..."), only the differing suffixes are stored.
+// A name is addressed by its index in the listing. Decoding a name takes at most BLOCK_SIZE steps, looking up
+// a name needs a binary search over the first names of the blocks and the decoding of one block.
+class FrontCodedNames {
+public:
+    using string_type = std::filesystem::path::string_type;
+
+    // Counters shared by all the stores of a drive. The first four describe the stores that currently exist,
+    // a store adds its values when it is built and subtracts them when it is destroyed or replaced.
+    struct Statistics {
+        std::uint64_t lists{0};           // number of compressed listings
+        std::uint64_t names{0};           // number of compressed names
+        std::uint64_t raw_bytes{0};       // size of the names before compression
+        std::uint64_t stored_bytes{0};    // size of the compressed names including the indexes
+        std::uint64_t decodes{0};         // number of `get` and `find` calls
+        std::uint64_t decode_steps{0};    // names decoded by `get` and `find`
+        std::uint64_t decode_time_ns{0};  // time spent in `get` and `find`
+        std::uint64_t max_decode_time_ns{0};
+    };
+
+    // Number of names in a block. Bounds the decoding cost of a name.
+    constexpr static std::size_t BLOCK_SIZE = 16;
+
+    FrontCodedNames() = default;
+
+    // Builds the store from `names` in the listing order, the index of a name is its position in `names`.
+    // The counters of the store are added to `statistics`, the store updates them on decoding.
+    FrontCodedNames(const std::vector<string_type> & names, Statistics & statistics);
+
+    FrontCodedNames(FrontCodedNames && other) noexcept;
+    FrontCodedNames & operator=(FrontCodedNames && other) noexcept;
+    ~FrontCodedNames() { release_statistics(); }
+
+    bool empty() const noexcept { return list_to_sorted.empty(); }
+    std::size_t size() const noexcept { return list_to_sorted.size(); }
+
+    // Returns the name at `index` of the listing.
+    string_type get(std::size_t index) const;
+
+    // Returns true if the name at `index` of the listing is `name`. Not counted in the statistics, used to compare
+    // listings on the server side.
+    bool equals(std::size_t index, const string_type & name) const;
+
+    // Returns the listing index of `name`, or -1 if it is not stored.
+    std::int32_t find(const string_type & name) const;
+
+    // Removes the name at `index` of the listing, the indexes of the following names decrease by one.
+    // The encoded name is kept, it is only unreachable.
+    void erase(std::size_t index);
+
+    // Returns the memory used by the store.
+    std::size_t get_memory_usage() const noexcept;
+
+private:
+    constexpr static std::uint16_t NO_INDEX = 0xFFFF;
+
+    // Decodes the names of the block of the sorted position `sorted_pos` up to `sorted_pos`, returns the last one.
+    string_type decode(std::size_t sorted_pos) const;
+
+    // Records a decoding that started at `start_ns` and decoded `steps` names.
+    void record_decode(std::int64_t start_ns, std::size_t steps) const noexcept;
+
+    // Subtracts the values added by the store from the statistics.
+    void release_statistics() noexcept;
+
+    string_type data;                           // encoded names: prefix length, suffix length, suffix
+    std::vector<std::uint32_t> block_offsets;   // offset of each block in `data`
+    std::vector<std::uint16_t> list_to_sorted;  // sorted position of each name of the listing
+    std::vector<std::uint16_t> sorted_to_list;  // listing index of each sorted position, NO_INDEX if erased
+    Statistics * statistics{nullptr};
+    std::size_t raw_bytes{0};     // value added to `statistics->raw_bytes`
+    std::size_t stored_bytes{0};  // value added to `statistics->stored_bytes`
+};
+
+}  // namespace netmount_srv
+
+#endif
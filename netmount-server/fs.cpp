@@ -3,31 +3,53 @@
 
 #include "fs.hpp"
 
+#include "content_cache.hpp"
 #include "logger.hpp"
+#include "shared_dir_cache.hpp"
 #include "unicode_to_ascii.hpp"
 #include "utils.hpp"
 
+#ifndef _WIN32
+#include <dirent.h>
+#endif
 #include <errno.h>
-#ifdef __linux__
+#ifndef _WIN32
 #include <fcntl.h>
+#endif
+#ifdef __linux__
 #include <linux/msdos_fs.h>
+#if __has_include(<linux/openat2.h>)
+#include <linux/openat2.h>
+#endif
 #endif
 #include <stdio.h>
 #ifdef __linux__
+#include <linux/fiemap.h>
+#include <linux/fs.h>
+#include <sys/inotify.h>
 #include <sys/ioctl.h>
+#include <sys/syscall.h>
 #endif
 #include <sys/stat.h>
 #include <time.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <atomic>
 #include <chrono>
 #include <compare>
 #include <exception>
 #include <format>
 #include <fstream>
 #include <string_view>
+#include <system_error>
+#include <thread>
 #include <tuple>
 
+#if defined(__linux__) && defined(SYS_openat2) && defined(RESOLVE_BENEATH)
+#define HAVE_OPENAT2 1
+#endif
+
 
 std::strong_ordering operator<=>(const fcb_file_name & lhs, const fcb_file_name & rhs) noexcept {
     auto ret = strncmp(
@@ -52,10 +74,42 @@ namespace netmount_srv {
 
 namespace {
 
+#ifndef _WIN32
+#ifdef O_PATH
+// Directory descriptors are used only as a starting point for *at() calls, they do not need read access.
+constexpr int DIR_FD_OPEN_FLAGS = O_PATH | O_DIRECTORY;
+#else
+constexpr int DIR_FD_OPEN_FLAGS = O_RDONLY | O_DIRECTORY;
+#endif
+
+#ifdef HAVE_OPENAT2
+// openat2 fails with EAGAIN if a concurrent rename changed the tree during the resolution, it is retried.
+constexpr int OPENAT2_EAGAIN_MAX_RETRIES = 8;
+#endif
+#endif
+
+#ifdef _WIN32
 // Fills the DosFileProperties structure if `properties` != nullptr.
 // Returns DOS attributes for `path` or FAT_ERROR_ATTR on error.
 // DOS attr flags: 1=RO 2=HID 4=SYS 8=VOL 16=DIR 32=ARCH 64=DEVICE
 uint8_t get_path_dos_properties(const std::filesystem::path & path, DosFileProperties * properties, AttrsMode mode);
+#else
+// Fills the DosFileProperties structure if `properties` != nullptr.
+// `name` is the file name of `path` in the directory `dir_fd`.
+// Returns DOS attributes for `path` or FAT_ERROR_ATTR on error.
+uint8_t get_path_dos_properties_at(
+    int dir_fd,
+    const std::filesystem::path & name,
+    const std::filesystem::path & path,
+    DosFileProperties * properties,
+    AttrsMode mode);
+
+// Fills the DosFileProperties structure from `st` if `properties` != nullptr.
+// `st` == nullptr means that `path` is a dangling symlink.
+// Returns DOS attributes for `path` or FAT_ERROR_ATTR on error.
+uint8_t stat_to_dos_properties(
+    const struct stat * st, const std::filesystem::path & path, DosFileProperties * properties, AttrsMode mode);
+#endif
 
 // Sets attributes `attrs` on file defined by `path`.
 // Throws exception on error.
@@ -65,6 +119,7 @@ void set_item_attrs(const std::filesystem::path & path, uint8_t attrs, AttrsMode
 // Throws exception on error.
 uint8_t get_item_attrs(const std::filesystem::path & path, AttrsMode mode);
 
+#ifdef _WIN32
 // Creates directory `dir`
 // Throws exception on error.
 void make_dir(const std::filesystem::path & dir);
@@ -73,10 +128,6 @@ void make_dir(const std::filesystem::path & dir);
 // Throws exception on error.
 void delete_dir(const std::filesystem::path & dir);
 
-// Changes the current working directory to `dir`
-// Throws exception on error.
-void change_dir(const std::filesystem::path & dir);
-
 // Creates or truncates a file `path` with attributes `attrs`.
 // Returns properties of created/truncated file.
 // Throws exception on error.
@@ -95,10 +146,66 @@ void delete_file(const std::filesystem::path & file);
 // Renames `old_name` to `new_name`
 // Throws exception on error or if no matching file found
 void rename_file(const std::filesystem::path & old_name, const std::filesystem::path & new_name);
+#else
+// Opens `name` relative to the directory `dir_fd`. If the kernel supports it, the resolution must stay beneath
+// `dir_fd` (neither ".." nor symlinks may escape it) and "magic" links (/proc/PID/fd/...) are refused.
+// Returns the new descriptor, or -1 and sets errno.
+int openat_beneath(int dir_fd, const char * name, int flags, mode_t mode);
+
+// Returns true if `err` is the errno value reported when a resolution escapes the starting directory.
+bool is_beneath_violation(int err);
+
+// Returns a key that orders reads by their position on the device. It is the physical offset of `offset`
+// in the file `fd` if it is known (Linux FIEMAP), otherwise the file order (inode number and `offset`).
+std::tuple<int, uint64_t, uint64_t> get_device_order_key(int fd, uint32_t offset);
+
+// Returns `server_path` relative to `root`, lexically normalized. Returns an empty path for `root` itself.
+// Throws exception if `server_path` is outside `root`.
+std::filesystem::path relative_server_path(
+    const std::filesystem::path & root, const std::filesystem::path & server_path);
+
+// Converts DOS open mode to open() flags.
+// Throws exception on invalid mode.
+int open_mode_to_flags(uint8_t open_mode);
+
+// Throws `std::filesystem::filesystem_error` for errno `err`, so it is reported the same way as errors
+// from `std::filesystem` functions.
+[[noreturn]] void throw_filesystem_error(const char * what, const std::filesystem::path & path, int err);
+
+// Creates directory `name` in `dir_fd`, `dir` is its full path.
+// Throws exception on error.
+void make_dir(int dir_fd, const std::filesystem::path & name, const std::filesystem::path & dir);
+
+// Removes directory `name` from `dir_fd`, `dir` is its full path.
+// Throws exception on error.
+void delete_dir(int dir_fd, const std::filesystem::path & name, const std::filesystem::path & dir);
+
+// Sets attributes `attrs` on the newly created/truncated file `path` opened as `fd`.
+// Returns properties of created/truncated file.
+// Throws exception on error.
+DosFileProperties create_or_truncate_file(int fd, const std::filesystem::path & path, uint8_t attrs, AttrsMode mode);
+
+// Removes file `name` from `dir_fd`, `file` is its full path.
+// Throws exception on error.
+void delete_file(int dir_fd, const std::filesystem::path & name, const std::filesystem::path & file);
+
+// Renames `old_name` in `old_dir_fd` to `new_name` in `new_dir_fd`
+// Throws exception on error
+void rename_file(
+    int old_dir_fd,
+    const std::filesystem::path & old_name,
+    int new_dir_fd,
+    const std::filesystem::path & new_name,
+    const std::filesystem::path & old_path,
+    const std::filesystem::path & new_path);
+#endif
 
 // Returns filesystem total size and free space in bytes, or 0, 0 on error
 std::pair<uint64_t, uint64_t> fs_space_info(const std::filesystem::path & path);
 
+// Returns the sum of the sizes of the files under `root`.
+uint64_t sum_file_sizes(const std::filesystem::path & root);
+
 // Converts lowercase ascii characters to uppercase and removes illegal characters
 // Returns new length and true if file name was shortened
 std::pair<unsigned int, bool> sanitize_short_name(std::string_view in, char * out_buf, unsigned int buf_size);
@@ -135,7 +242,12 @@ bool match_fcb_name_to_mask(const fcb_file_name & mask, const fcb_file_name & na
 // 7 bits 25–31: Year (since 1980, with 0 representing 1980, 1 representing 1981, and so on).
 uint32_t time_to_fat(time_t t) {
     uint32_t res;
-    const struct tm * const ltime = localtime(&t);
+#ifdef _WIN32
+    const struct tm * const ltime = localtime(&t);  // uses a thread-local buffer on Windows
+#else
+    struct tm ltime_buf;  // the storage workers of the drives convert times concurrently
+    const struct tm * const ltime = localtime_r(&t, &ltime_buf);
+#endif
     if (ltime->tm_year < 80) {
         // 1980-01-01 00:00:00 - DOS FAT minimum timestamp
         return ((1U << 5) + 1U) << 16;
@@ -177,6 +289,91 @@ time_t fat_to_time(uint32_t date_time) {
 }
 
 
+// Returns lexically normalized `path` without a trailing directory separator.
+std::filesystem::path normalize_path(const std::filesystem::path & path) {
+    auto ret = path.lexically_normal();
+    if (ret.has_relative_path() && ret.filename().empty()) {
+        ret = ret.parent_path();
+    }
+    return ret;
+}
+
+
+// Tests whether `name` matches `pattern` with the '*' and '?' wildcards. Case insensitive.
+bool match_glob(std::string_view pattern, std::string_view name) {
+    std::size_t pattern_pos = 0;
+    std::size_t name_pos = 0;
+    std::size_t star_pattern_pos = std::string_view::npos;
+    std::size_t star_name_pos = 0;
+    while (name_pos < name.size()) {
+        if (pattern_pos < pattern.size() &&
+            (pattern[pattern_pos] == '?' || ascii_to_upper(pattern[pattern_pos]) == ascii_to_upper(name[name_pos]))) {
+            ++pattern_pos;
+            ++name_pos;
+        } else if (pattern_pos < pattern.size() && pattern[pattern_pos] == '*') {
+            star_pattern_pos = pattern_pos++;
+            star_name_pos = name_pos;
+        } else if (star_pattern_pos != std::string_view::npos) {
+            // let the last '*' match one more character
+            pattern_pos = star_pattern_pos + 1;
+            name_pos = ++star_name_pos;
+        } else {
+            return false;
+        }
+    }
+    while (pattern_pos < pattern.size() && pattern[pattern_pos] == '*') {
+        ++pattern_pos;
+    }
+    return pattern_pos == pattern.size();
+}
+
+
+// Appends the regular files under `dir` matching the pattern `components` (starting at `index`) to `paths`.
+void expand_pin_pattern(
+    const std::filesystem::path & dir,
+    const std::vector<std::string> & components,
+    std::size_t index,
+    std::vector<std::filesystem::path> & paths) {
+    const bool is_last = index + 1 == components.size();
+    for (const auto & dentry : std::filesystem::directory_iterator(dir)) {
+        if (!match_glob(components[index], dentry.path().filename().string())) {
+            continue;
+        }
+        std::error_code ec;
+        if (is_last) {
+            if (dentry.is_regular_file(ec)) {
+                paths.push_back(dentry.path());
+            }
+        } else if (dentry.is_directory(ec)) {
+            expand_pin_pattern(dentry.path(), components, index + 1, paths);
+        }
+    }
+}
+
+
+// Returns true if the directory listings are the same.
+// `lhs_names` are the server names of `lhs` if it is compressed, `rhs` is not compressed.
+bool is_same_directory_list(
+    const std::vector<DosFileProperties> & lhs,
+    const FrontCodedNames & lhs_names,
+    const std::vector<DosFileProperties> & rhs) {
+    if (lhs.size() != rhs.size()) {
+        return false;
+    }
+    for (std::size_t i = 0; i < lhs.size(); ++i) {
+        const auto & l = lhs[i];
+        const auto & r = rhs[i];
+        if (l.size != r.size || l.time_date != r.time_date || l.attrs != r.attrs || !(l.fcb_name == r.fcb_name)) {
+            return false;
+        }
+        if (lhs_names.empty() ? l.server_name != r.server_name : !lhs_names.equals(i, r.server_name.native())) {
+            return false;
+        }
+    }
+    return true;
+}
+
+
 bool is_dangling_symlink(const std::filesystem::path & p) {
     std::error_code ec;
     if (!std::filesystem::is_symlink(p, ec)) {
@@ -191,6 +388,16 @@ bool is_dangling_symlink(const std::filesystem::path & p) {
 }
 
 
+#ifndef _WIN32
+// Returns true if `name` in `dir_fd` is a symlink whose target does not exist.
+bool is_dangling_symlink_at(int dir_fd, const std::filesystem::path & name) {
+    struct stat st;
+    return fstatat(dir_fd, name.c_str(), &st, 0) != 0 && errno == ENOENT &&
+           fstatat(dir_fd, name.c_str(), &st, AT_SYMLINK_NOFOLLOW) == 0 && S_ISLNK(st.st_mode);
+}
+#endif
+
+
 // Computes the canonical depth of a filesystem path.
 // Returns:
 //  - depth >= 0 : number of logical components
@@ -216,10 +423,27 @@ int check_path_depth(const std::filesystem::path & p) {
 }  // namespace
 
 
+#ifndef _WIN32
+void UniqueFd::reset(int new_fd) noexcept {
+    if (fd >= 0) {
+        close(fd);
+    }
+    fd = new_fd;
+}
+#endif
+
+
 void Drive::set_root(std::filesystem::path root) {
     if (used) {
         throw std::runtime_error("already used");
     }
+#ifndef _WIN32
+    const int fd = open(root.c_str(), DIR_FD_OPEN_FLAGS | O_CLOEXEC);
+    if (fd == -1) {
+        throw std::runtime_error(std::format("Cannot open directory \"{}\": {}", root.string(), strerror(errno)));
+    }
+    root_fd.reset(fd);
+#endif
     this->root = std::move(root);
     used = true;
 }
@@ -262,64 +486,227 @@ void Drive::set_volume_label(const std::string & label) {
 
 
 uint16_t Drive::get_handle(const std::filesystem::path & server_path) {
-    uint16_t first_free = items.size();
-    uint16_t oldest = 0;
+    // The same item may be referred to by different paths (e.g. "dir/.." or a trailing separator).
+    const auto relative_path = relative_server_path(get_root(), server_path);
     const time_t now = time(NULL);
+    release_idle_directory_lists(now);
+
+    // walk the tree from the root, the missing items are added
+    bool found = true;
+    if (root_handle == NO_HANDLE) {
+        root_handle = add_item(NO_HANDLE, {}, now);
+        found = false;
+    }
+    uint16_t handle = root_handle;
+    for (const auto & component : relative_path) {
+        const auto & name = component.native();
+        const auto name_it = names.find(name);
+        if (name_it != names.end()) {
+            const auto child_it = child_handles.find({handle, &*name_it});
+            if (child_it != child_handles.end()) {
+                handle = child_it->second;
+                continue;
+            }
+        }
+        handle = add_item(handle, name, now);
+        found = false;
+    }
+    items[handle].last_used_time = now;
+    record_cache_access(CacheStream::HANDLES, handle);
 
-    // see if not already in cache
-    for (uint16_t handle = 0; handle < items.size(); ++handle) {
-        auto & cur_item = items[handle];
+    if (found) {
+        log(LogLevel::DEBUG, "{}: Found handle {} with path \"{}\" in cache\n", __func__, handle, server_path.string());
+    }
+    return handle;
+}
 
-        if (cur_item.path == server_path) {
-            cur_item.last_used_time = now;
-            log(LogLevel::DEBUG,
-                "{}: Found handle {} with path \"{}\" in cache\n",
-                __func__,
-                handle,
-                server_path.string());
-            return handle;
+
+uint16_t Drive::find_handle(const std::filesystem::path & server_path) const {
+    if (root_handle == NO_HANDLE) {
+        return NO_HANDLE;
+    }
+    std::filesystem::path relative_path;
+    try {
+        relative_path = relative_server_path(get_root(), server_path);
+    } catch (const FilesystemError &) {
+        return NO_HANDLE;
+    }
+    uint16_t handle = root_handle;
+    for (const auto & component : relative_path) {
+        const auto name_it = names.find(component.native());
+        if (name_it == names.end()) {
+            return NO_HANDLE;
         }
+        const auto child_it = child_handles.find({handle, &*name_it});
+        if (child_it == child_handles.end()) {
+            return NO_HANDLE;
+        }
+        handle = child_it->second;
+    }
+    return handle;
+}
 
-        if ((now - cur_item.last_used_time) > 3600) {
-            if (!cur_item.directory_list.empty()) {
-                // Directory list is too old -> remove it from cache and free memory.
-                // It will be re-generated if necessary.
-                log(LogLevel::DEBUG,
-                    "{}: Remove old directory list for handle {} path \"{}\" from cache\n",
-                    __func__,
-                    handle,
-                    server_path.string());
-                cur_item.directory_list = {};
-            }
+
+std::filesystem::path Drive::get_item_path(uint16_t handle) const {
+    const auto & item = items[handle];
+    if (item.parent == NO_HANDLE) {
+        return get_root();
+    }
+    auto path = get_item_path(item.parent);
+    path /= item.name->first;
+    return path;
+}
+
+
+uint16_t Drive::next_subtree_item(uint16_t handle, uint16_t subtree_root) const noexcept {
+    if (items[handle].first_child != NO_HANDLE) {
+        return items[handle].first_child;
+    }
+    for (; handle != subtree_root; handle = items[handle].parent) {
+        if (items[handle].next_sibling != NO_HANDLE) {
+            return items[handle].next_sibling;
         }
+    }
+    return NO_HANDLE;
+}
 
-        if (first_free == items.size()) {
-            if (cur_item.path.empty()) {
-                first_free = handle;
-            } else if (items[oldest].last_used_time > cur_item.last_used_time) {
-                oldest = handle;
+
+uint16_t Drive::add_item(uint16_t parent, const std::filesystem::path::string_type & name, time_t now) {
+    uint16_t handle;
+    if (!free_handles.empty()) {
+        handle = free_handles.back();
+        free_handles.pop_back();
+    } else if (items.size() < MAX_HANDLE_COUNT) {
+        handle = items.size();
+        items.emplace_back();
+    } else {
+        // all handles are used, pick the least recently used item without child items and reuse its handle
+        handle = NO_HANDLE;
+        for (uint16_t i = 0; i < items.size(); ++i) {
+            const auto & cur_item = items[i];
+            if (i == parent || i == root_handle || cur_item.first_child != NO_HANDLE) {
+                continue;
+            }
+            if (handle == NO_HANDLE || items[handle].last_used_time > cur_item.last_used_time) {
+                handle = i;
             }
         }
+        if (handle == NO_HANDLE) {
+            throw FilesystemError(std::format("{}: No handle available", __func__), DOS_EXTERR_TOO_MANY_OPEN_FILES);
+        }
+        remove_item(handle);
+        free_handles.pop_back();
     }
 
-    if (first_free == items.size()) {
-        // not found - no free slot available
-        if (first_free < MAX_HANDLE_COUNT) {
-            // allocate new slot
-            items.resize(first_free + 1);
+    auto & item = items[handle];
+    item.last_used_time = now;
+    item.generation = ++last_generation;
+    link_item(handle, parent, name);
+    return handle;
+}
+
+
+void Drive::remove_item(uint16_t handle) {
+    unlink_item(handle);
+    auto & item = items[handle];
+    item.release_directory_list();
+#ifndef _WIN32
+    release_dir_fd(handle);
+#endif
+    if (handle == root_handle) {
+        root_handle = NO_HANDLE;
+    }
+    free_handles.push_back(handle);
+}
+
+
+void Drive::link_item(uint16_t handle, uint16_t parent, const std::filesystem::path::string_type & name) {
+    auto & item = items[handle];
+    auto & name_entry = *names.try_emplace(name, 0).first;
+    ++name_entry.second;
+    item.name = &name_entry;
+    item.parent = parent;
+    item.prev_sibling = NO_HANDLE;
+    item.next_sibling = NO_HANDLE;
+    if (parent != NO_HANDLE) {
+        auto & parent_item = items[parent];
+        item.next_sibling = parent_item.first_child;
+        if (item.next_sibling != NO_HANDLE) {
+            items[item.next_sibling].prev_sibling = handle;
+        }
+        parent_item.first_child = handle;
+        child_handles.emplace(ChildKey{parent, item.name}, handle);
+    }
+}
+
+
+void Drive::unlink_item(uint16_t handle) {
+    auto & item = items[handle];
+    if (item.parent != NO_HANDLE) {
+        child_handles.erase({item.parent, item.name});
+        if (item.prev_sibling != NO_HANDLE) {
+            items[item.prev_sibling].next_sibling = item.next_sibling;
         } else {
-            // all handles are used, pick the oldest one and replace it
-            items[oldest].path.clear();
-            items[oldest].directory_list = {};
-            first_free = oldest;
+            items[item.parent].first_child = item.next_sibling;
+        }
+        if (item.next_sibling != NO_HANDLE) {
+            items[item.next_sibling].prev_sibling = item.prev_sibling;
         }
     }
+    if (--item.name->second == 0) {
+        names.erase(names.find(item.name->first));
+    }
+    item.name = nullptr;
+    item.parent = NO_HANDLE;
+    item.prev_sibling = NO_HANDLE;
+    item.next_sibling = NO_HANDLE;
+}
 
-    // assign item to handle
-    items[first_free].path = server_path;
-    items[first_free].last_used_time = now;
 
-    return first_free;
+bool Drive::move_item(const std::filesystem::path & old_server_path, const std::filesystem::path & new_server_path) {
+    // `get_handle` may reuse a handle, the other handles are looked up after it
+    const auto new_parent = get_handle(new_server_path.parent_path());
+    const auto handle = find_handle(old_server_path);
+    if (handle == NO_HANDLE || handle == root_handle) {
+        return true;
+    }
+
+    // a directory cannot be moved into itself
+    for (auto ancestor = new_parent; ancestor != NO_HANDLE; ancestor = items[ancestor].parent) {
+        if (ancestor == handle) {
+            return false;
+        }
+    }
+
+    // The destination did not exist. It could still have a handle, e.g. from a previous query for its attributes.
+    const auto new_handle = find_handle(new_server_path);
+    if (new_handle != NO_HANDLE) {
+        if (items[new_handle].first_child != NO_HANDLE) {
+            return false;
+        }
+        remove_item(new_handle);
+    }
+
+    unlink_item(handle);
+    link_item(handle, new_parent, new_server_path.filename().native());
+    return true;
+}
+
+
+void Drive::release_idle_directory_lists(time_t now) {
+    if (now - directory_lists_aged_time < DIRECTORY_LIST_AGING_INTERVAL) {
+        return;
+    }
+    directory_lists_aged_time = now;
+    for (uint16_t handle = 0; handle < items.size(); ++handle) {
+        auto & cur_item = items[handle];
+        if (!cur_item.directory_list.empty() && now - cur_item.last_used_time > DIRECTORY_LIST_MAX_IDLE_TIME) {
+            // Directory list is too old -> remove it from cache and free memory.
+            // It will be re-generated if necessary.
+            log(LogLevel::DEBUG, "{}: Remove old directory list for handle {} from cache\n", __func__, handle);
+            cur_item.release_directory_list();
+        }
+    }
 }
 
 
@@ -330,7 +717,7 @@ Drive::Item & Drive::get_item(uint16_t handle) {
             DOS_EXTERR_INVALID_HANDLE);
     }
     Item & item = items[handle];
-    if (item.path.empty()) {
+    if (!item.is_used()) {
         throw FilesystemError(
             std::format("Handle {} is invalid because it is empty", handle), DOS_EXTERR_INVALID_HANDLE);
     }
@@ -338,45 +725,916 @@ Drive::Item & Drive::get_item(uint16_t handle) {
 }
 
 
-const std::filesystem::path & Drive::get_handle_path(uint16_t handle) {
+std::filesystem::path Drive::get_handle_path(uint16_t handle) {
     auto & item = get_item(handle);
-    const auto & path = item.path;
     item.update_last_used_timestamp();
-    return path;
+    return get_item_path(handle);
+}
+
+
+void Drive::enable_cache_statistics() { miss_ratio_curves.resize(CACHE_STREAM_COUNT); }
+
+
+const MissRatioCurve * Drive::get_miss_ratio_curve(CacheStream stream) const noexcept {
+    if (miss_ratio_curves.empty()) {
+        return nullptr;
+    }
+    return &miss_ratio_curves[static_cast<int>(stream)];
+}
+
+
+std::pair<std::size_t, std::size_t> Drive::get_directory_lists_usage() const noexcept {
+    std::size_t count = 0;
+    std::size_t bytes = 0;
+    for (const auto & item : items) {
+        if (item.directory_list.empty()) {
+            continue;
+        }
+        ++count;
+        bytes += item.directory_list.capacity() * sizeof(DosFileProperties) +
+                 item.fcb_names.size() * (sizeof(fcb_file_name) + 4 * sizeof(void *)) +
+                 item.server_names.get_memory_usage();
+        for (const auto & entry : item.directory_list) {
+            bytes += entry.server_name.native().capacity();
+        }
+    }
+    return {count, bytes};
+}
+
+
+void Drive::limit_directory_lists(uint16_t handle) {
+    if (max_directory_list_count == 0) {
+        return;
+    }
+    std::vector<uint16_t> handles;
+    for (uint16_t i = 0; i < items.size(); ++i) {
+        if (i != handle && !items[i].directory_list.empty()) {
+            handles.push_back(i);
+        }
+    }
+    if (handles.size() < max_directory_list_count) {
+        return;
+    }
+    // keep the most recently used listings
+    const auto release_count = handles.size() - (max_directory_list_count - 1);
+    std::nth_element(
+        handles.begin(), handles.begin() + release_count - 1, handles.end(), [this](uint16_t a, uint16_t b) {
+            return items[a].last_used_time < items[b].last_used_time;
+        });
+    for (std::size_t i = 0; i < release_count; ++i) {
+        log(LogLevel::DEBUG,
+            "{}: Release directory list for handle {} path \"{}\"\n",
+            __func__,
+            handles[i],
+            get_item_path(handles[i]).string());
+        items[handles[i]].release_directory_list();
+    }
+}
+
+
+uint32_t Drive::get_generation(uint16_t handle) const noexcept {
+    if (handle >= items.size() || !items[handle].is_used()) {
+        return 0;
+    }
+    return items[handle].generation;
+}
+
+
+void Drive::update_generation(const std::filesystem::path & server_path, bool include_subitems) {
+    invalidate_pinned_files(server_path, include_subitems);
+#ifndef _WIN32
+    invalidate_read_ahead(server_path, include_subitems);
+    invalidate_shared_directory_list(server_path);
+#endif
+
+    const auto handle = find_handle(server_path);
+    if (handle == NO_HANDLE) {
+        return;
+    }
+    items[handle].generation = ++last_generation;
+    if (include_subitems) {
+        for (auto sub = next_subtree_item(handle, handle); sub != NO_HANDLE; sub = next_subtree_item(sub, handle)) {
+            items[sub].generation = ++last_generation;
+        }
+    }
+}
+
+
+void Drive::load_pinned_files() {
+    pinned_files.clear();
+    if (pin_patterns.empty()) {
+        return;
+    }
+
+#ifdef __linux__
+    if (!pinned_files_inotify_fd) {
+        pinned_files_inotify_fd.reset(inotify_init1(IN_NONBLOCK | IN_CLOEXEC));
+        if (!pinned_files_inotify_fd) {
+            log(LogLevel::WARNING,
+                "{}: inotify is not available, pinned files are checked periodically: {}\n",
+                __func__,
+                strerror(errno));
+        }
+    }
+#endif
+
+    std::vector<std::filesystem::path> paths;
+    for (const auto & pattern : pin_patterns) {
+        std::vector<std::string> components;
+        for (const auto & component : std::filesystem::path(pattern).relative_path()) {
+            if (!component.empty() && component != ".") {
+                components.push_back(component.string());
+            }
+        }
+        if (components.empty()) {
+            continue;
+        }
+        try {
+            expand_pin_pattern(root, components, 0, paths);
+        } catch (const std::filesystem::filesystem_error & ex) {
+            log(LogLevel::WARNING, "{}: Pattern \"{}\": {}\n", __func__, pattern, ex.what());
+        }
+    }
+
+    for (const auto & path : paths) {
+        const auto normalized_path = normalize_path(path);
+        if (pinned_files.contains(normalized_path)) {
+            continue;
+        }
+        PinnedFile pinned_file;
+        if (reload_pinned_file(normalized_path, pinned_file)) {
+            pinned_files.emplace(normalized_path, std::move(pinned_file));
+        }
+    }
+
+    const auto [count, bytes] = get_pinned_files_usage();
+    log(LogLevel::NOTICE, "Pinned {} files ({} bytes) of \"{}\"\n", count, bytes, root.string());
+}
+
+
+std::pair<std::size_t, std::size_t> Drive::get_pinned_files_usage() const noexcept {
+    std::size_t bytes = 0;
+    for (const auto & [path, pinned_file] : pinned_files) {
+        bytes += pinned_file.data.size();
+    }
+    return {pinned_files.size(), bytes};
+}
+
+
+const Drive::PinnedFile * Drive::get_pinned_file(const std::filesystem::path & server_path) {
+    if (pinned_files.empty()) {
+        return nullptr;
+    }
+
+    process_pinned_files_events();
+
+    const auto it = pinned_files.find(server_path);
+    if (it == pinned_files.end()) {
+        return nullptr;
+    }
+    auto & pinned_file = it->second;
+
+#ifdef __linux__
+    const bool check_periodically = !pinned_files_inotify_fd;
+#else
+    const bool check_periodically = true;
+#endif
+    const auto now = time(NULL);
+    if (pinned_file.valid && check_periodically && now - pinned_file.validated_time >= PINNED_FILE_VALIDATE_INTERVAL) {
+        DosFileProperties properties;
+        const auto attrs = read_server_path_dos_properties(server_path, &properties);
+        pinned_file.validated_time = now;
+        if (attrs == FAT_ERROR_ATTR || properties.size != pinned_file.properties.size ||
+            properties.time_date != pinned_file.properties.time_date ||
+            properties.attrs != pinned_file.properties.attrs) {
+            update_generation(server_path);
+            update_generation(server_path.parent_path());
+        }
+    }
+
+    if (!pinned_file.valid && !reload_pinned_file(server_path, pinned_file)) {
+        return nullptr;
+    }
+
+    return &pinned_file;
 }
 
 
+bool Drive::reload_pinned_file(const std::filesystem::path & server_path, PinnedFile & pinned_file) {
+    pinned_file.valid = false;
+    pinned_file.data.clear();
+    pinned_file.data.shrink_to_fit();
+
+#ifdef __linux__
+    if (pinned_files_inotify_fd && pinned_file.watch_descriptor == -1) {
+        // The watch is added before reading, so that a change during reading is not missed.
+        pinned_file.watch_descriptor = inotify_add_watch(
+            pinned_files_inotify_fd.get(),
+            server_path.c_str(),
+            IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE | IN_MOVE_SELF | IN_DELETE_SELF);
+        if (pinned_file.watch_descriptor == -1) {
+            log(LogLevel::WARNING,
+                "{}: Cannot watch \"{}\": {}\n",
+                __func__,
+                server_path.string(),
+                strerror(errno));
+            return false;
+        }
+    }
+#endif
+
+    const auto attrs = read_server_path_dos_properties(server_path, &pinned_file.properties);
+    if (attrs == FAT_ERROR_ATTR || (attrs & (FAT_DIRECTORY | FAT_VOLUME))) {
+        log(LogLevel::DEBUG, "{}: \"{}\" is not a file\n", __func__, server_path.string());
+        return false;
+    }
+    if (pinned_file.properties.size > MAX_PINNED_FILE_SIZE) {
+        log(LogLevel::WARNING,
+            "{}: File \"{}\" is too big to be pinned ({} bytes)\n",
+            __func__,
+            server_path.string(),
+            pinned_file.properties.size);
+        return false;
+    }
+    pinned_file.properties.server_name = server_path.filename();
+
+    try {
+        pinned_file.data.resize(pinned_file.properties.size);
+#ifdef _WIN32
+        std::ifstream file(server_path, std::ios::binary);
+        file.read(reinterpret_cast<char *>(pinned_file.data.data()), pinned_file.data.size());
+        if (static_cast<std::size_t>(file.gcount()) != pinned_file.data.size()) {
+            throw FilesystemError("Cannot read file: " + server_path.string(), DOS_EXTERR_ACCESS_DENIED);
+        }
+#else
+        const auto fd = open_item(server_path, O_RDONLY);
+        std::size_t offset = 0;
+        while (offset < pinned_file.data.size()) {
+            const auto res =
+                pread(fd.get(), pinned_file.data.data() + offset, pinned_file.data.size() - offset, offset);
+            if (res == -1 && errno == EINTR) {
+                continue;
+            }
+            if (res <= 0) {
+                throw FilesystemError(
+                    std::format(
+                        "Cannot read file \"{}\": {}",
+                        server_path.string(),
+                        res == 0 ? "File is shorter than expected" : strerror(errno)),
+                    DOS_EXTERR_ACCESS_DENIED);
+            }
+            offset += res;
+        }
+#endif
+    } catch (const std::runtime_error & ex) {
+        log(LogLevel::WARNING, "{}: {}\n", __func__, ex.what());
+        pinned_file.data.clear();
+        return false;
+    }
+
+    pinned_file.valid = true;
+    pinned_file.validated_time = time(NULL);
+    log(LogLevel::DEBUG,
+        "{}: Loaded \"{}\" ({} bytes)\n",
+        __func__,
+        server_path.string(),
+        pinned_file.data.size());
+    return true;
+}
+
+
+void Drive::invalidate_pinned_files(const std::filesystem::path & server_path, bool include_subitems) {
+    if (pinned_files.empty()) {
+        return;
+    }
+    const auto path = normalize_path(server_path);
+    if (!include_subitems) {
+        if (const auto it = pinned_files.find(path); it != pinned_files.end()) {
+            it->second.valid = false;
+        }
+        return;
+    }
+    for (auto & [pinned_path, pinned_file] : pinned_files) {
+        const auto relative_path = pinned_path.lexically_relative(path);
+        if (!relative_path.empty() && *relative_path.begin() != "..") {
+            pinned_file.valid = false;
+        }
+    }
+}
+
+
+void Drive::process_pinned_files_events() {
+#ifdef __linux__
+    if (pinned_files.empty() || !pinned_files_inotify_fd) {
+        return;
+    }
+    alignas(struct inotify_event) char buffer[4096];
+    while (true) {
+        const auto len = read(pinned_files_inotify_fd.get(), buffer, sizeof(buffer));
+        if (len <= 0) {
+            // EAGAIN - no more events
+            break;
+        }
+        for (ssize_t offset = 0; offset < len;) {
+            const auto * const event = reinterpret_cast<const struct inotify_event *>(buffer + offset);
+            offset += sizeof(struct inotify_event) + event->len;
+            for (auto & [path, pinned_file] : pinned_files) {
+                if (pinned_file.watch_descriptor != event->wd) {
+                    continue;
+                }
+                log(LogLevel::DEBUG, "{}: Pinned file \"{}\" changed\n", __func__, path.string());
+                // Also invalidates the pinned file.
+                update_generation(path);
+                update_generation(path.parent_path());
+                if (event->mask & IN_MOVE_SELF) {
+                    // The watched file was moved away. The file that appears at the path gets a new watch.
+                    inotify_rm_watch(pinned_files_inotify_fd.get(), event->wd);
+                    pinned_file.watch_descriptor = -1;
+                } else if (event->mask & IN_IGNORED) {
+                    // the watch was removed (file deleted or filesystem unmounted)
+                    pinned_file.watch_descriptor = -1;
+                }
+            }
+        }
+    }
+#endif
+}
+
+
+int32_t Drive::refresh_directory_list(uint16_t handle) {
+    const auto old_directory_list = std::move(items[handle].directory_list);
+    const auto old_server_names = std::move(items[handle].server_names);
+    items[handle].server_names = {};
+    const auto path = get_item_path(handle);
+    int32_t ret;
+#ifdef _WIN32
+    ret = items[handle].create_directory_list(*this, path, -1);
+#else
+    int dir_fd;
+    try {
+        dir_fd = get_handle_dir_fd(handle);
+        auto & item = items[handle];
+        SharedDirectoryCache::Key key;
+        struct stat st;
+        // The directory times are read before the directory is scanned. If the directory changes during the scan,
+        // the stored listing does not match the new times.
+        if (shared_directory_cache && fstat(dir_fd, &st) == 0) {
+            key.dev = st.st_dev;
+            key.ino = st.st_ino;
+#ifdef __APPLE__
+            key.mtime_ns = st.st_mtimespec.tv_sec * 1000000000LL + st.st_mtimespec.tv_nsec;
+            key.ctime_ns = st.st_ctimespec.tv_sec * 1000000000LL + st.st_ctimespec.tv_nsec;
+#else
+            key.mtime_ns = st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+            key.ctime_ns = st.st_ctim.tv_sec * 1000000000LL + st.st_ctim.tv_nsec;
+#endif
+            key.settings = get_directory_list_settings_hash();
+            if (shared_directory_cache->find(key, item.directory_list)) {
+                // Rebuild the set of used short names, it is needed to generate unique names for new files.
+                item.fcb_names.clear();
+                if (name_conversion != FileNameConversion::OFF) {
+                    for (const auto & entry : item.directory_list) {
+                        if (!(entry.attrs & FAT_VOLUME) && entry.server_name != "." && entry.server_name != "..") {
+                            item.fcb_names.insert(entry.fcb_name);
+                        }
+                    }
+                }
+                item.update_last_used_timestamp();
+                ret = item.directory_list.size();
+            } else {
+                ret = item.create_directory_list(*this, path, dir_fd);
+                if (ret >= 0) {
+                    shared_directory_cache->store(key, item.directory_list);
+                }
+            }
+        } else {
+            ret = item.create_directory_list(*this, path, dir_fd);
+        }
+    } catch (const std::runtime_error & ex) {
+        log(LogLevel::WARNING, "{}: {}\n", __func__, ex.what());
+        items[handle].directory_list.clear();
+        items[handle].fcb_names.clear();
+        ret = -1;
+    }
+#endif
+    auto & item = items[handle];
+    if (!is_same_directory_list(old_directory_list, old_server_names, item.directory_list)) {
+        // The directory was changed (possibly by another program on the server).
+        item.generation = ++last_generation;
+    }
+    if (compress_names && name_conversion != FileNameConversion::OFF &&
+        item.directory_list.size() >= MIN_COMPRESSED_DIRECTORY_LIST_SIZE) {
+        item.compress_directory_list(compressed_names_statistics);
+    }
+    limit_directory_lists(handle);
+    return ret;
+}
+
+
+#ifndef _WIN32
+uint64_t Drive::get_directory_list_settings_hash() const noexcept {
+    // FNV-1a
+    uint64_t hash = 0xCBF29CE484222325ULL;
+    const auto add = [&hash](const void * data, std::size_t len) {
+        for (std::size_t i = 0; i < len; ++i) {
+            hash ^= static_cast<const uint8_t *>(data)[i];
+            hash *= 0x100000001B3ULL;
+        }
+    };
+    add(&attrs_mode, sizeof(attrs_mode));
+    add(&name_conversion, sizeof(name_conversion));
+    add(&has_volume_label, sizeof(has_volume_label));
+    if (has_volume_label) {
+        add(&volume_label, sizeof(volume_label));
+    }
+    return hash;
+}
+
+
+void Drive::invalidate_shared_directory_list(const std::filesystem::path & server_path) {
+    if (!shared_directory_cache) {
+        return;
+    }
+    try {
+        const auto relative_path = relative_server_path(get_root(), server_path);
+        struct stat st;
+        if (fstatat(root_fd.get(), relative_path.empty() ? "." : relative_path.c_str(), &st, 0) == 0 &&
+            S_ISDIR(st.st_mode)) {
+            shared_directory_cache->invalidate(st.st_dev, st.st_ino);
+        }
+    } catch (const std::runtime_error & ex) {
+        log(LogLevel::WARNING, "{}: {}\n", __func__, ex.what());
+    }
+}
+
+
+int Drive::get_dir_fd(const std::filesystem::path & server_dir) {
+    const auto relative_dir = relative_server_path(get_root(), server_dir);
+    if (relative_dir.empty()) {
+        return root_fd.get();
+    }
+    return get_handle_dir_fd(get_handle(server_dir));
+}
+
+
+int Drive::get_handle_dir_fd(uint16_t handle) {
+    if (handle == root_handle) {
+        return root_fd.get();
+    }
+
+    const time_t now = time(NULL);
+    if (items[handle].dir_fd) {
+        if (now - items[handle].dir_fd_validated_time < DIR_FD_VALIDATE_INTERVAL) {
+            // move the handle to the end of the LRU list
+            dir_fd_handles.erase(std::find(dir_fd_handles.begin(), dir_fd_handles.end(), handle));
+            dir_fd_handles.push_back(handle);
+            return items[handle].dir_fd.get();
+        }
+    }
+
+    // The parent directory keeps its handle while the item exists, the recursion does not change `items`.
+    auto & item = items[handle];
+    const int parent_fd = get_handle_dir_fd(item.parent);
+    const auto & name = item.name->first;
+
+    if (item.dir_fd) {
+        // Verify that the cached descriptor still refers to the directory.
+        struct stat st;
+        if (fstatat(parent_fd, name.c_str(), &st, 0) == 0 && st.st_dev == item.dir_dev &&
+            st.st_ino == item.dir_ino) {
+            item.dir_fd_validated_time = now;
+            dir_fd_handles.erase(std::find(dir_fd_handles.begin(), dir_fd_handles.end(), handle));
+            dir_fd_handles.push_back(handle);
+            return item.dir_fd.get();
+        }
+        log(LogLevel::DEBUG,
+            "{}: Directory \"{}\" was replaced, reopening\n",
+            __func__,
+            get_item_path(handle).string());
+        release_dir_fd(handle);
+    }
+
+    int fd = openat_beneath(parent_fd, name.c_str(), DIR_FD_OPEN_FLAGS, 0);
+    if (fd == -1 && is_beneath_violation(errno)) {
+        // The directory is a symlink pointing outside its parent directory. That is fine as long as the target
+        // is inside the shared directory. Resolve it again, relative to the root.
+        const auto relative_dir = relative_server_path(get_root(), get_item_path(handle));
+        fd = openat_beneath(root_fd.get(), relative_dir.c_str(), DIR_FD_OPEN_FLAGS, 0);
+        if (fd == -1 && is_beneath_violation(errno)) {
+            throw FilesystemError(
+                std::format(
+                    "{}: Security alert: Directory \"{}\" resolves outside the shared directory",
+                    __func__,
+                    get_item_path(handle).string()),
+                DOS_EXTERR_PATH_NOT_FOUND);
+        }
+    }
+    if (fd == -1) {
+        const auto orig_errno = errno;
+        throw FilesystemError(
+            std::format("Cannot open directory \"{}\": {}", get_item_path(handle).string(), strerror(orig_errno)),
+            orig_errno == EACCES ? DOS_EXTERR_ACCESS_DENIED : DOS_EXTERR_PATH_NOT_FOUND);
+    }
+
+    UniqueFd dir_fd(fd);
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        throw FilesystemError(
+            std::format("Cannot stat directory \"{}\": {}", get_item_path(handle).string(), strerror(errno)),
+            DOS_EXTERR_PATH_NOT_FOUND);
+    }
+
+    item.dir_fd = std::move(dir_fd);
+    item.dir_dev = st.st_dev;
+    item.dir_ino = st.st_ino;
+    item.dir_fd_validated_time = now;
+    dir_fd_handles.push_back(handle);
+
+    // Limit the number of open descriptors. The least recently used ones are closed.
+    while (dir_fd_handles.size() > MAX_DIR_FD_COUNT) {
+        items[dir_fd_handles.front()].dir_fd.reset();
+        dir_fd_handles.pop_front();
+    }
+
+    return fd;
+}
+
+
+void Drive::set_media_type(MediaType type) {
+    media_type = type;
+#ifndef _WIN32
+    read_ahead_streams.clear();
+    switch (type) {
+        case MediaType::SSD:
+            read_ahead_chunk_size = 0;
+            break;
+        case MediaType::HDD:
+            read_ahead_streams.resize(HDD_READ_AHEAD_STREAMS);
+            read_ahead_chunk_size = HDD_READ_AHEAD_CHUNK_SIZE;
+            break;
+        case MediaType::OPTICAL:
+            read_ahead_streams.resize(OPTICAL_READ_AHEAD_STREAMS);
+            read_ahead_chunk_size = OPTICAL_READ_AHEAD_CHUNK_SIZE;
+            break;
+    }
+#endif
+}
+
+
+std::pair<int, std::filesystem::path> Drive::get_parent_dir_fd(const std::filesystem::path & server_path) {
+    const auto relative_path = relative_server_path(get_root(), server_path);
+    if (relative_path.empty()) {
+        throw FilesystemError(
+            std::format("{}: Root directory has no parent directory", __func__), DOS_EXTERR_ACCESS_DENIED);
+    }
+    const auto name = relative_path.filename();
+    return {get_dir_fd(get_root() / relative_path.parent_path()), name};
+}
+
+
+UniqueFd Drive::open_item(const std::filesystem::path & server_path, int flags, mode_t mode) {
+    const auto relative_path = relative_server_path(get_root(), server_path);
+    const auto [dir_fd, name] = get_parent_dir_fd(server_path);
+
+    int fd = openat_beneath(dir_fd, name.c_str(), flags, mode);
+    if (fd == -1 && is_beneath_violation(errno)) {
+        // The item is a symlink pointing outside its directory. That is fine as long as the target
+        // is inside the shared directory. Resolve it again, relative to the root.
+        fd = openat_beneath(root_fd.get(), relative_path.c_str(), flags, mode);
+        if (fd == -1 && is_beneath_violation(errno)) {
+            throw FilesystemError(
+                std::format(
+                    "{}: Security alert: \"{}\" resolves outside the shared directory",
+                    __func__,
+                    (get_root() / relative_path).string()),
+                DOS_EXTERR_ACCESS_DENIED);
+        }
+    }
+    if (fd == -1) {
+        throw FilesystemError(std::format("Cannot open file: {}", strerror(errno)), DOS_EXTERR_ACCESS_DENIED);
+    }
+
+    return UniqueFd(fd);
+}
+
+
+void Drive::release_dir_fd(uint16_t handle) {
+    auto & item = items[handle];
+    if (item.dir_fd) {
+        item.dir_fd.reset();
+        dir_fd_handles.erase(std::find(dir_fd_handles.begin(), dir_fd_handles.end(), handle));
+    }
+}
+
+
+void Drive::release_dir_fds(const std::filesystem::path & server_path) {
+    const auto handle = find_handle(server_path);
+    for (auto sub = handle; sub != NO_HANDLE; sub = next_subtree_item(sub, handle)) {
+        release_dir_fd(sub);
+    }
+}
+#endif
+
+
 int32_t Drive::read_file(void * buffer, uint16_t handle, uint32_t offset, uint16_t len) {
     auto & item = get_item(handle);
-    const auto & fname = item.path;
+    const auto path = get_item_path(handle);
+
+    item.update_last_used_timestamp();
+
+    if (len > 0) {
+        for (uint64_t block = offset / READ_BLOCK_SIZE; block <= (offset + len - 1ULL) / READ_BLOCK_SIZE; ++block) {
+            record_cache_access(CacheStream::READ_BLOCKS, path, block);
+        }
+    }
+
+    if (const auto * const pinned_file = get_pinned_file(path)) {
+        const auto & data = pinned_file->data;
+        if (offset >= data.size()) {
+            return 0;
+        }
+        const auto res = std::min<std::size_t>(len, data.size() - offset);
+        memcpy(buffer, data.data() + offset, res);
+        return static_cast<int32_t>(res);
+    }
+
+#ifdef _WIN32
+    const auto & fname = path;
+
+    if (is_dangling_symlink(fname)) {
+        throw FilesystemError("Dangling symlink: " + fname.string(), DOS_EXTERR_ACCESS_DENIED);
+    }
+
+    auto * const fd = _wfopen(fname.c_str(), L"rb");
+    if (!fd) {
+        throw FilesystemError(std::format("Cannot open file: {}", strerror(errno)), DOS_EXTERR_ACCESS_DENIED);
+    }
+
+    if (fseek(fd, offset, SEEK_SET) != 0) {
+        const auto orig_errno = errno;
+        fclose(fd);
+        throw FilesystemError(std::format("Cannot seek in file: {}", strerror(orig_errno)), DOS_EXTERR_SEEK_ERROR);
+    }
+
+    const auto res = fread(buffer, 1, len, fd);
+
+    fclose(fd);
+
+    return static_cast<int32_t>(res);
+#else
+    UniqueFd fd;
+    if (content_cache) {
+        fd = open_item(path, O_RDONLY);
+        const auto res = read_file_cached(buffer, fd.get(), offset, len);
+        if (res >= 0) {
+            return res;
+        }
+    }
+
+    if (!read_ahead_streams.empty()) {
+        const auto res = read_file_ahead(buffer, path, offset, len);
+        if (res >= 0) {
+            return res;
+        }
+    }
+
+    if (!fd) {
+        fd = open_item(path, O_RDONLY);
+    }
+
+    ssize_t res;
+    do {
+        res = pread(fd.get(), buffer, len, offset);
+    } while (res == -1 && errno == EINTR);
+    if (res == -1) {
+        throw FilesystemError(std::format("Cannot read file: {}", strerror(errno)), DOS_EXTERR_ACCESS_DENIED);
+    }
+
+    return static_cast<int32_t>(res);
+#endif
+}
+
+
+#ifndef _WIN32
+int32_t Drive::read_file_cached(void * buffer, int fd, uint32_t offset, uint16_t len) {
+    // Returns the identity of the file, the cached content is valid while it does not change.
+    const auto get_file_id = [fd](ContentCache::FileId & id) {
+        struct stat st;
+        if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+            return false;
+        }
+        id.dev = st.st_dev;
+        id.ino = st.st_ino;
+#ifdef __APPLE__
+        id.mtime_ns = st.st_mtimespec.tv_sec * 1000000000LL + st.st_mtimespec.tv_nsec;
+        id.ctime_ns = st.st_ctimespec.tv_sec * 1000000000LL + st.st_ctimespec.tv_nsec;
+#else
+        id.mtime_ns = st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+        id.ctime_ns = st.st_ctim.tv_sec * 1000000000LL + st.st_ctim.tv_nsec;
+#endif
+        id.size = st.st_size;
+        return true;
+    };
+
+    ContentCache::FileId id;
+    if (!get_file_id(id) || !content_cache->is_cacheable(id.size)) {
+        return -1;
+    }
+    const auto res = content_cache->read(id, buffer, offset, len);
+    if (res >= 0) {
+        return res;
+    }
+
+    // The first read of the file, load the whole file.
+    std::vector<uint8_t> data(id.size);
+    std::size_t loaded = 0;
+    while (loaded < data.size()) {
+        const auto ret = pread(fd, data.data() + loaded, data.size() - loaded, loaded);
+        if (ret == -1 && errno == EINTR) {
+            continue;
+        }
+        if (ret <= 0) {
+            return -1;
+        }
+        loaded += ret;
+    }
+    ContentCache::FileId loaded_id;
+    if (!get_file_id(loaded_id) || loaded_id != id) {
+        // changed while it was being read
+        return -1;
+    }
+
+    const auto copied = offset < data.size() ? std::min<std::size_t>(len, data.size() - offset) : 0;
+    memcpy(buffer, data.data() + offset, copied);
+    content_cache->store(id, std::move(data));
+    return static_cast<int32_t>(copied);
+}
+
+
+int32_t Drive::read_file_ahead(
+    void * buffer, const std::filesystem::path & server_path, uint32_t offset, uint16_t len) {
+    const time_t now = time(NULL);
+
+    ReadAheadStream * stream = nullptr;
+    for (auto & cur_stream : read_ahead_streams) {
+        if (cur_stream.path == server_path) {
+            stream = &cur_stream;
+            break;
+        }
+    }
+    if (!stream) {
+        // replace the least recently used stream
+        stream = &*std::min_element(
+            read_ahead_streams.begin(), read_ahead_streams.end(), [](const auto & a, const auto & b) {
+                return a.last_used < b.last_used;
+            });
+        stream->path = server_path;
+        stream->data.clear();
+        stream->eof = false;
+    } else if (now - stream->fill_time >= READ_AHEAD_VALIDATE_INTERVAL) {
+        // The file may have been changed by another program on the server.
+        stream->data.clear();
+        stream->eof = false;
+    }
+
+    // Returns true if the window contains the requested data (or its part up to the end of the file).
+    const auto is_in_window = [offset, len](const ReadAheadStream & stream) {
+        const uint64_t window_end = stream.offset + stream.data.size();
+        return offset >= stream.offset && (offset + len <= window_end || (stream.eof && offset <= window_end));
+    };
+
+    if (!is_in_window(*stream)) {
+        refill_read_ahead_streams(*stream, offset, now);
+        if (!is_in_window(*stream)) {
+            return -1;
+        }
+    }
+
+    stream->last_used = ++read_ahead_clock;
+    const auto res = std::min<uint32_t>(len, stream->offset + stream->data.size() - offset);
+    memcpy(buffer, stream->data.data() + (offset - stream->offset), res);
+    stream->position = offset + res;
+    return static_cast<int32_t>(res);
+}
 
-    item.update_last_used_timestamp();
 
-    if (is_dangling_symlink(fname)) {
-        throw FilesystemError("Dangling symlink: " + fname.string(), DOS_EXTERR_ACCESS_DENIED);
+void Drive::refill_read_ahead_streams(ReadAheadStream & stream, uint32_t offset, time_t now) {
+    const uint32_t window_size = 2 * read_ahead_chunk_size;
+
+    struct Refill {
+        ReadAheadStream * stream;
+        uint32_t offset;  // new offset of the window
+        UniqueFd fd;
+        std::tuple<int, uint64_t, uint64_t> device_order_key;
+    };
+    std::vector<Refill> refills;
+
+    // A copy of the path is passed, `open_item` may reallocate `items`.
+    refills.push_back(
+        {&stream,
+         offset / read_ahead_chunk_size * read_ahead_chunk_size,
+         open_item(std::filesystem::path(stream.path), O_RDONLY),
+         {}});
+
+    // Serving several clients reading different files in arrival order makes the device seek between the files
+    // for every chunk. Move the windows of the other files whose reader will need the next chunk soon
+    // in the same batch.
+    for (auto & other : read_ahead_streams) {
+        if (&other == &stream || other.path.empty() || other.eof || other.data.size() < window_size ||
+            other.position < other.offset + read_ahead_chunk_size ||
+            now - other.fill_time >= READ_AHEAD_VALIDATE_INTERVAL) {
+            continue;
+        }
+        try {
+            refills.push_back(
+                {&other,
+                 other.offset + read_ahead_chunk_size,
+                 open_item(std::filesystem::path(other.path), O_RDONLY),
+                 {}});
+        } catch (const std::runtime_error & ex) {
+            log(LogLevel::DEBUG, "{}: {}\n", __func__, ex.what());
+            other.path.clear();
+            other.data.clear();
+            other.last_used = 0;
+        }
     }
 
-#ifdef _WIN32
-    auto * const fd = _wfopen(fname.c_str(), L"rb");
-#else
-    auto * const fd = fopen(fname.c_str(), "rb");
-#endif
-    if (!fd) {
-        throw FilesystemError(std::format("Cannot open file: {}", strerror(errno)), DOS_EXTERR_ACCESS_DENIED);
+    for (auto & refill : refills) {
+        refill.device_order_key = get_device_order_key(refill.fd.get(), refill.offset);
     }
+    std::sort(refills.begin(), refills.end(), [](const Refill & a, const Refill & b) {
+        return a.device_order_key < b.device_order_key;
+    });
 
-    if (fseek(fd, offset, SEEK_SET) != 0) {
-        const auto orig_errno = errno;
-        fclose(fd);
-        throw FilesystemError(std::format("Cannot seek in file: {}", strerror(orig_errno)), DOS_EXTERR_SEEK_ERROR);
+    for (auto & refill : refills) {
+        auto & cur_stream = *refill.stream;
+
+        // Keep the part of the old window that is also in the new window.
+        uint32_t keep = 0;
+        if (refill.offset >= cur_stream.offset && refill.offset < cur_stream.offset + cur_stream.data.size()) {
+            keep = cur_stream.offset + cur_stream.data.size() - refill.offset;
+            memmove(cur_stream.data.data(), cur_stream.data.data() + (refill.offset - cur_stream.offset), keep);
+        } else {
+            cur_stream.fill_time = now;
+        }
+        cur_stream.data.resize(window_size);
+        cur_stream.offset = refill.offset;
+
+        uint32_t size = keep;
+        while (size < window_size) {
+            const auto res =
+                pread(refill.fd.get(), cur_stream.data.data() + size, window_size - size, refill.offset + size);
+            if (res == -1 && errno == EINTR) {
+                continue;
+            }
+            if (res == -1) {
+                const auto orig_errno = errno;
+                cur_stream.data.clear();
+                cur_stream.eof = false;
+                if (&cur_stream == &stream) {
+                    throw FilesystemError(
+                        std::format("Cannot read file: {}", strerror(orig_errno)), DOS_EXTERR_ACCESS_DENIED);
+                }
+                break;
+            }
+            if (res == 0) {
+                break;
+            }
+            size += res;
+        }
+        if (!cur_stream.data.empty()) {
+            cur_stream.data.resize(size);
+            cur_stream.eof = size < window_size;
+        }
     }
 
-    const auto res = fread(buffer, 1, len, fd);
+    log(LogLevel::DEBUG, "{}: Refilled {} read-ahead windows\n", __func__, refills.size());
+}
 
-    fclose(fd);
 
-    return static_cast<int32_t>(res);
+void Drive::invalidate_read_ahead(const std::filesystem::path & server_path, bool include_subitems) {
+    if (read_ahead_streams.empty()) {
+        return;
+    }
+    const auto path = normalize_path(server_path);
+    for (auto & stream : read_ahead_streams) {
+        if (stream.path.empty()) {
+            continue;
+        }
+        bool matches = stream.path == path;
+        if (!matches && include_subitems) {
+            const auto relative_path = stream.path.lexically_relative(path);
+            matches = !relative_path.empty() && *relative_path.begin() != "..";
+        }
+        if (matches) {
+            stream.path.clear();
+            stream.data.clear();
+            stream.eof = false;
+            stream.last_used = 0;
+        }
+    }
 }
+#endif
 
 
 int32_t Drive::write_file(const void * buffer, uint16_t handle, uint32_t offset, uint16_t len) {
@@ -385,13 +1643,17 @@ int32_t Drive::write_file(const void * buffer, uint16_t handle, uint32_t offset,
     }
 
     auto & item = get_item(handle);
-    const auto & fname = item.path;
+    const auto fname = get_item_path(handle);
 
     item.update_last_used_timestamp();
 
-    if (is_dangling_symlink(fname)) {
-        throw FilesystemError("Dangling symlink: " + fname.string(), DOS_EXTERR_ACCESS_DENIED);
-    }
+    // The file content and the size/timestamp in the directory listing are going to change.
+    item.generation = ++last_generation;
+    update_generation(fname.parent_path());
+#ifndef _WIN32
+    invalidate_read_ahead(fname, false);
+#endif
+    invalidate_pinned_files(fname);
 
     // READ_ONLY DOS attribute is handled at open time. Do not check it here.
     // Files opened with CREATE_FILE (create or truncate) must remain writable.
@@ -402,20 +1664,27 @@ int32_t Drive::write_file(const void * buffer, uint16_t handle, uint32_t offset,
     //        DOS_EXTERR_ACCESS_DENIED);
     //}
 
+#ifdef _WIN32
+    if (is_dangling_symlink(fname)) {
+        throw FilesystemError("Dangling symlink: " + fname.string(), DOS_EXTERR_ACCESS_DENIED);
+    }
+
+    std::error_code ec;
+    const uint64_t old_size = std::filesystem::file_size(fname, ec);
+
     // len 0 means "truncate" or "extend"
     if (len == 0) {
         log(LogLevel::DEBUG, "{}: truncate \"{}\" to {} bytes\n", __func__, fname.string(), offset);
         resize_file(fname, offset);
+        if (!ec) {
+            adjust_used_space(static_cast<int64_t>(offset) - static_cast<int64_t>(old_size));
+        }
         return 0;
     }
 
     //  write to file
     log(LogLevel::DEBUG, "{}: write {} bytes into file \"{}\" at offset {}\n", __func__, len, fname.string(), offset);
-#ifdef _WIN32
     auto * const fd = _wfopen(fname.c_str(), L"r+b");
-#else
-    auto * const fd = fopen(fname.c_str(), "r+b");
-#endif
     if (!fd) {
         throw FilesystemError(std::format("Cannot open file: {}", strerror(errno)), DOS_EXTERR_ACCESS_DENIED);
     }
@@ -430,19 +1699,74 @@ int32_t Drive::write_file(const void * buffer, uint16_t handle, uint32_t offset,
 
     fclose(fd);
 
+    if (!ec && offset + res > old_size) {
+        adjust_used_space(static_cast<int64_t>(offset + res - old_size));
+    }
+
+    return static_cast<int32_t>(res);
+#else
+    const auto fd = open_item(fname, O_WRONLY);
+
+    struct stat st;
+    const bool have_old_size = fstat(fd.get(), &st) == 0;
+    const uint64_t old_size = have_old_size ? st.st_size : 0;
+    if (content_cache && have_old_size) {
+        content_cache->invalidate(st.st_dev, st.st_ino);
+    }
+
+    // len 0 means "truncate" or "extend"
+    if (len == 0) {
+        log(LogLevel::DEBUG, "{}: truncate \"{}\" to {} bytes\n", __func__, fname.string(), offset);
+        if (ftruncate(fd.get(), offset) != 0) {
+            throw FilesystemError(std::format("Cannot resize file: {}", strerror(errno)), DOS_EXTERR_ACCESS_DENIED);
+        }
+        if (have_old_size) {
+            adjust_used_space(static_cast<int64_t>(offset) - static_cast<int64_t>(old_size));
+        }
+        return 0;
+    }
+
+    //  write to file
+    log(LogLevel::DEBUG, "{}: write {} bytes into file \"{}\" at offset {}\n", __func__, len, fname.string(), offset);
+    ssize_t res;
+    do {
+        res = pwrite(fd.get(), buffer, len, offset);
+    } while (res == -1 && errno == EINTR);
+    if (res == -1) {
+        throw FilesystemError(std::format("Cannot write file: {}", strerror(errno)), DOS_EXTERR_ACCESS_DENIED);
+    }
+
+    const uint64_t end = static_cast<uint64_t>(offset) + static_cast<uint64_t>(res);
+    if (have_old_size && end > old_size) {
+        adjust_used_space(static_cast<int64_t>(end - old_size));
+    }
+
     return static_cast<int32_t>(res);
+#endif
 }
 
 
 int32_t Drive::get_file_size(uint16_t handle) {
     auto & item = get_item(handle);
 
+    item.update_last_used_timestamp();
+
+    const auto path = get_item_path(handle);
+    if (const auto * const pinned_file = get_pinned_file(path)) {
+        return pinned_file->properties.size;
+    }
+
     DosFileProperties fprops;
-    if (get_path_dos_properties(item.path, &fprops, AttrsMode::IGNORE) == FAT_ERROR_ATTR) {
+#ifdef _WIN32
+    if (get_path_dos_properties(path, &fprops, AttrsMode::IGNORE) == FAT_ERROR_ATTR) {
         return -1;
     }
-
-    item.update_last_used_timestamp();
+#else
+    const auto [dir_fd, name] = get_parent_dir_fd(path);
+    if (get_path_dos_properties_at(dir_fd, name, path, &fprops, AttrsMode::IGNORE) == FAT_ERROR_ATTR) {
+        return -1;
+    }
+#endif
 
     return fprops.size;
 }
@@ -460,7 +1784,13 @@ bool Drive::set_file_date_time(uint16_t handle, uint32_t date_time) {
         return false;
     }
 
+    item.generation = ++last_generation;
+    const auto path = get_item_path(handle);
+    update_generation(path.parent_path());
+    invalidate_pinned_files(path);
+
     const auto seconds = fat_to_time(date_time);
+#ifdef _WIN32
     auto sctp = std::chrono::system_clock::from_time_t(seconds);
 #if __cpp_lib_chrono >= 201907L
     // C++20 and newer
@@ -472,9 +1802,22 @@ bool Drive::set_file_date_time(uint16_t handle, uint32_t date_time) {
     auto ftime = std::chrono::time_point_cast<std::chrono::file_clock::duration>(
         sctp - std::chrono::system_clock::now() + std::chrono::file_clock::now());
 #endif
-    std::filesystem::last_write_time(item.path, ftime);
+    std::filesystem::last_write_time(path, ftime);
 
     item.update_last_used_timestamp();
+#else
+    item.update_last_used_timestamp();
+
+    const auto [dir_fd, name] = get_parent_dir_fd(path);
+    struct timespec times[2];
+    times[0].tv_sec = 0;
+    times[0].tv_nsec = UTIME_OMIT;  // keep the last access time
+    times[1].tv_sec = seconds;
+    times[1].tv_nsec = 0;
+    if (utimensat(dir_fd, name.c_str(), times, 0) != 0) {
+        throw_filesystem_error("set_file_date_time", path, errno);
+    }
+#endif
 
     return true;
 }
@@ -513,16 +1856,22 @@ bool Drive::find_file(
         }
     }
 
-    auto & item = get_item(handle);
+    get_item(handle);  // throws for an invalid handle
+    record_cache_access(CacheStream::DIRECTORY_LISTS, handle);
 
     // recompute the dir listing if operation is FIND_FIRST (nth == 0) or if no cache found
-    if ((nth == 0) || (item.directory_list.empty())) {
-        const auto count = item.create_directory_list(*this);
+    if ((nth == 0) || (items[handle].directory_list.empty())) {
+        const auto count = refresh_directory_list(handle);
+        const auto & item = items[handle];
         if (count < 0) {
-            log(LogLevel::WARNING, "{}: Failed to scan dir \"{}\"\n", __func__, item.path.string());
+            log(LogLevel::WARNING, "{}: Failed to scan dir \"{}\"\n", __func__, get_item_path(handle).string());
             return false;
         } else {
-            log(LogLevel::DEBUG, "{}: Scanned dir \"{}\", found {} items\n", __func__, item.path.string(), count);
+            log(LogLevel::DEBUG,
+                "{}: Scanned dir \"{}\", found {} items\n",
+                __func__,
+                get_item_path(handle).string(),
+                count);
             if (global_log_level >= LogLevel::TRACE) {
                 for (const auto & item : item.directory_list) {
                     log(LogLevel::TRACE,
@@ -537,7 +1886,7 @@ bool Drive::find_file(
     }
 
     DosFileProperties const * found_props{nullptr};
-    auto & dir_list = item.directory_list;
+    auto & dir_list = items[handle].directory_list;
     const auto item_count = dir_list.size();
     uint16_t n;
     for (n = nth; n < item_count; ++n) {
@@ -559,6 +1908,9 @@ bool Drive::find_file(
     if (found_props) {
         nth = n + 1;
         properties = *found_props;
+        if (!items[handle].server_names.empty()) {
+            properties.server_name = items[handle].get_server_name(n);
+        }
         return true;
     }
 
@@ -566,29 +1918,45 @@ bool Drive::find_file(
 }
 
 
-const std::filesystem::path & Drive::get_server_name(
+std::filesystem::path Drive::get_server_name(
     uint16_t handle, const fcb_file_name & fcb_name, bool create_directory_list) {
-    static const std::filesystem::path empty_path;
-    auto & item = items[handle];
-    if (create_directory_list || item.directory_list.empty()) {
-        item.create_directory_list(*this);
+    record_cache_access(CacheStream::DIRECTORY_LISTS, handle);
+    if (create_directory_list || items[handle].directory_list.empty()) {
+        refresh_directory_list(handle);
+    }
+#ifndef _WIN32
+    int dir_fd;
+    try {
+        dir_fd = get_handle_dir_fd(handle);
+    } catch (const std::runtime_error & ex) {
+        log(LogLevel::DEBUG, "{}: {}\n", __func__, ex.what());
+        return {};
     }
-    auto & directory_list = item.directory_list;
-    for (auto it = directory_list.begin(); it != directory_list.end(); ++it) {
-        auto & dir = *it;
+#endif
+    auto & item = items[handle];
+    const auto & directory_list = item.directory_list;
+    for (std::size_t i = 0; i < directory_list.size(); ++i) {
+        const auto & dir = directory_list[i];
         if (dir.attrs != FAT_VOLUME && dir.fcb_name == fcb_name) {
-            auto server_path = item.path / dir.server_name;
-            if (!std::filesystem::exists(server_path) && !std::filesystem::is_symlink(server_path)) {
+            auto server_name = item.get_server_name(i);
+#ifdef _WIN32
+            auto server_path = get_item_path(handle) / server_name;
+            const bool exists = std::filesystem::exists(server_path) || std::filesystem::is_symlink(server_path);
+#else
+            struct stat st;
+            const bool exists = fstatat(dir_fd, server_name.c_str(), &st, AT_SYMLINK_NOFOLLOW) == 0;
+#endif
+            if (!exists) {
                 // The entry exists in the directory list, but the file no longer exists on disk.
                 // Remove the stale entry from the directory list.
-                directory_list.erase(it);
+                item.erase_directory_list_entry(i);
                 item.fcb_names.erase(fcb_name);
-                return empty_path;
+                return {};
             }
-            return dir.server_name;
+            return server_name;
         }
     }
-    return empty_path;
+    return {};
 }
 
 
@@ -612,12 +1980,19 @@ std::pair<std::filesystem::path, bool> Drive::create_server_path(
 
     if (get_file_name_conversion() == Drive::FileNameConversion::OFF) {
         auto server_path = root / client_path;
+#ifdef _WIN32
         if (!std::filesystem::exists(server_path.parent_path())) {
             throw FilesystemError(
                 std::format("create_server_path: Parent path not found: {}", server_path.parent_path().string()),
                 DOS_EXTERR_PATH_NOT_FOUND);
         }
         return {server_path, std::filesystem::exists(server_path) || std::filesystem::is_symlink(server_path)};
+#else
+        // Opening the parent directory fails if it does not exist or resolves outside the shared directory.
+        const auto [dir_fd, name] = get_parent_dir_fd(server_path);
+        struct stat st;
+        return {server_path, fstatat(dir_fd, name.c_str(), &st, AT_SYMLINK_NOFOLLOW) == 0};
+#endif
     }
 
     std::filesystem::path server_path = root;
@@ -625,7 +2000,7 @@ std::pair<std::filesystem::path, bool> Drive::create_server_path(
     auto it_end = client_path.end();
     while (true) {
         const fcb_file_name fcb_name = short_name_to_fcb(it->string());
-        auto & server_name = get_server_name(get_handle(server_path), fcb_name, create_directory_list);
+        const auto server_name = get_server_name(get_handle(server_path), fcb_name, create_directory_list);
         auto prev_it = it;
         ++it;
         if (server_name.empty()) {
@@ -662,7 +2037,14 @@ void Drive::make_dir(const std::filesystem::path & client_path) {
         throw FilesystemError("make_dir: Path exists: " + server_path.string(), DOS_EXTERR_ACCESS_DENIED);
     }
 
+    update_generation(server_path.parent_path());
+
+#ifdef _WIN32
     netmount_srv::make_dir(server_path);
+#else
+    const auto [dir_fd, name] = get_parent_dir_fd(server_path);
+    netmount_srv::make_dir(dir_fd, name, server_path);
+#endif
 
     // Recreates directory_list
     create_server_path(client_path, true);
@@ -692,7 +2074,16 @@ void Drive::delete_dir(const std::filesystem::path & client_path) {
     //    throw FilesystemError("Access denied: Directory has the READ_ONLY attribute", DOS_EXTERR_ACCESS_DENIED);
     //}
 
+    update_generation(server_path.parent_path());
+    update_generation(server_path, true);
+
+#ifdef _WIN32
     netmount_srv::delete_dir(server_path);
+#else
+    const auto [dir_fd, name] = get_parent_dir_fd(server_path);
+    netmount_srv::delete_dir(dir_fd, name, server_path);
+    release_dir_fds(server_path);
+#endif
 
     // Recreates directory_list
     create_server_path(client_path, true);
@@ -700,12 +2091,46 @@ void Drive::delete_dir(const std::filesystem::path & client_path) {
 
 
 void Drive::change_dir(const std::filesystem::path & client_path) {
+    // The server is stateless, the client keeps its current directory. The server does not change
+    // its working directory, it only verifies that the target exists and is a directory.
     auto [server_path, exist] = create_server_path(client_path);
     if (!exist) {
         throw FilesystemError(
             "change_dir: Directory does not exist: " + server_path.string(), DOS_EXTERR_PATH_NOT_FOUND);
     }
-    netmount_srv::change_dir(server_path);
+
+    if (server_path == get_root()) {
+        return;
+    }
+
+#ifndef _WIN32
+    // Opening the directory verifies that it is a directory and that it does not resolve outside the shared
+    // directory. The descriptor stays cached for the following requests (typically FIND_FIRST).
+    get_dir_fd(server_path);
+#else
+    if (get_file_name_conversion() == Drive::FileNameConversion::OFF) {
+        // There is no directory list, ask the filesystem.
+        std::error_code ec;
+        if (!std::filesystem::is_directory(server_path, ec)) {
+            throw FilesystemError(
+                "change_dir: Not a directory: " + server_path.string(), DOS_EXTERR_PATH_NOT_FOUND);
+        }
+        return;
+    }
+
+    // `create_server_path` has just walked through the directory lists, so the list of the parent directory
+    // is in the cache. Use the attributes from it instead of querying the filesystem again.
+    const auto & item = get_item(get_handle(server_path.parent_path()));
+    const auto index = item.find_server_name(server_path.filename());
+    if (index >= 0) {
+        if ((item.directory_list[index].attrs & FAT_DIRECTORY) == 0) {
+            throw FilesystemError("change_dir: Not a directory: " + server_path.string(), DOS_EXTERR_PATH_NOT_FOUND);
+        }
+        return;
+    }
+
+    throw FilesystemError("change_dir: Directory does not exist: " + server_path.string(), DOS_EXTERR_PATH_NOT_FOUND);
+#endif
 }
 
 
@@ -724,6 +2149,9 @@ void Drive::set_item_attrs(const std::filesystem::path & client_path, uint8_t at
                 DOS_EXTERR_ACCESS_DENIED);
         }
 
+        update_generation(server_path);
+        update_generation(server_path.parent_path());
+
         netmount_srv::set_item_attrs(server_path, attrs, attrs_mode);
 
         // Recreates directory_list
@@ -737,8 +2165,54 @@ uint8_t Drive::get_server_path_attrs(const std::filesystem::path & server_path)
 }
 
 
-uint8_t Drive::get_dos_properties(const std::filesystem::path & client_path, DosFileProperties * properties) {
+bool Drive::exists(const std::filesystem::path & server_path) {
+#ifdef _WIN32
+    std::error_code ec;
+    return std::filesystem::exists(server_path, ec);
+#else
+    if (relative_server_path(get_root(), server_path).empty()) {
+        return true;
+    }
+    try {
+        const auto [dir_fd, name] = get_parent_dir_fd(server_path);
+        struct stat st;
+        return fstatat(dir_fd, name.c_str(), &st, 0) == 0;
+    } catch (const std::runtime_error & ex) {
+        log(LogLevel::DEBUG, "{}: {}\n", __func__, ex.what());
+    }
+    return false;
+#endif
+}
+
+
+bool Drive::is_directory(const std::filesystem::path & server_dir) {
+#ifdef _WIN32
+    std::error_code ec;
+    return std::filesystem::is_directory(server_dir, ec);
+#else
+    if (relative_server_path(get_root(), server_dir).empty()) {
+        return true;
+    }
+    try {
+        const auto [dir_fd, name] = get_parent_dir_fd(server_dir);
+        struct stat st;
+        return fstatat(dir_fd, name.c_str(), &st, 0) == 0 && S_ISDIR(st.st_mode);
+    } catch (const std::runtime_error & ex) {
+        log(LogLevel::DEBUG, "{}: {}\n", __func__, ex.what());
+    }
+    return false;
+#endif
+}
+
+
+uint8_t Drive::get_dos_properties(
+    const std::filesystem::path & client_path,
+    DosFileProperties * properties,
+    std::filesystem::path * server_path_out) {
     auto [server_path, exist] = create_server_path(client_path);
+    if (server_path_out) {
+        *server_path_out = server_path;
+    }
 
     if (server_path == get_root()) {
         throw FilesystemError(
@@ -764,11 +2238,34 @@ uint8_t Drive::get_dos_properties(const std::filesystem::path & client_path, Dos
 
 uint8_t Drive::get_server_path_dos_properties(
     const std::filesystem::path & server_path, DosFileProperties * properties) {
+    if (const auto * const pinned_file = get_pinned_file(server_path)) {
+        if (properties) {
+            *properties = pinned_file->properties;
+        }
+        return pinned_file->properties.attrs;
+    }
+    return read_server_path_dos_properties(server_path, properties);
+}
+
+
+uint8_t Drive::read_server_path_dos_properties(
+    const std::filesystem::path & server_path, DosFileProperties * properties) {
+#ifdef _WIN32
     return get_path_dos_properties(server_path, properties, get_attrs_mode());
+#else
+    try {
+        const auto [dir_fd, name] = get_parent_dir_fd(server_path);
+        return get_path_dos_properties_at(dir_fd, name, server_path, properties, get_attrs_mode());
+    } catch (const std::runtime_error & ex) {
+        log(LogLevel::DEBUG, "{}: {}\n", __func__, ex.what());
+    }
+    return FAT_ERROR_ATTR;
+#endif
 }
 
 
-void Drive::rename_file(const std::filesystem::path & old_client_path, const std::filesystem::path & new_client_path) {
+std::pair<std::filesystem::path, std::filesystem::path> Drive::rename_file(
+    const std::filesystem::path & old_client_path, const std::filesystem::path & new_client_path) {
     if (is_read_only()) {
         throw FilesystemError(std::string(__func__) + ": Drive is read-only", DOS_EXTERR_DISK_WRITE_PROTECTED);
     }
@@ -819,14 +2316,32 @@ void Drive::rename_file(const std::filesystem::path & old_client_path, const std
             DOS_EXTERR_ACCESS_DENIED);
     }
 
+    update_generation(old_server_path.parent_path());
+    update_generation(old_server_path, true);
+    update_generation(new_server_path.parent_path());
+    update_generation(new_server_path, true);
+
+#ifdef _WIN32
     netmount_srv::rename_file(old_server_path, new_server_path);
+    move_item(old_server_path, new_server_path);
+#else
+    const auto [old_dir_fd, old_name] = get_parent_dir_fd(old_server_path);
+    const auto [new_dir_fd, new_name] = get_parent_dir_fd(new_server_path);
+    netmount_srv::rename_file(old_dir_fd, old_name, new_dir_fd, new_name, old_server_path, new_server_path);
+    // The cached descriptors of a moved directory and its subdirectories still refer to the right directories.
+    if (!move_item(old_server_path, new_server_path)) {
+        release_dir_fds(old_server_path);
+    }
+#endif
 
     // Recreates directory_list
     create_server_path(new_client_path, true);
+
+    return {old_server_path, new_server_path};
 }
 
 
-void Drive::delete_files(const std::filesystem::path & client_pattern) {
+std::vector<std::filesystem::path> Drive::delete_files(const std::filesystem::path & client_pattern) {
     if (is_read_only()) {
         throw FilesystemError(std::string(__func__) + ": Drive is read-only", DOS_EXTERR_DISK_WRITE_PROTECTED);
     }
@@ -851,8 +2366,26 @@ void Drive::delete_files(const std::filesystem::path & client_pattern) {
                 DOS_EXTERR_ACCESS_DENIED);
         }
 
+        update_generation(server_path);
+        update_generation(server_path.parent_path());
+
+#ifdef _WIN32
+        std::error_code ec;
+        const auto size = std::filesystem::file_size(server_path, ec);
         netmount_srv::delete_file(server_path);
-        return;
+        if (!ec) {
+            adjust_used_space(-static_cast<int64_t>(size));
+        }
+#else
+        const auto [dir_fd, name] = get_parent_dir_fd(server_path);
+        struct stat st;
+        const bool is_file = fstatat(dir_fd, name.c_str(), &st, AT_SYMLINK_NOFOLLOW) == 0 && S_ISREG(st.st_mode);
+        netmount_srv::delete_file(dir_fd, name, server_path);
+        if (is_file) {
+            adjust_used_space(-static_cast<int64_t>(st.st_size));
+        }
+#endif
+        return {server_path};
     }
 
     // test if pattern contains '?' characters
@@ -872,10 +2405,16 @@ void Drive::delete_files(const std::filesystem::path & client_pattern) {
     const std::filesystem::path directory = server_path.parent_path();
     const std::string filemask = client_pattern.filename().string();
 
+    // Files from the directory are going to be deleted.
+    update_generation(directory, true);
+
+    std::vector<std::filesystem::path> deleted_paths;
+
     const auto filfcb = short_name_to_fcb(filemask);
 
     if (get_file_name_conversion() == Drive::FileNameConversion::OFF) {
         // If file name conversion is turned off, we traverse the file system directly.
+#ifdef _WIN32
         for (const auto & dentry : std::filesystem::directory_iterator(directory)) {
             if (dentry.is_directory()) {
                 // skip directories and symlinks to directories
@@ -898,26 +2437,98 @@ void Drive::delete_files(const std::filesystem::path & client_pattern) {
                     continue;
                 }
                 std::error_code ec;
+                const auto size = dentry.file_size(ec);
+                const bool size_known = !ec;
                 if (!std::filesystem::remove(dentry.path(), ec)) {
                     log(LogLevel::NOTICE, "{}: Failed to delete file \"{}\": {}\n", __func__, path_str, ec.message());
+                    continue;
+                }
+                if (size_known) {
+                    adjust_used_space(-static_cast<int64_t>(size));
                 }
+                deleted_paths.push_back(dentry.path());
             }
         }
-        return;
+#else
+        // The directory is listed and its files are deleted relative to its descriptor, a directory that
+        // resolves outside the shared directory is not opened.
+        const int dir_fd = get_dir_fd(directory);
+        // `dir_fd` may be an O_PATH descriptor which cannot be used for reading, open the directory for reading.
+        const int list_fd = openat(dir_fd, ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (list_fd == -1) {
+            throw_filesystem_error("delete_files", directory, errno);
+        }
+        DIR * const dir = fdopendir(list_fd);
+        if (!dir) {
+            const auto orig_errno = errno;
+            close(list_fd);
+            throw_filesystem_error("delete_files", directory, orig_errno);
+        }
+        std::vector<std::string> names;
+        while (const auto * const dentry = readdir(dir)) {
+            if (strcmp(dentry->d_name, ".") != 0 && strcmp(dentry->d_name, "..") != 0) {
+                names.emplace_back(dentry->d_name);
+            }
+        }
+        closedir(dir);
+
+        for (const auto & name : names) {
+            struct stat st;
+            if (fstatat(dir_fd, name.c_str(), &st, 0) == 0 && S_ISDIR(st.st_mode)) {
+                // skip directories and symlinks to directories
+                continue;
+            }
+
+            // if match, delete the file
+            if (match_fcb_name_to_mask(filfcb, short_name_to_fcb(name))) {
+                const auto path = directory / name;
+                uint8_t attrs = 0;
+                try {
+                    attrs = get_server_path_attrs(path);
+                } catch (const std::runtime_error &) {
+                }
+                if (attrs & FAT_RO) {
+                    log(LogLevel::NOTICE,
+                        "{}: Access denied: File \"{}\" has the READ_ONLY attribute",
+                        __func__,
+                        path.string());
+                    continue;
+                }
+                const bool is_file =
+                    fstatat(dir_fd, name.c_str(), &st, AT_SYMLINK_NOFOLLOW) == 0 && S_ISREG(st.st_mode);
+                try {
+                    netmount_srv::delete_file(dir_fd, name, path);
+                } catch (const std::runtime_error & ex) {
+                    log(LogLevel::NOTICE, "{}: Failed to delete file \"{}\": {}\n", __func__, path.string(), ex.what());
+                    continue;
+                }
+                if (is_file) {
+                    adjust_used_space(-static_cast<int64_t>(st.st_size));
+                }
+                deleted_paths.push_back(path);
+            }
+        }
+#endif
+        return deleted_paths;
     }
 
+#ifndef _WIN32
+    const int dir_fd = get_dir_fd(directory);
+#endif
     const auto handle = get_handle(directory);
     const auto & item = items[handle];
 
     // iterate over the directory_list and delete files that match the pattern
-    for (const auto & file_properties : item.directory_list) {
+    for (std::size_t i = 0; i < item.directory_list.size(); ++i) {
+        const auto & file_properties = item.directory_list[i];
         if (file_properties.attrs & FAT_DIRECTORY) {
             // skip directories
             continue;
         }
 
         if (match_fcb_name_to_mask(filfcb, file_properties.fcb_name)) {
-            const auto path = directory / file_properties.server_name;
+            const auto server_name = item.get_server_name(i);
+            const auto path = directory / server_name;
             uint8_t attrs = 0;
             try {
                 attrs = get_server_path_attrs(path);
@@ -931,12 +2542,20 @@ void Drive::delete_files(const std::filesystem::path & client_pattern) {
                 continue;
             }
             try {
+#ifdef _WIN32
                 netmount_srv::delete_file(path);
+#else
+                netmount_srv::delete_file(dir_fd, server_name, path);
+#endif
+                adjust_used_space(-static_cast<int64_t>(file_properties.size));
+                deleted_paths.push_back(path);
             } catch (const std::runtime_error & ex) {
                 log(LogLevel::NOTICE, "{}: Failed to delete file \"{}\": {}\n", __func__, path.string(), ex.what());
             }
         }
     }
+
+    return deleted_paths;
 }
 
 
@@ -968,7 +2587,42 @@ DosFileProperties Drive::create_or_truncate_file(
         }
     }
 
+    update_generation(server_path);
+    update_generation(server_path.parent_path());
+
+#ifdef _WIN32
+    // An existing file is truncated, its space is released.
+    if (current_attrs != FAT_ERROR_ATTR) {
+        std::error_code ec;
+        const auto size = std::filesystem::file_size(server_path, ec);
+        if (!ec) {
+            adjust_used_space(-static_cast<int64_t>(size));
+        }
+    }
+
     return netmount_srv::create_or_truncate_file(server_path, requested_attrs, get_attrs_mode());
+#else
+    const auto [dir_fd, name] = get_parent_dir_fd(server_path);
+    if (is_dangling_symlink_at(dir_fd, name)) {
+        throw FilesystemError(
+            "create_or_truncate_file: Dangling symlink: " + server_path.string(), DOS_EXTERR_ACCESS_DENIED);
+    }
+
+    // The file is truncated after it is opened, its size is read from the opened descriptor.
+    const auto fd = open_item(server_path, O_WRONLY | O_CREAT, 0666);
+    struct stat st;
+    if (fstat(fd.get(), &st) != 0) {
+        throw_filesystem_error("create_or_truncate_file", server_path, errno);
+    }
+    if (S_ISREG(st.st_mode) && st.st_size > 0) {
+        if (ftruncate(fd.get(), 0) != 0) {
+            throw_filesystem_error("create_or_truncate_file", server_path, errno);
+        }
+        // An existing file is truncated, its space is released.
+        adjust_used_space(-static_cast<int64_t>(st.st_size));
+    }
+    return netmount_srv::create_or_truncate_file(fd.get(), server_path, requested_attrs, get_attrs_mode());
+#endif
 }
 
 
@@ -992,7 +2646,16 @@ void Drive::try_open_file(const std::filesystem::path & server_path, uint8_t ope
             DOS_EXTERR_ACCESS_DENIED);
     }
 
+    if ((open_mode & 0x03) == OPEN_MODE_RDONLY && get_pinned_file(server_path)) {
+        // The file is readable, it is in memory.
+        return;
+    }
+
+#ifdef _WIN32
     netmount_srv::try_open_file(server_path, open_mode);
+#else
+    open_item(server_path, open_mode_to_flags(open_mode));
+#endif
 }
 
 
@@ -1001,84 +2664,208 @@ std::pair<uint64_t, uint64_t> Drive::space_info() {
     if (root.empty()) {
         throw std::runtime_error("space_info: Not shared drive");
     }
-    return netmount_srv::fs_space_info(root);
+    if (space_info_time == 0) {
+        std::tie(space_total, space_free) = netmount_srv::fs_space_info(root);
+        space_info_time = time(NULL);
+    }
+    if (quota == 0) {
+        return {space_total, space_free};
+    }
+    collect_quota_scan();
+    if (quota_scan_time == 0) {
+        // Summing the file sizes of a large share takes long, it must not delay the request.
+        if (!quota_scan.valid()) {
+            start_quota_scan();
+        }
+        return {quota, std::min(quota, space_free)};
+    }
+    const uint64_t quota_free = quota > quota_used ? quota - quota_used : 0;
+    return {quota, std::min(quota_free, space_free)};
+}
+
+
+void Drive::refresh_space_info() {
+    // Only the information that was already requested by a client is refreshed.
+    const auto now = time(NULL);
+    collect_quota_scan();
+    if (quota_scan_time != 0 && !quota_scan.valid() && now - quota_scan_time >= QUOTA_RESCAN_INTERVAL) {
+        start_quota_scan();
+    }
+    if (space_info_time != 0 && now - space_info_time >= SPACE_INFO_REFRESH_INTERVAL) {
+        space_info_time = now;  // on error, the old values are used until the next refresh
+        std::tie(space_total, space_free) = netmount_srv::fs_space_info(get_root());
+    }
+}
+
+
+void Drive::adjust_used_space(int64_t delta) noexcept {
+    // The cached values are approximate (allocation granularity, sparse files), the next refresh corrects them.
+    if (delta > 0) {
+        space_free -= std::min(space_free, static_cast<uint64_t>(delta));
+        quota_used += delta;
+    } else {
+        space_free = std::min(space_total, space_free - delta);
+        quota_used -= std::min(quota_used, static_cast<uint64_t>(-delta));
+    }
+}
+
+
+void Drive::start_quota_scan() {
+    std::promise<uint64_t> promise;
+    quota_scan = promise.get_future();
+    const TerminationSignalsBlocker signals_blocker;
+    std::thread([root = get_root(), promise = std::move(promise)]() mutable {
+        try {
+            promise.set_value(sum_file_sizes(root));
+        } catch (...) {
+            promise.set_exception(std::current_exception());
+        }
+    }).detach();
+}
+
+
+void Drive::collect_quota_scan() {
+    if (!quota_scan.valid() || quota_scan.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+        return;
+    }
+    // The changes made during the scan may be counted twice or not at all, the next scan corrects them.
+    quota_scan_time = time(NULL);
+    try {
+        quota_used = quota_scan.get();
+    } catch (const std::exception & ex) {
+        log(LogLevel::WARNING, "{}: Drive root \"{}\": {}\n", __func__, get_root().string(), ex.what());
+    }
 }
 
 
-int32_t Drive::Item::create_directory_list(const Drive & drive) {
+int32_t Drive::Item::create_directory_list(
+    const Drive & drive, const std::filesystem::path & path, [[maybe_unused]] int dir_fd) {
     directory_list.clear();
+    server_names = {};
     fcb_names.clear();
 
-    try {
-        for (const auto & dentry : std::filesystem::directory_iterator(path)) {
-            if (directory_list.empty()) {
-                std::error_code ec;
-                const bool is_root_dir = std::filesystem::equivalent(path, drive.get_root(), ec);
-                if (ec) {
-                    log(LogLevel::WARNING, "{}: {}\n", __func__, ec.message());
-                    return -1;
+#ifdef _WIN32
+    std::error_code ec;
+    const bool is_root_dir = std::filesystem::equivalent(path, drive.get_root(), ec);
+    if (ec) {
+        log(LogLevel::WARNING, "{}: {}\n", __func__, ec.message());
+        return -1;
+    }
+#else
+    const bool is_root_dir = dir_fd == drive.root_fd.get();
+#endif
+
+    // Fills `fprops` with the properties of the directory entry `name`.
+    auto get_entry_properties = [&](const std::filesystem::path & name, DosFileProperties & fprops) {
+#ifdef _WIN32
+        get_path_dos_properties(path / name, &fprops, drive.get_attrs_mode());
+#else
+        get_path_dos_properties_at(dir_fd, name, path / name, &fprops, drive.get_attrs_mode());
+#endif
+    };
+
+    // Appends the directory entry `filename` to the directory list.
+    // Returns false if the directory list is full.
+    auto add_entry = [&](const std::filesystem::path & filename) {
+        if (directory_list.empty()) {
+            if (is_root_dir) {
+                if (drive.has_volume_label) {
+                    DosFileProperties fprops;
+                    fprops.fcb_name = drive.volume_label;
+                    fprops.attrs = FAT_VOLUME;
+                    fprops.size = 0;
+                    fprops.time_date = 0;
+                    log(LogLevel::DEBUG,
+                        "{}: VOLUME LABEL {:.8s}{:.3s} -> {:.8s} {:.3s}\n",
+                        __func__,
+                        reinterpret_cast<const char *>(drive.volume_label.name_blank_padded),
+                        reinterpret_cast<const char *>(drive.volume_label.ext_blank_padded),
+                        reinterpret_cast<const char *>(fprops.fcb_name.name_blank_padded),
+                        reinterpret_cast<const char *>(fprops.fcb_name.ext_blank_padded));
+                    directory_list.emplace_back(fprops);
                 }
-                if (is_root_dir) {
-                    if (drive.has_volume_label) {
-                        DosFileProperties fprops;
-                        fprops.fcb_name = drive.volume_label;
-                        fprops.attrs = FAT_VOLUME;
-                        fprops.size = 0;
-                        fprops.time_date = 0;
-                        log(LogLevel::DEBUG,
-                            "{}: VOLUME LABEL {:.8s}{:.3s} -> {:.8s} {:.3s}\n",
-                            __func__,
-                            reinterpret_cast<const char *>(drive.volume_label.name_blank_padded),
-                            reinterpret_cast<const char *>(drive.volume_label.ext_blank_padded),
-                            reinterpret_cast<const char *>(fprops.fcb_name.name_blank_padded),
-                            reinterpret_cast<const char *>(fprops.fcb_name.ext_blank_padded));
-                        directory_list.emplace_back(fprops);
-                    }
-                } else {
-                    // Add the . and .. entries to non-root directories
-                    for (const auto name : {".", ".."}) {
-                        const auto fullpath = path / name;
-                        DosFileProperties fprops;
-                        get_path_dos_properties(fullpath, &fprops, drive.get_attrs_mode());
-                        fprops.fcb_name = short_name_to_fcb(name);
-                        if (drive.get_file_name_conversion() != Drive::FileNameConversion::OFF) {
-                            fprops.server_name = name;
-                        }
-                        log(LogLevel::DEBUG,
-                            "{}: {} -> {:.8s} {:.3s}\n",
-                            __func__,
-                            name,
-                            reinterpret_cast<const char *>(fprops.fcb_name.name_blank_padded),
-                            reinterpret_cast<const char *>(fprops.fcb_name.ext_blank_padded));
-                        directory_list.emplace_back(fprops);
+            } else {
+                // Add the . and .. entries to non-root directories
+                for (const auto name : {".", ".."}) {
+                    DosFileProperties fprops;
+                    get_entry_properties(name, fprops);
+                    fprops.fcb_name = short_name_to_fcb(name);
+                    if (drive.get_file_name_conversion() != Drive::FileNameConversion::OFF) {
+                        fprops.server_name = name;
                     }
+                    log(LogLevel::DEBUG,
+                        "{}: {} -> {:.8s} {:.3s}\n",
+                        __func__,
+                        name,
+                        reinterpret_cast<const char *>(fprops.fcb_name.name_blank_padded),
+                        reinterpret_cast<const char *>(fprops.fcb_name.ext_blank_padded));
+                    directory_list.emplace_back(fprops);
                 }
-            } else if (directory_list.size() == 0xFFFFU) {
-                // DOS FIND uses a 16-bit offset for directory entries, we cannot address more than 65535 entries.
-                log(LogLevel::ERROR, "{}: Directory \"{}\" contains more than 65535 items", __func__, path.string());
-                break;
             }
+        } else if (directory_list.size() == 0xFFFFU) {
+            // DOS FIND uses a 16-bit offset for directory entries, we cannot address more than 65535 entries.
+            log(LogLevel::ERROR, "{}: Directory \"{}\" contains more than 65535 items", __func__, path.string());
+            return false;
+        }
 
-            DosFileProperties fprops;
-            auto path = dentry.path();
-            auto filename = path.filename();
-            get_path_dos_properties(path, &fprops, drive.get_attrs_mode());
-            if (drive.get_file_name_conversion() != Drive::FileNameConversion::OFF) {
-                file_name_to_83(filename, fprops.fcb_name, fcb_names);
-                fprops.server_name = filename;
+        DosFileProperties fprops;
+        get_entry_properties(filename, fprops);
+        if (drive.get_file_name_conversion() != Drive::FileNameConversion::OFF) {
+            file_name_to_83(filename, fprops.fcb_name, fcb_names);
+            fprops.server_name = filename;
+        }
+        log(LogLevel::DEBUG,
+            "{}: {} -> {:.8s} {:.3s}\n",
+            __func__,
+            filename.string(),
+            reinterpret_cast<const char *>(fprops.fcb_name.name_blank_padded),
+            reinterpret_cast<const char *>(fprops.fcb_name.ext_blank_padded));
+        directory_list.emplace_back(fprops);
+        return true;
+    };
+
+#ifdef _WIN32
+    try {
+        for (const auto & dentry : std::filesystem::directory_iterator(path)) {
+            if (!add_entry(dentry.path().filename())) {
+                break;
+            }
+        }
+    } catch (const std::runtime_error & ex) {
+        log(LogLevel::WARNING, "{}: {}\n", __func__, ex.what());
+        return -1;
+    }
+#else
+    // `dir_fd` may be an O_PATH descriptor which cannot be used for reading, open the directory for reading.
+    const int list_fd = openat(dir_fd, ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (list_fd == -1) {
+        log(LogLevel::WARNING, "{}: Cannot open directory \"{}\": {}\n", __func__, path.string(), strerror(errno));
+        return -1;
+    }
+    DIR * const dir = fdopendir(list_fd);
+    if (!dir) {
+        const auto orig_errno = errno;
+        close(list_fd);
+        log(LogLevel::WARNING, "{}: Cannot read directory \"{}\": {}\n", __func__, path.string(), strerror(orig_errno));
+        return -1;
+    }
+    try {
+        while (const auto * const dentry = readdir(dir)) {
+            const char * const name = dentry->d_name;
+            if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) {
+                continue;
+            }
+            if (!add_entry(name)) {
+                break;
             }
-            log(LogLevel::DEBUG,
-                "{}: {} -> {:.8s} {:.3s}\n",
-                __func__,
-                filename.string(),
-                reinterpret_cast<const char *>(fprops.fcb_name.name_blank_padded),
-                reinterpret_cast<const char *>(fprops.fcb_name.ext_blank_padded));
-            directory_list.emplace_back(fprops);
         }
     } catch (const std::runtime_error & ex) {
+        closedir(dir);
         log(LogLevel::WARNING, "{}: {}\n", __func__, ex.what());
         return -1;
     }
+    closedir(dir);
+#endif
 
     update_last_used_timestamp();
 
@@ -1086,6 +2873,54 @@ int32_t Drive::Item::create_directory_list(const Drive & drive) {
 }
 
 
+void Drive::Item::compress_directory_list(FrontCodedNames::Statistics & statistics) {
+    std::vector<FrontCodedNames::string_type> names;
+    names.reserve(directory_list.size());
+    for (auto & entry : directory_list) {
+        names.push_back(entry.server_name.native());
+        entry.server_name = std::filesystem::path();
+    }
+    server_names = FrontCodedNames(names, statistics);
+}
+
+
+std::filesystem::path Drive::Item::get_server_name(std::size_t index) const {
+    if (server_names.empty()) {
+        return directory_list[index].server_name;
+    }
+    return server_names.get(index);
+}
+
+
+int32_t Drive::Item::find_server_name(const std::filesystem::path & name) const {
+    if (!server_names.empty()) {
+        const auto index = server_names.find(name.native());
+        return index >= 0 && directory_list[index].attrs != FAT_VOLUME ? index : -1;
+    }
+    for (std::size_t i = 0; i < directory_list.size(); ++i) {
+        if (directory_list[i].attrs != FAT_VOLUME && directory_list[i].server_name == name) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+
+void Drive::Item::erase_directory_list_entry(std::size_t index) {
+    directory_list.erase(directory_list.begin() + index);
+    if (!server_names.empty()) {
+        server_names.erase(index);
+    }
+}
+
+
+void Drive::Item::release_directory_list() {
+    directory_list = {};
+    server_names = {};
+    fcb_names.clear();
+}
+
+
 void Drive::Item::update_last_used_timestamp() { last_used_time = time(NULL); }
 
 
@@ -1231,6 +3066,7 @@ bool file_name_to_83(
 }
 
 
+#ifdef _WIN32
 uint8_t get_path_dos_properties(
     const std::filesystem::path & path, DosFileProperties * properties, [[maybe_unused]] AttrsMode mode) {
     std::error_code ec;
@@ -1285,6 +3121,64 @@ uint8_t get_path_dos_properties(
 
     return FAT_ERROR_ATTR;
 }
+#else
+uint8_t get_path_dos_properties_at(
+    int dir_fd,
+    const std::filesystem::path & name,
+    const std::filesystem::path & path,
+    DosFileProperties * properties,
+    AttrsMode mode) {
+    struct stat st;
+    if (fstatat(dir_fd, name.c_str(), &st, 0) == 0) {
+        return stat_to_dos_properties(&st, path, properties, mode);
+    }
+    if (errno == ENOENT && fstatat(dir_fd, name.c_str(), &st, AT_SYMLINK_NOFOLLOW) == 0 && S_ISLNK(st.st_mode)) {
+        return stat_to_dos_properties(nullptr, path, properties, mode);
+    }
+    log(LogLevel::DEBUG, "{}: Cannot stat \"{}\": {}\n", __func__, path.string(), strerror(errno));
+    return FAT_ERROR_ATTR;
+}
+
+
+uint8_t stat_to_dos_properties(
+    const struct stat * st, const std::filesystem::path & path, DosFileProperties * properties, AttrsMode mode) {
+    const bool is_directory = st && S_ISDIR(st->st_mode);
+    uint8_t attrs = is_directory ? FAT_DIRECTORY : 0;
+
+    if (properties) {
+        // set file fcbname to the file part of path (ignore traling directory separators)
+        auto it = path.end();
+        while (it != path.begin() && (--it)->empty()) {
+        }
+        properties->fcb_name = short_name_to_fcb(it->string());
+        properties->time_date = time_to_fat(st ? st->st_mtime : 0);
+        properties->attrs = attrs;
+        properties->size = st && !is_directory ? st->st_size : 0;
+    }
+
+    if (!st) {
+        // dangling symlink
+        return attrs;
+    }
+
+    try {
+        if (mode == AttrsMode::IGNORE) {
+            // Saves the filesystem calls made by `get_item_attrs`, the result is known.
+            attrs |= is_directory ? 0 : FAT_ARCHIVE;
+        } else {
+            attrs |= get_item_attrs(path, mode);
+        }
+        if (properties) {
+            properties->attrs = attrs;
+        }
+        return attrs;
+    } catch (const std::runtime_error & ex) {
+        log(LogLevel::DEBUG, "{}: {}\n", __func__, ex.what());
+    }
+
+    return FAT_ERROR_ATTR;
+}
+#endif
 
 
 void set_item_attrs(
@@ -1331,6 +3225,7 @@ uint8_t get_item_attrs([[maybe_unused]] const std::filesystem::path & path, [[ma
 }
 
 
+#ifdef _WIN32
 void make_dir(const std::filesystem::path & dir) {
     if (is_dangling_symlink(dir)) {
         throw FilesystemError("make_dir: Dangling symlink - not directory: " + dir.string(), DOS_EXTERR_ACCESS_DENIED);
@@ -1356,26 +3251,13 @@ void delete_dir(const std::filesystem::path & dir) {
 }
 
 
-void change_dir(const std::filesystem::path & dir) {
-    if (is_dangling_symlink(dir)) {
-        throw FilesystemError(
-            "change_dir: Dangling symlink - not directory: " + dir.string(), DOS_EXTERR_PATH_NOT_FOUND);
-    }
-    std::filesystem::current_path(dir);
-}
-
-
 DosFileProperties create_or_truncate_file(const std::filesystem::path & path, uint8_t attrs, AttrsMode mode) {
     if (is_dangling_symlink(path)) {
         throw FilesystemError("create_or_truncate_file: Dangling symlink: " + path.string(), DOS_EXTERR_ACCESS_DENIED);
     }
 
     // try to create/truncate the file
-#ifdef _WIN32
     auto * const fd = _wfopen(path.c_str(), L"wb");
-#else
-    auto * const fd = fopen(path.c_str(), "wb");
-#endif
     if (!fd) {
         throw FilesystemError(std::format("Cannot open file: {}", strerror(errno)), DOS_EXTERR_ACCESS_DENIED);
     }
@@ -1441,7 +3323,6 @@ void resize_file(const std::filesystem::path & path, uint32_t new_size) {
     }
 #else
     // Fallback to platform-specific implementation
-#ifdef _WIN32
     FILE * const f = _wfopen(path.c_str(), L"r+b");
     if (!f) {
         throw FilesystemError(
@@ -1453,11 +3334,6 @@ void resize_file(const std::filesystem::path & path, uint32_t new_size) {
     if (err != 0) {
         throw FilesystemError(std::format("Cannot resize file: {}", strerror(err)), DOS_EXTERR_ACCESS_DENIED);
     }
-#else
-    if (truncate(path.string().c_str(), new_size) != 0) {
-        throw FilesystemError(std::format("Cannot resize file: {}", strerror(errno)), DOS_EXTERR_ACCESS_DENIED);
-    }
-#endif
 #endif
 }
 
@@ -1476,6 +3352,201 @@ void delete_file(const std::filesystem::path & file) {
 void rename_file(const std::filesystem::path & old_name, const std::filesystem::path & new_name) {
     std::filesystem::rename(old_name, new_name);
 }
+#else
+int openat_beneath(int dir_fd, const char * name, int flags, mode_t mode) {
+#ifdef HAVE_OPENAT2
+    static std::atomic<bool> openat2_supported = true;
+    if (openat2_supported) {
+        struct open_how how;
+        memset(&how, 0, sizeof(how));
+        how.flags = flags | O_CLOEXEC;
+        how.mode = (flags & O_CREAT) ? mode : 0;
+        how.resolve = RESOLVE_BENEATH | RESOLVE_NO_MAGICLINKS;
+        int fd;
+        int eagain_retries = 0;
+        do {
+            fd = syscall(SYS_openat2, dir_fd, name, &how, sizeof(how));
+        } while (fd == -1 &&
+                 (errno == EINTR || (errno == EAGAIN && ++eagain_retries <= OPENAT2_EAGAIN_MAX_RETRIES)));
+        if (fd != -1 || (errno != ENOSYS && errno != E2BIG)) {
+            return fd;
+        }
+        openat2_supported = false;
+        log(LogLevel::WARNING,
+            "{}: openat2 is not supported by the kernel, symlinks leading outside the shared directory "
+            "are not refused\n",
+            __func__);
+    }
+#endif
+#ifdef O_RESOLVE_BENEATH
+    flags |= O_RESOLVE_BENEATH;
+#endif
+    int fd;
+    do {
+        fd = openat(dir_fd, name, flags | O_CLOEXEC, mode);
+    } while (fd == -1 && errno == EINTR);
+    return fd;
+}
+
+
+bool is_beneath_violation(int err) {
+#ifdef ENOTCAPABLE
+    if (err == ENOTCAPABLE) {
+        return true;
+    }
+#endif
+    return err == EXDEV;
+}
+
+
+std::tuple<int, uint64_t, uint64_t> get_device_order_key(int fd, uint32_t offset) {
+#ifdef __linux__
+    alignas(struct fiemap) uint8_t buffer[sizeof(struct fiemap) + sizeof(struct fiemap_extent)];
+    memset(buffer, 0, sizeof(buffer));
+    auto * const fiemap = reinterpret_cast<struct fiemap *>(buffer);
+    fiemap->fm_start = offset;
+    fiemap->fm_length = 1;
+    fiemap->fm_extent_count = 1;
+    if (ioctl(fd, FS_IOC_FIEMAP, fiemap) == 0 && fiemap->fm_mapped_extents == 1) {
+        const auto & extent = fiemap->fm_extents[0];
+        if (!(extent.fe_flags & (FIEMAP_EXTENT_UNKNOWN | FIEMAP_EXTENT_DELALLOC)) && extent.fe_logical <= offset) {
+            return {0, extent.fe_physical + (offset - extent.fe_logical), 0};
+        }
+    }
+#endif
+    struct stat st;
+    if (fstat(fd, &st) == 0) {
+        return {1, st.st_ino, offset};
+    }
+    return {2, 0, offset};
+}
+
+
+std::filesystem::path relative_server_path(
+    const std::filesystem::path & root, const std::filesystem::path & server_path) {
+    auto relative_path = server_path.lexically_normal().lexically_relative(root);
+    if (relative_path.empty() || *relative_path.begin() == "..") {
+        throw FilesystemError(
+            std::format("Security alert: Path \"{}\" is outside the shared directory", server_path.string()),
+            DOS_EXTERR_PATH_NOT_FOUND);
+    }
+    if (relative_path == ".") {
+        return {};
+    }
+    if (relative_path.filename().empty()) {
+        // remove trailing directory separator
+        relative_path = relative_path.parent_path();
+    }
+    return relative_path;
+}
+
+
+int open_mode_to_flags(uint8_t open_mode) {
+    switch (open_mode & 0x03) {  // use only access mode bits, ignore sharing mode
+        case OPEN_MODE_RDONLY:
+            return O_RDONLY;
+        case OPEN_MODE_WRONLY:
+        case OPEN_MODE_RDWR:
+            return O_RDWR;
+        default:
+            throw FilesystemError(
+                std::format("try_open_file: Invalid open mode 0x{:02X}", open_mode), DOS_EXTERR_FUNC_NUM_INVALID);
+    }
+}
+
+
+void throw_filesystem_error(const char * what, const std::filesystem::path & path, int err) {
+    throw std::filesystem::filesystem_error(what, path, std::error_code(err, std::generic_category()));
+}
+
+
+void make_dir(int dir_fd, const std::filesystem::path & name, const std::filesystem::path & dir) {
+    if (mkdirat(dir_fd, name.c_str(), 0777) != 0) {
+        if (errno == EEXIST) {
+            // also a dangling symlink
+            throw FilesystemError("make_dir: Path exists: " + dir.string(), DOS_EXTERR_ACCESS_DENIED);
+        }
+        throw_filesystem_error("make_dir", dir, errno);
+    }
+}
+
+
+void delete_dir(int dir_fd, const std::filesystem::path & name, const std::filesystem::path & dir) {
+    struct stat st;
+    if (fstatat(dir_fd, name.c_str(), &st, AT_SYMLINK_NOFOLLOW) != 0) {
+        throw FilesystemError("delete_dir: Directory does not exist: " + dir.string(), DOS_EXTERR_PATH_NOT_FOUND);
+    }
+    int flags = AT_REMOVEDIR;
+    if (S_ISLNK(st.st_mode)) {
+        if (fstatat(dir_fd, name.c_str(), &st, 0) != 0) {
+            throw FilesystemError(
+                "delete_dir: Dangling symlink - not directory: " + dir.string(), DOS_EXTERR_ACCESS_DENIED);
+        }
+        // A symlink to a directory. The symlink is removed, not the directory it points to.
+        flags = 0;
+    }
+    if (!S_ISDIR(st.st_mode)) {
+        throw FilesystemError("delete_dir: Not a directory: " + dir.string(), DOS_EXTERR_ACCESS_DENIED);
+    }
+    if (unlinkat(dir_fd, name.c_str(), flags) != 0) {
+        throw_filesystem_error("delete_dir", dir, errno);
+    }
+}
+
+
+DosFileProperties create_or_truncate_file(int fd, const std::filesystem::path & path, uint8_t attrs, AttrsMode mode) {
+    // set FAT attributes
+    if (mode != AttrsMode::IGNORE) {
+        try {
+            set_item_attrs(path, attrs, mode);
+        } catch (const std::runtime_error & ex) {
+            log(LogLevel::WARNING,
+                "{}: Failed to set attribute 0x{:02X} to \"{}\": {}\n",
+                __func__,
+                attrs,
+                path.string(),
+                ex.what());
+        }
+    }
+
+    DosFileProperties properties;
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        throw_filesystem_error("create_or_truncate_file", path, errno);
+    }
+    stat_to_dos_properties(&st, path, &properties, mode);
+    return properties;
+}
+
+
+void delete_file(int dir_fd, const std::filesystem::path & name, const std::filesystem::path & file) {
+    struct stat st;
+    if (fstatat(dir_fd, name.c_str(), &st, AT_SYMLINK_NOFOLLOW) != 0) {
+        throw FilesystemError("delete_file: File does not exist: " + file.string(), DOS_EXTERR_FILE_NOT_FOUND);
+    }
+    if (S_ISDIR(st.st_mode) ||
+        (S_ISLNK(st.st_mode) && fstatat(dir_fd, name.c_str(), &st, 0) == 0 && S_ISDIR(st.st_mode))) {
+        throw FilesystemError("delete_file: Is a directory: " + file.string(), DOS_EXTERR_ACCESS_DENIED);
+    }
+    if (unlinkat(dir_fd, name.c_str(), 0) != 0) {
+        throw_filesystem_error("delete_file", file, errno);
+    }
+}
+
+
+void rename_file(
+    int old_dir_fd,
+    const std::filesystem::path & old_name,
+    int new_dir_fd,
+    const std::filesystem::path & new_name,
+    const std::filesystem::path & old_path,
+    const std::filesystem::path & new_path) {
+    if (renameat(old_dir_fd, old_name.c_str(), new_dir_fd, new_name.c_str()) != 0) {
+        throw std::filesystem::filesystem_error(
+            "rename_file", old_path, new_path, std::error_code(errno, std::generic_category()));
+    }
+}
+#endif
 
 
 std::pair<uint64_t, uint64_t> fs_space_info(const std::filesystem::path & path) {
@@ -1483,6 +3554,46 @@ std::pair<uint64_t, uint64_t> fs_space_info(const std::filesystem::path & path)
     return {info.capacity, info.free};
 }
 
+
+uint64_t sum_file_sizes(const std::filesystem::path & root) {
+    uint64_t used = 0;
+#ifndef _WIN32
+    std::set<std::pair<dev_t, ino_t>> linked_files;  // counted files with more than one hard link
+#endif
+    std::error_code ec;
+    for (auto it = std::filesystem::recursive_directory_iterator(
+             root, std::filesystem::directory_options::skip_permission_denied, ec);
+         !ec && it != std::filesystem::recursive_directory_iterator();
+         it.increment(ec)) {
+        // Symlinks are not followed, their targets may be outside the drive.
+        std::error_code status_ec;
+        if (!std::filesystem::is_regular_file(it->symlink_status(status_ec))) {
+            continue;
+        }
+#ifdef _WIN32
+        std::error_code size_ec;
+        const auto size = it->file_size(size_ec);
+        if (!size_ec) {
+            used += size;
+        }
+#else
+        struct stat st;
+        if (lstat(it->path().c_str(), &st) != 0 || !S_ISREG(st.st_mode)) {
+            continue;
+        }
+        // A file with several hard links in the drive is counted once.
+        if (st.st_nlink > 1 && !linked_files.emplace(st.st_dev, st.st_ino).second) {
+            continue;
+        }
+        used += st.st_size;
+#endif
+    }
+    if (ec) {
+        log(LogLevel::WARNING, "{}: Drive root \"{}\": {}\n", __func__, root.string(), ec.message());
+    }
+    return used;
+}
+
 }  // namespace
 
 }  // namespace netmount_srv
@@ -6,13 +6,23 @@
 
 #include "../shared/dos.h"
 #include "config.hpp"
+#include "front_coded_names.hpp"
+#include "miss_ratio_curve.hpp"
 
 #include <stdint.h>
 #include <string.h>
+#ifndef _WIN32
+#include <sys/types.h>
+#endif
+#include <time.h>
 
+#include <deque>
 #include <filesystem>
+#include <future>
+#include <map>
 #include <set>
 #include <string>
+#include <unordered_map>
 #include <utility>
 #include <vector>
 
@@ -50,6 +60,9 @@ namespace netmount_srv {
 
 enum class AttrsMode { AUTO, IGNORE, NATIVE, IN_EXTENDED };
 
+class ContentCache;
+class SharedDirectoryCache;
+
 class FilesystemError : public std::runtime_error {
 public:
     FilesystemError(const std::string & msg, uint16_t dos_err_code) : runtime_error(msg), dos_err_code(dos_err_code) {}
@@ -60,6 +73,41 @@ private:
 };
 
 
+#ifndef _WIN32
+// Owns a file descriptor and closes it on destruction.
+class UniqueFd {
+public:
+    UniqueFd() noexcept = default;
+    explicit UniqueFd(int fd) noexcept : fd(fd) {}
+    UniqueFd(UniqueFd && other) noexcept : fd(other.release()) {}
+    UniqueFd & operator=(UniqueFd && other) noexcept {
+        reset(other.release());
+        return *this;
+    }
+    ~UniqueFd() { reset(); }
+
+    UniqueFd(const UniqueFd &) = delete;
+    UniqueFd & operator=(const UniqueFd &) = delete;
+
+    int get() const noexcept { return fd; }
+    explicit operator bool() const noexcept { return fd >= 0; }
+
+    // Returns the descriptor and gives up its ownership.
+    int release() noexcept {
+        const int ret = fd;
+        fd = -1;
+        return ret;
+    }
+
+    // Closes the owned descriptor (if any) and takes ownership of `new_fd`.
+    void reset(int new_fd = -1) noexcept;
+
+private:
+    int fd{-1};
+};
+#endif
+
+
 struct DosFileProperties {
     fcb_file_name fcb_name;             // DOS FCB (file control block) style file name
     uint32_t size;                      // file size in bytes
@@ -72,6 +120,14 @@ struct DosFileProperties {
 class Drive {
 public:
     enum class FileNameConversion { OFF, RAM };
+    enum class MediaType { SSD, HDD, OPTICAL };
+
+    // Caches whose access streams are recorded for miss ratio curve estimation
+    enum class CacheStream { HANDLES, DIRECTORY_LISTS, READ_BLOCKS };
+    constexpr static int CACHE_STREAM_COUNT = 3;
+
+    // Granularity of the READ_BLOCKS access stream
+    constexpr static uint32_t READ_BLOCK_SIZE = 4096;
 
     // Returns true if this drive is used (shared)
     bool is_shared() const noexcept { return used; }
@@ -90,6 +146,8 @@ public:
     AttrsMode get_attrs_mode() const noexcept { return attrs_mode; }
 
     // Sets `root` for this drive. Initialize `used`.
+    // On POSIX systems it also opens the root directory. All filesystem access is then resolved relative to it.
+    // Throws exception on error.
     void set_root(std::filesystem::path root);
 
     void set_volume_label(const std::string & label);
@@ -97,6 +155,64 @@ public:
     void set_file_name_conversion(FileNameConversion conversion) { name_conversion = conversion; }
     FileNameConversion get_file_name_conversion() const { return name_conversion; }
 
+    /// Sets the type of the media the root is stored on. On seek-bound media (HDD, OPTICAL), files are read
+    /// ahead in large aligned chunks. The windows of the files read by several clients are refilled together,
+    /// in the order of their position on the device. Read-ahead is not supported on Windows.
+    void set_media_type(MediaType type);
+    MediaType get_media_type() const noexcept { return media_type; }
+
+    /// Sets the patterns of files to be pinned in memory by `load_pinned_files`. The patterns are relative
+    /// to the root, use '/' as the directory separator and may contain the '*' and '?' wildcards. Matching
+    /// is case insensitive.
+    void set_pin_patterns(std::vector<std::string> patterns) { pin_patterns = std::move(patterns); }
+
+    /// Loads the properties and content of the files matching the pin patterns into memory.
+    /// OPEN, GET_ATTRS and READ requests for the pinned files are then served from memory. A pinned file
+    /// is reloaded when it changes.
+    void load_pinned_files();
+
+    /// Processes pending change notifications of the pinned files. The generations of the changed files
+    /// and their directories are updated. Without notification support, changes are detected when a pinned
+    /// file is accessed.
+    void process_pinned_files_events();
+
+    /// Returns the number of pinned files and the number of bytes of their content held in memory.
+    std::pair<std::size_t, std::size_t> get_pinned_files_usage() const noexcept;
+
+    /// Sets the cache of directory listings shared with other server instances, nullptr disables it.
+    /// The cache is used on POSIX systems only.
+    void set_shared_directory_cache(SharedDirectoryCache * cache) noexcept { shared_directory_cache = cache; }
+
+    /// Sets the cache of file contents shared by the drives, nullptr disables it. The first read of a small file
+    /// loads the whole file into the cache, the next reads are served from memory. The cache is used on POSIX
+    /// systems only.
+    void set_content_cache(ContentCache * cache) noexcept { content_cache = cache; }
+
+    /// Enables recording of the cache access streams. Miss ratio curves are then estimated for them.
+    void enable_cache_statistics();
+
+    /// Returns the miss ratio curve of the `stream` cache, or nullptr if cache statistics are not enabled.
+    const MissRatioCurve * get_miss_ratio_curve(CacheStream stream) const noexcept;
+
+    /// Limits the number of directory listings kept in memory, the least recently used ones are released.
+    /// 0 means no limit.
+    void set_max_directory_list_count(std::size_t count) noexcept { max_directory_list_count = count; }
+    std::size_t get_max_directory_list_count() const noexcept { return max_directory_list_count; }
+
+    /// Returns the number of directory listings held in memory and their approximate size in bytes.
+    std::pair<std::size_t, std::size_t> get_directory_lists_usage() const noexcept;
+
+    /// Enables keeping the server names of the directory listings front-coded (see FrontCodedNames).
+    /// Saves memory on directories with many long names sharing prefixes, a name is decoded when it is needed.
+    /// Used with name conversion only, without it the listings do not hold server names.
+    void set_compress_names(bool enabled) noexcept { compress_names = enabled; }
+    bool get_compress_names() const noexcept { return compress_names; }
+
+    /// Returns the counters of the compressed listings.
+    const FrontCodedNames::Statistics & get_compressed_names_statistics() const noexcept {
+        return compressed_names_statistics;
+    }
+
     Drive() = default;
 
     // Drive is accessed by reference. Make sure no one copies the Drive by mistake.
@@ -104,11 +220,18 @@ public:
     Drive & operator=(const Drive &) = delete;
 
     /// Returns the handle (start cluster in dos) of a filesystem item (file or directory).
-    /// Returns 0xffff on error
+    /// Handles are also assigned to the parent directories of the item.
+    /// Throws exception if `server_path` is outside the root.
     uint16_t get_handle(const std::filesystem::path & server_path);
 
     /// Returns the path to the filesystem item represented by the handle.
-    const std::filesystem::path & get_handle_path(uint16_t handle);
+    /// The path is built from the names of the item and its parent directories.
+    std::filesystem::path get_handle_path(uint16_t handle);
+
+    /// Returns the generation of the filesystem item represented by the handle, or 0 for an invalid handle.
+    /// The generation changes whenever the server changes the item (for a directory, its content) and when
+    /// the handle is reassigned to another item. Generations are unique within the drive.
+    uint32_t get_generation(uint16_t handle) const noexcept;
 
     /// Reads `len` bytes from `offset` from the file defined by `handle` to `buffer`.
     /// Returns the number of bytes read
@@ -152,6 +275,7 @@ public:
     /// Throws exception on error.
     void delete_dir(const std::filesystem::path & client_path);
 
+    /// Verifies that `client_path` is an existing directory. The process working directory is not changed.
     /// Throws exception on error.
     void change_dir(const std::filesystem::path & client_path);
 
@@ -163,19 +287,35 @@ public:
     /// Throws exception on error.
     uint8_t get_server_path_attrs(const std::filesystem::path & server_path);
 
+    /// Returns true if the item `server_path` exists, a symlink is followed.
+    /// On POSIX systems, the item is looked up relative to the descriptor of its parent directory.
+    bool exists(const std::filesystem::path & server_path);
+
+    /// Returns true if `server_dir` is a directory, a symlink is followed.
+    /// On POSIX systems, the item is looked up relative to the descriptor of its parent directory.
+    bool is_directory(const std::filesystem::path & server_dir);
+
     /// Fills the DosFileProperties structure if `properties` != nullptr.
+    /// Stores the resolved server path to `server_path` if `server_path` != nullptr. It is stored also if the file
+    /// does not exist (and the exception is thrown).
     /// Returns DOS attributes for `client_path` or FAT_ERROR_ATTR on error.
     /// DOS attr flags: 1=RO 2=HID 4=SYS 8=VOL 16=DIR 32=ARCH 64=DEVICE
-    uint8_t get_dos_properties(const std::filesystem::path & client_path, DosFileProperties * properties);
+    uint8_t get_dos_properties(
+        const std::filesystem::path & client_path,
+        DosFileProperties * properties,
+        std::filesystem::path * server_path = nullptr);
 
     uint8_t get_server_path_dos_properties(const std::filesystem::path & server_path, DosFileProperties * properties);
 
     /// Renames `old_client_name` to `new_client_name`
-    void rename_file(const std::filesystem::path & old_client_path, const std::filesystem::path & new_client_path);
+    /// Returns the old and the new server path.
+    std::pair<std::filesystem::path, std::filesystem::path> rename_file(
+        const std::filesystem::path & old_client_path, const std::filesystem::path & new_client_path);
 
     /// Removes all files matching the pattern
+    /// Returns the server paths of the removed files.
     /// Throws exception on error or if no matching file found
-    void delete_files(const std::filesystem::path & client_pattern);
+    std::vector<std::filesystem::path> delete_files(const std::filesystem::path & client_pattern);
 
     /// Creates or truncates a file `server_path` with attributes `attrs`.
     /// Returns properties of created/truncated file.
@@ -186,12 +326,79 @@ public:
     /// Try to open a file, then close it.
     void try_open_file(const std::filesystem::path & server_path, uint8_t open_mode, uint8_t current_attrs);
 
-    /// Returns filesystem total size and free space in bytes, or 0, 0 on error
+#ifndef _WIN32
+    /// Opens the filesystem item `server_path`. The path is resolved by the kernel and must not escape `root`,
+    /// including through symbolic links.
+    /// Throws exception on error.
+    UniqueFd open_item(const std::filesystem::path & server_path, int flags, mode_t mode = 0);
+#endif
+
+    /// Sets a virtual quota in bytes, 0 means no quota. With a quota, the quota is reported as the total size
+    /// and the quota minus the size of the files on the drive as the free space (at most the real free space).
+    void set_quota(uint64_t bytes) noexcept { quota = bytes; }
+    uint64_t get_quota() const noexcept { return quota; }
+
+    /// Returns total size and free space in bytes, or 0, 0 on error.
+    /// The values are cached and adjusted by the writes, truncates and deletes made through this drive.
+    /// The cache is refreshed by `refresh_space_info`, only the first call reads the filesystem.
+    /// With a quota, the first call starts summing the sizes of the files in a background thread. Until the sum
+    /// is known, the free space of the filesystem (at most the quota) is returned.
     std::pair<uint64_t, uint64_t> space_info();
 
+    /// Reads the filesystem space information if the cached one is older than SPACE_INFO_REFRESH_INTERVAL.
+    /// With a quota, takes over a finished sum of the file sizes and starts a new one in a background thread
+    /// if the last sum is older than QUOTA_RESCAN_INTERVAL.
+    /// Called between requests (after a reply is sent, when idle) so that DISK_INFO does not wait for it.
+    /// Throws exception on error.
+    void refresh_space_info();
+
 private:
+    // Files larger than this are not pinned.
+    constexpr static uint32_t MAX_PINNED_FILE_SIZE = 16 * 1024 * 1024;
+
+    // Without change notifications, a pinned file is compared with the file on the server after this many seconds.
+    constexpr static time_t PINNED_FILE_VALIDATE_INTERVAL = 2;
+
     constexpr static uint16_t MAX_HANDLE_COUNT = 0xFFFFU;
 
+    // Marks a missing parent, child or sibling item. It is not a valid handle.
+    constexpr static uint16_t NO_HANDLE = 0xFFFFU;
+
+    // Directory listings not used for this many seconds are released. The handles are checked for them
+    // every DIRECTORY_LIST_AGING_INTERVAL seconds.
+    constexpr static time_t DIRECTORY_LIST_MAX_IDLE_TIME = 3600;
+    constexpr static time_t DIRECTORY_LIST_AGING_INTERVAL = 60;
+
+    // Smaller directory listings are not compressed, the indexes of the compressed names would take more memory
+    // than the compression saves.
+    constexpr static std::size_t MIN_COMPRESSED_DIRECTORY_LIST_SIZE = 64;
+
+    // The cached filesystem space information is read again after this many seconds.
+    constexpr static time_t SPACE_INFO_REFRESH_INTERVAL = 10;
+
+    // With a quota, the sizes of the files on the drive are summed again after this many seconds.
+    constexpr static time_t QUOTA_RESCAN_INTERVAL = 600;
+
+#ifndef _WIN32
+    // Read-ahead on seek-bound media: the number of files read ahead at the same time and the chunk size.
+    // A file is read ahead in a window of two chunks.
+    constexpr static unsigned int HDD_READ_AHEAD_STREAMS = 8;
+    constexpr static uint32_t HDD_READ_AHEAD_CHUNK_SIZE = 32 * 1024;
+    constexpr static unsigned int OPTICAL_READ_AHEAD_STREAMS = 4;
+    constexpr static uint32_t OPTICAL_READ_AHEAD_CHUNK_SIZE = 64 * 1024;
+
+    // Data read ahead is used for this many seconds. After that, it is read again (the file may have been
+    // changed by another program on the server).
+    constexpr static time_t READ_AHEAD_VALIDATE_INTERVAL = 2;
+
+    // Maximum number of cached directory descriptors (in addition to the root descriptor).
+    constexpr static unsigned int MAX_DIR_FD_COUNT = 128;
+
+    // A cached directory descriptor is trusted for this many seconds. After that, it is verified that
+    // the path still refers to the same directory (it may have been renamed or replaced on the server).
+    constexpr static time_t DIR_FD_VALIDATE_INTERVAL = 2;
+#endif
+
     bool used{false};
     std::filesystem::path root;
     bool read_only{false};
@@ -200,26 +407,263 @@ private:
     bool has_volume_label{false};
     AttrsMode attrs_mode{AttrsMode::AUTO};
     FileNameConversion name_conversion{FileNameConversion::RAM};
+    uint32_t last_generation{0};  // the last generation assigned to an item
+    SharedDirectoryCache * shared_directory_cache{nullptr};
+    ContentCache * content_cache{nullptr};
+    std::vector<MissRatioCurve> miss_ratio_curves;  // indexed by CacheStream, empty if statistics are disabled
+    std::size_t max_directory_list_count{0};
+    bool compress_names{false};
+    FrontCodedNames::Statistics compressed_names_statistics;
+    MediaType media_type{MediaType::SSD};
+    uint64_t quota{0};
+    uint64_t space_total{0};           // cached filesystem size
+    uint64_t space_free{0};            // cached filesystem free space
+    time_t space_info_time{0};         // when the space information was read, 0 = never
+    uint64_t quota_used{0};            // sum of the sizes of the files on the drive
+    time_t quota_scan_time{0};         // when the file sizes were summed, 0 = never
+    std::future<uint64_t> quota_scan;  // sum of the file sizes computed in the background, valid while running
+
+    struct PinnedFile {
+        DosFileProperties properties;
+        std::vector<uint8_t> data;  // content of the file
+        bool valid{false};          // false if `properties` and `data` must be reloaded
+        time_t validated_time{0};   // when the file was last compared to the file on the server
+#ifdef __linux__
+        int watch_descriptor{-1};  // inotify watch descriptor
+#endif
+    };
+    std::vector<std::string> pin_patterns;
+    std::map<std::filesystem::path, PinnedFile> pinned_files;
+#ifdef __linux__
+    UniqueFd pinned_files_inotify_fd;  // inotify instance that reports changes of the pinned files
+#endif
 
+#ifndef _WIN32
+    struct ReadAheadStream {
+        std::filesystem::path path;  // file read ahead, empty if the stream is not used
+        std::vector<uint8_t> data;   // content of the file from `offset`
+        uint32_t offset{0};          // offset of the window in the file, aligned to the chunk size
+        uint32_t position{0};        // end of the last read served from the window
+        bool eof{false};             // the window reaches the end of the file
+        time_t fill_time{0};         // when the oldest data in the window was read
+        uint64_t last_used{0};       // for replacing the least recently used stream
+    };
+    std::vector<ReadAheadStream> read_ahead_streams;
+    uint32_t read_ahead_chunk_size{0};
+    uint64_t read_ahead_clock{0};
+#endif
+
+#ifndef _WIN32
+    UniqueFd root_fd;                     // descriptor of the `root` directory
+    std::deque<uint16_t> dir_fd_handles;  // handles with a cached directory descriptor, least recently used first
+#endif
+
+    // Interned item names. Items with the same name share one string, the value is the number of the items.
+    // Names are compared by their address.
+    using Name = std::pair<const std::filesystem::path::string_type, uint32_t>;
+    std::unordered_map<std::filesystem::path::string_type, uint32_t> names;
+
+    // The items form a tree. An item is identified by the handle of its parent directory and its name,
+    // the path of the item is built from the names only when needed. An item with child items keeps its handle.
     class Item {
     public:
-        std::filesystem::path path;                     // path to filesystem item
+        Name * name{nullptr};                           // name of the item, nullptr if the handle is not used
+        uint16_t parent{NO_HANDLE};                     // parent directory, NO_HANDLE for the root
+        uint16_t first_child{NO_HANDLE};                // child items are linked by `next_sibling`, `prev_sibling`
+        uint16_t next_sibling{NO_HANDLE};               // next item in the parent directory
+        uint16_t prev_sibling{NO_HANDLE};               // previous item in the parent directory
         time_t last_used_time;                          // when this item was last used
         std::vector<DosFileProperties> directory_list;  // used by FIND_FIRST and FIND_NEXT
+        FrontCodedNames server_names;                   // server names of `directory_list` if compressed
         std::set<fcb_file_name> fcb_names;
+        uint32_t generation;                            // see `Drive::get_generation`
+#ifndef _WIN32
+        UniqueFd dir_fd;               // cached descriptor of the directory
+        dev_t dir_dev;                 // device of the directory referred to by `dir_fd`
+        ino_t dir_ino;                 // inode of the directory referred to by `dir_fd`
+        time_t dir_fd_validated_time;  // when `dir_fd` was last verified to refer to the item
+#endif
+
+        bool is_used() const noexcept { return name != nullptr; }
 
-        // Creates a directory listing for `path`.
+        // Creates a directory listing for the item, `path` is its path.
+        // On POSIX systems, `dir_fd` is the descriptor of the directory `path`.
         // Returns the number of filesystem entries, or -1 if an error occurs.
-        int32_t create_directory_list(const Drive & drive);
+        int32_t create_directory_list(const Drive & drive, const std::filesystem::path & path, int dir_fd);
+
+        // Moves the server names of `directory_list` to `server_names`.
+        void compress_directory_list(FrontCodedNames::Statistics & statistics);
+
+        // Returns the server name of the entry `index` of `directory_list`.
+        std::filesystem::path get_server_name(std::size_t index) const;
+
+        // Returns the index of the entry of `directory_list` with the server name `name`, or -1 if there is none.
+        // The volume label entry is not considered.
+        int32_t find_server_name(const std::filesystem::path & name) const;
+
+        // Removes the entry `index` from `directory_list`.
+        void erase_directory_list_entry(std::size_t index);
+
+        // Releases the directory listing.
+        void release_directory_list();
 
         void update_last_used_timestamp();
     };
     std::vector<Item> items;
+    std::vector<uint16_t> free_handles;   // unused handles in `items`
+    uint16_t root_handle{NO_HANDLE};      // handle of the root directory, NO_HANDLE if no item has a handle
+    time_t directory_lists_aged_time{0};  // when the handles were last checked for unused directory listings
+
+    struct ChildKey {
+        uint16_t parent;
+        const Name * name;
+
+        bool operator==(const ChildKey &) const = default;
+    };
+    struct ChildKeyHash {
+        std::size_t operator()(const ChildKey & key) const noexcept {
+            return std::hash<const void *>()(key.name) ^ (key.parent * 0x9E3779B97F4A7C15ULL);
+        }
+    };
+    std::unordered_map<ChildKey, uint16_t, ChildKeyHash> child_handles;  // (parent, name) -> handle
 
     Item & get_item(uint16_t handle);
 
-    const std::filesystem::path & get_server_name(
-        uint16_t handle, const fcb_file_name & fcb_name, bool create_directory_list);
+    // Returns the handle of `server_path`, or NO_HANDLE if it has no handle or is outside the root.
+    uint16_t find_handle(const std::filesystem::path & server_path) const;
+
+    // Returns the path of the item `handle`.
+    std::filesystem::path get_item_path(uint16_t handle) const;
+
+    // Returns the next item of the subtree `subtree_root` after `handle` in preorder, or NO_HANDLE.
+    uint16_t next_subtree_item(uint16_t handle, uint16_t subtree_root) const noexcept;
+
+    // Assigns a handle to the item `name` in the directory `parent` (NO_HANDLE for the root).
+    // If all handles are used, the handle of the least recently used item without child items is reused,
+    // `parent` is never reused.
+    uint16_t add_item(uint16_t parent, const std::filesystem::path::string_type & name, time_t now);
+
+    // Releases the handle of the item without child items.
+    void remove_item(uint16_t handle);
+
+    // Links the item to the directory `parent` under `name`.
+    void link_item(uint16_t handle, uint16_t parent, const std::filesystem::path::string_type & name);
+
+    // Unlinks the item from its parent directory and releases its name.
+    void unlink_item(uint16_t handle);
+
+    // Moves the handle of `old_server_path` (with its subitems) to `new_server_path` after a rename, the handles
+    // keep referring to the renamed items. Returns false if the handles cannot be moved and stay unchanged.
+    bool move_item(const std::filesystem::path & old_server_path, const std::filesystem::path & new_server_path);
+
+    // Releases the listings of the directories not used for DIRECTORY_LIST_MAX_IDLE_TIME.
+    void release_idle_directory_lists(time_t now);
+
+    // Recreates the directory listing for the directory defined by `handle`.
+    // The generation of the directory is changed if the listing differs from the previous one.
+    // Returns the number of filesystem entries, or -1 if an error occurs.
+    int32_t refresh_directory_list(uint16_t handle);
+
+    // Adjusts the cached space information by `delta` bytes allocated (positive) or released (negative)
+    // by a change made through this drive.
+    void adjust_used_space(int64_t delta) noexcept;
+
+    // Starts summing the sizes of the files on the drive in a background thread.
+    void start_quota_scan();
+
+    // Takes over the sum of the file sizes into `quota_used` if the background scan finished.
+    void collect_quota_scan();
+
+    // Releases the least recently used directory listings above `max_directory_list_count`.
+    // The listing of `handle` is kept.
+    void limit_directory_lists(uint16_t handle);
+
+    // Records an access to the item `path` (to the block `block` for READ_BLOCKS) in the `stream`.
+    void record_cache_access(CacheStream stream, const std::filesystem::path & path, uint64_t block = 0) {
+        if (!miss_ratio_curves.empty()) {
+            const auto key = std::filesystem::hash_value(path) ^ (block * 0x9E3779B97F4A7C15ULL);
+            miss_ratio_curves[static_cast<int>(stream)].access(key);
+        }
+    }
+
+    // Records an access to the item `handle`. The path is built only if cache statistics are enabled.
+    void record_cache_access(CacheStream stream, uint16_t handle, uint64_t block = 0) {
+        if (!miss_ratio_curves.empty()) {
+            record_cache_access(stream, get_item_path(handle), block);
+        }
+    }
+
+#ifndef _WIN32
+    // Serves the read from the read-ahead window of the file `server_path`, the window is refilled if needed.
+    // Returns the number of bytes read, or -1 if the read cannot be served from the window.
+    // Throws exception on error.
+    int32_t read_file_ahead(void * buffer, const std::filesystem::path & server_path, uint32_t offset, uint16_t len);
+
+    // Serves the read from the content cache, the whole file `fd` is loaded into the cache on the first read.
+    // Returns the number of bytes read, or -1 if the file is not cacheable or cannot be loaded.
+    int32_t read_file_cached(void * buffer, int fd, uint32_t offset, uint16_t len);
+
+    // Moves the window of `stream` to contain `offset`. The windows of the other streams whose reader reached
+    // the second chunk of the window are moved forward in the same batch. The reads are sorted by their
+    // position on the device.
+    // Throws exception if `stream` cannot be read.
+    void refill_read_ahead_streams(ReadAheadStream & stream, uint32_t offset, time_t now);
+
+    // Drops the data read ahead from `server_path` (and its subitems if `include_subitems` is set).
+    void invalidate_read_ahead(const std::filesystem::path & server_path, bool include_subitems);
+
+    // Returns a hash of the drive settings that affect the content of directory listings.
+    uint64_t get_directory_list_settings_hash() const noexcept;
+
+    // Removes the listing of the directory `server_path` from the shared directory cache.
+    // Does nothing if `server_path` is not a directory.
+    void invalidate_shared_directory_list(const std::filesystem::path & server_path);
+#endif
+
+    // Assigns a new generation to the item `server_path` if it has a handle.
+    // If `include_subitems` is true, also to all items under `server_path` (used when a directory is removed
+    // or renamed). The affected pinned files are invalidated.
+    void update_generation(const std::filesystem::path & server_path, bool include_subitems = false);
+
+    // Gets DOS properties of `server_path` from the filesystem (pinned files are not used).
+    // Returns DOS attributes or FAT_ERROR_ATTR on error.
+    uint8_t read_server_path_dos_properties(const std::filesystem::path & server_path, DosFileProperties * properties);
+
+    // Returns the pinned file `server_path` or nullptr if the file is not pinned or cannot be loaded.
+    // The file is reloaded if it was changed.
+    const PinnedFile * get_pinned_file(const std::filesystem::path & server_path);
+
+    // Loads the properties and content of the pinned file `server_path`. Returns false on error.
+    bool reload_pinned_file(const std::filesystem::path & server_path, PinnedFile & pinned_file);
+
+    // Marks the pinned file `server_path` as changed. If `include_subitems` is true, also all pinned files
+    // under `server_path`.
+    void invalidate_pinned_files(const std::filesystem::path & server_path, bool include_subitems = false);
+
+#ifndef _WIN32
+    // Returns the descriptor of the directory `server_dir`. The descriptor is owned by the drive and stays
+    // valid at least until the next call. Descriptors are cached, an uncached directory is opened relative
+    // to the descriptor of its parent directory, so the kernel walks only one path component.
+    // Throws exception on error.
+    int get_dir_fd(const std::filesystem::path & server_dir);
+
+    // Same as `get_dir_fd` for the directory item `handle`. Does not change `items`.
+    // Throws exception on error.
+    int get_handle_dir_fd(uint16_t handle);
+
+    // Returns the descriptor of the parent directory of `server_path` and the file name of `server_path`.
+    // Throws exception on error.
+    std::pair<int, std::filesystem::path> get_parent_dir_fd(const std::filesystem::path & server_path);
+
+    // Closes the cached descriptor of the directory defined by `handle`.
+    void release_dir_fd(uint16_t handle);
+
+    // Closes the cached descriptors of `server_path` and of all its subdirectories.
+    // Used when a directory is removed or renamed.
+    void release_dir_fds(const std::filesystem::path & server_path);
+#endif
+
+    std::filesystem::path get_server_name(uint16_t handle, const fcb_file_name & fcb_name, bool create_directory_list);
 };
 
 
@@ -0,0 +1,343 @@
+// SPDX-License-Identifier: GPL-2.0-only
+// Copyright 2025-2026 Jaroslav Rohel, jaroslav.rohel@gmail.com
+
+#include "lock_manager.hpp"
+
+#include "logger.hpp"
+
+#ifdef __linux__
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <iterator>
+#include <vector>
+
+namespace netmount_srv {
+
+LockManager::LockManager(time_t lease_time, bool host_locks) : lease_time(lease_time), host_locks(host_locks) {
+#ifndef F_OFD_SETLK
+    if (host_locks) {
+        log(LogLevel::WARNING, "LockManager: Locking of server files is not supported on this platform\n");
+        this->host_locks = false;
+    }
+#endif
+}
+
+
+LockManager::~LockManager() {
+#ifdef F_OFD_SETLK
+    for (auto & [path, file] : files) {
+        if (file.host_fd != -1) {
+            close(file.host_fd);
+        }
+    }
+#endif
+}
+
+
+std::map<std::uint64_t, LockManager::Range>::iterator LockManager::find_overlap(
+    File & file, std::uint64_t offset, std::uint64_t end) noexcept {
+    // The ranges are disjoint. Only the last range starting before `end` can overlap [offset, end),
+    // all the ranges before it end before it starts.
+    auto it = file.ranges.lower_bound(end);
+    if (it == file.ranges.begin()) {
+        return file.ranges.end();
+    }
+    --it;
+    return it->second.end > offset ? it : file.ranges.end();
+}
+
+
+bool LockManager::release_if_expired(const Owner & owner) {
+    if (lease_time == 0) {
+        return false;
+    }
+    const auto it = owners.find(owner);
+    if (it == owners.end() || time(NULL) - it->second.last_seen < lease_time) {
+        return false;
+    }
+    log(LogLevel::NOTICE,
+        "LockManager: Lease of client {}.{}.{}.{}:{} expired, releasing {} locks\n",
+        owner.ipv4_addr >> 24,
+        (owner.ipv4_addr >> 16) & 0xFF,
+        (owner.ipv4_addr >> 8) & 0xFF,
+        owner.ipv4_addr & 0xFF,
+        owner.udp_port,
+        it->second.lock_count);
+    statistics.expired_locks += it->second.lock_count;
+    release_owner(owner);
+    return true;
+}
+
+
+void LockManager::release_owner(const Owner & owner) {
+    for (auto file_it = files.begin(); file_it != files.end();) {
+        auto & [path, file] = *file_it;
+        for (auto it = file.ranges.begin(); it != file.ranges.end();) {
+            if (it->second.owner == owner) {
+                set_host_lock(path, file, false, it->first, it->second.end - it->first);
+                it = file.ranges.erase(it);
+            } else {
+                ++it;
+            }
+        }
+        remove_file_if_unused(file_it++);
+    }
+    owners.erase(owner);
+}
+
+
+bool LockManager::open_host_file(
+    const std::filesystem::path & path, File & file, const OpenFileFunction & open_file) {
+#ifdef F_OFD_SETLK
+    if (!host_locks || file.host_fd != -1) {
+        return true;
+    }
+    // A write lock requires a file opened for writing. A read-only file gets a read lock, it still
+    // prevents other programs from write-locking the range. O_NONBLOCK: opening a FIFO must not wait.
+    try {
+        try {
+            file.host_fd = open_file(O_RDWR | O_NONBLOCK);
+        } catch (const std::exception &) {
+            file.host_fd = open_file(O_RDONLY | O_NONBLOCK);
+        }
+    } catch (const std::exception & ex) {
+        log(LogLevel::WARNING, "LockManager: Cannot open \"{}\": {}\n", path.native(), ex.what());
+        return false;
+    }
+#else
+    (void)path;
+    (void)file;
+    (void)open_file;
+#endif
+    return true;
+}
+
+
+bool LockManager::set_host_lock(
+    const std::filesystem::path & path, File & file, bool lock, std::uint64_t offset, std::uint64_t length) {
+#ifdef F_OFD_SETLK
+    if (!host_locks || file.host_fd == -1) {
+        return true;
+    }
+    const bool read_only = (fcntl(file.host_fd, F_GETFL) & O_ACCMODE) == O_RDONLY;
+
+    struct flock fl;
+    memset(&fl, 0, sizeof(fl));
+    fl.l_type = lock ? (read_only ? F_RDLCK : F_WRLCK) : F_UNLCK;
+    fl.l_whence = SEEK_SET;
+    fl.l_start = static_cast<off_t>(offset);
+    fl.l_len = static_cast<off_t>(length);
+    if (fcntl(file.host_fd, F_OFD_SETLK, &fl) == -1) {
+        log(LogLevel::INFO,
+            "LockManager: Cannot {} range {}+{} of \"{}\": {}\n",
+            lock ? "lock" : "unlock",
+            offset,
+            length,
+            path.native(),
+            strerror(errno));
+        return false;
+    }
+#else
+    (void)path;
+    (void)file;
+    (void)lock;
+    (void)offset;
+    (void)length;
+#endif
+    return true;
+}
+
+
+void LockManager::remove_file_if_unused(std::map<std::filesystem::path, File>::iterator file_it) {
+    if (!file_it->second.ranges.empty()) {
+        return;
+    }
+#ifdef F_OFD_SETLK
+    if (file_it->second.host_fd != -1) {
+        close(file_it->second.host_fd);
+    }
+#endif
+    files.erase(file_it);
+}
+
+
+bool LockManager::lock(
+    const std::filesystem::path & path,
+    const Owner & owner,
+    std::uint64_t offset,
+    std::uint64_t length,
+    const OpenFileFunction & open_file) {
+    ++statistics.lock_requests;
+    if (length == 0) {
+        return true;
+    }
+    const auto end = offset + length < offset ? UINT64_MAX : offset + length;
+
+    auto file_it = files.try_emplace(path).first;
+    auto & file = file_it->second;
+    auto overlap_it = find_overlap(file, offset, end);
+    if (overlap_it != file.ranges.end()) {
+        const auto overlap_owner = overlap_it->second.owner;
+        if (overlap_owner == owner || !release_if_expired(overlap_owner)) {
+            ++statistics.conflicts;
+            return false;
+        }
+        // The file could be removed together with the expired locks.
+        file_it = files.try_emplace(path).first;
+        if (find_overlap(file_it->second, offset, end) != file_it->second.ranges.end()) {
+            ++statistics.conflicts;
+            return false;
+        }
+    }
+
+    if (!open_host_file(path, file_it->second, open_file) ||
+        !set_host_lock(path, file_it->second, true, offset, end - offset)) {
+        ++statistics.conflicts;
+        remove_file_if_unused(file_it);
+        return false;
+    }
+
+    file_it->second.ranges.emplace(offset, Range{end, owner});
+    auto & owner_info = owners.try_emplace(owner).first->second;
+    owner_info.last_seen = time(NULL);
+    ++owner_info.lock_count;
+    return true;
+}
+
+
+bool LockManager::unlock(
+    const std::filesystem::path & path, const Owner & owner, std::uint64_t offset, std::uint64_t length) {
+    ++statistics.unlock_requests;
+    if (length == 0) {
+        return true;
+    }
+    const auto end = offset + length < offset ? UINT64_MAX : offset + length;
+
+    const auto file_it = files.find(path);
+    if (file_it == files.end()) {
+        return false;
+    }
+    auto & file = file_it->second;
+    const auto it = file.ranges.find(offset);
+    if (it == file.ranges.end() || it->second.end != end || it->second.owner != owner) {
+        return false;
+    }
+
+    set_host_lock(path, file, false, offset, end - offset);
+    file.ranges.erase(it);
+    remove_file_if_unused(file_it);
+
+    const auto owner_it = owners.find(owner);
+    if (owner_it != owners.end() && --owner_it->second.lock_count == 0) {
+        owners.erase(owner_it);
+    }
+    return true;
+}
+
+
+bool LockManager::is_access_allowed(
+    const std::filesystem::path & path, const Owner & owner, std::uint64_t offset, std::uint64_t length) {
+    if (length == 0 || files.empty()) {
+        return true;
+    }
+    const auto file_it = files.find(path);
+    if (file_it == files.end()) {
+        return true;
+    }
+    const auto end = offset + length < offset ? UINT64_MAX : offset + length;
+
+    // More ranges of other owners can overlap, check them all.
+    auto & file = file_it->second;
+    auto it = file.ranges.lower_bound(end);
+    while (it != file.ranges.begin()) {
+        --it;
+        if (it->second.end <= offset) {
+            break;
+        }
+        if (it->second.owner != owner) {
+            const auto overlap_owner = it->second.owner;
+            if (!release_if_expired(overlap_owner)) {
+                ++statistics.conflicts;
+                return false;
+            }
+            // The locks of the expired owner were released, start again.
+            return is_access_allowed(path, owner, offset, length);
+        }
+    }
+    return true;
+}
+
+
+void LockManager::rename(const std::filesystem::path & old_path, const std::filesystem::path & new_path) {
+    std::vector<std::filesystem::path> moved;
+    for (const auto & [path, file] : files) {
+        const auto [old_it, path_it] = std::mismatch(old_path.begin(), old_path.end(), path.begin(), path.end());
+        if (old_it == old_path.end()) {
+            moved.push_back(path);
+        }
+    }
+    for (const auto & path : moved) {
+        auto node = files.extract(path);
+        node.key() = path == old_path ? new_path : new_path / path.lexically_relative(old_path);
+        // The locks of a file that was replaced by the rename are stale.
+        remove(node.key());
+        files.insert(std::move(node));
+    }
+}
+
+
+void LockManager::remove(const std::filesystem::path & path) {
+    const auto file_it = files.find(path);
+    if (file_it == files.end()) {
+        return;
+    }
+    for (const auto & [offset, range] : file_it->second.ranges) {
+        const auto owner_it = owners.find(range.owner);
+        if (owner_it != owners.end() && --owner_it->second.lock_count == 0) {
+            owners.erase(owner_it);
+        }
+    }
+    // Closing the descriptor releases the host locks.
+    file_it->second.ranges.clear();
+    remove_file_if_unused(file_it);
+}
+
+
+void LockManager::touch(const Owner & owner) noexcept {
+    const auto it = owners.find(owner);
+    if (it != owners.end()) {
+        it->second.last_seen = time(NULL);
+    }
+}
+
+
+void LockManager::expire_leases() {
+    std::vector<Owner> expired;
+    for (const auto & [owner, owner_info] : owners) {
+        if (lease_time != 0 && time(NULL) - owner_info.last_seen >= lease_time) {
+            expired.push_back(owner);
+        }
+    }
+    for (const auto & owner : expired) {
+        release_if_expired(owner);
+    }
+}
+
+
+LockManager::Statistics LockManager::get_statistics() const noexcept {
+    auto ret = statistics;
+    ret.files = files.size();
+    ret.owners = owners.size();
+    ret.locks = 0;
+    for (const auto & [owner, owner_info] : owners) {
+        ret.locks += owner_info.lock_count;
+    }
+    return ret;
+}
+
+}  // namespace netmount_srv
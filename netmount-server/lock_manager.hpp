@@ -0,0 +1,138 @@
+// SPDX-License-Identifier: GPL-2.0-only
+// Copyright 2025-2026 Jaroslav Rohel, jaroslav.rohel@gmail.com
+
+// Byte-range locks requested by the clients (INT2F_LOCK_UNLOCK_FILE).
+
+#ifndef _LOCK_MANAGER_HPP_
+#define _LOCK_MANAGER_HPP_
+
+#include <time.h>
+
+#include <compare>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <map>
+
+namespace netmount_srv {
+
+// Keeps the byte-range locks of the files shared by the server.
+// DOS locks are exclusive: a lock must not overlap any other lock of the file. The locked ranges of a file
+// are therefore disjoint and are kept in a map ordered by the range start. Checking a range for conflicts
+// and adding or removing a lock takes O(log n) time, where n is the number of locks of the file.
+// The owner of a lock is the client (IP address and UDP port). Clients do not tell the server when they
+// restart, a lock of a client that has not sent any request for `lease_time` seconds is therefore released.
+// Optionally, the locks are also placed on the server files as open file description locks (Linux), so that
+// they are respected by other programs on the server (e.g. Samba).
+class LockManager {
+public:
+    struct Owner {
+        std::uint32_t ipv4_addr;
+        std::uint16_t udp_port;
+
+        auto operator<=>(const Owner &) const = default;
+    };
+
+    struct Statistics {
+        std::uint64_t lock_requests{0};
+        std::uint64_t unlock_requests{0};
+        std::uint64_t conflicts{0};      // requests rejected because of a lock of another owner
+        std::uint64_t expired_locks{0};  // locks released because the lease of the owner expired
+        std::size_t locks{0};            // current number of locks
+        std::size_t files{0};            // current number of files with locks
+        std::size_t owners{0};           // current number of clients with locks
+    };
+
+    // Opens the server file with `flags` for the host locks. Returns the descriptor, throws exception on error.
+    using OpenFileFunction = std::function<int(int flags)>;
+
+    // `lease_time` - seconds without requests after which the locks of a client are released, 0 = never
+    // `host_locks` - also lock the server files, only supported on Linux
+    LockManager(time_t lease_time, bool host_locks);
+    ~LockManager();
+
+    LockManager(const LockManager &) = delete;
+    LockManager & operator=(const LockManager &) = delete;
+
+    // Locks `length` bytes from `offset` of the file `path` for `owner`. `open_file` opens the server file
+    // when the first host lock of the file is placed.
+    // Returns false if the range overlaps an existing lock or the server file is locked by another program.
+    bool lock(
+        const std::filesystem::path & path,
+        const Owner & owner,
+        std::uint64_t offset,
+        std::uint64_t length,
+        const OpenFileFunction & open_file);
+
+    // Removes the lock of `owner`. The range must be the same as when it was locked.
+    // Returns false if there is no such lock.
+    bool unlock(const std::filesystem::path & path, const Owner & owner, std::uint64_t offset, std::uint64_t length);
+
+    // Returns true if no other owner holds a lock overlapping the range.
+    bool is_access_allowed(
+        const std::filesystem::path & path, const Owner & owner, std::uint64_t offset, std::uint64_t length);
+
+    // Returns true if any file is locked.
+    bool has_locks() const noexcept { return !files.empty(); }
+
+    // Moves the locks of the renamed file or directory `old_path` and of the files under it to `new_path`.
+    void rename(const std::filesystem::path & old_path, const std::filesystem::path & new_path);
+
+    // Releases the locks of the deleted file `path`.
+    void remove(const std::filesystem::path & path);
+
+    // Renews the lease of `owner`. Called for every request from the client.
+    void touch(const Owner & owner) noexcept;
+
+    // Releases the locks of the owners whose lease expired.
+    void expire_leases();
+
+    Statistics get_statistics() const noexcept;
+
+private:
+    struct Range {
+        std::uint64_t end;  // first byte after the range
+        Owner owner;
+    };
+
+    struct File {
+        std::map<std::uint64_t, Range> ranges;  // disjoint ranges ordered by start
+        int host_fd{-1};                        // file descriptor holding the host locks
+    };
+
+    struct OwnerInfo {
+        time_t last_seen{0};
+        std::size_t lock_count{0};
+    };
+
+    // Returns the range of `file` overlapping [offset, end), or `file.ranges.end()`.
+    static std::map<std::uint64_t, Range>::iterator find_overlap(
+        File & file, std::uint64_t offset, std::uint64_t end) noexcept;
+
+    // Returns true if the lease of `owner` expired, its locks are released then.
+    bool release_if_expired(const Owner & owner);
+
+    // Releases all locks of `owner`.
+    void release_owner(const Owner & owner);
+
+    // Opens the server file of `file` for the host locks. Returns false on failure.
+    bool open_host_file(const std::filesystem::path & path, File & file, const OpenFileFunction & open_file);
+
+    // Places or removes a lock on the server file opened by `open_host_file`. Returns false on failure.
+    bool set_host_lock(
+        const std::filesystem::path & path, File & file, bool lock, std::uint64_t offset, std::uint64_t length);
+
+    // Removes `file_it` if it has no locks.
+    void remove_file_if_unused(std::map<std::filesystem::path, File>::iterator file_it);
+
+    time_t lease_time;
+    bool host_locks;
+    std::map<std::filesystem::path, File> files;
+    std::map<Owner, OwnerInfo> owners;
+    Statistics statistics;
+};
+
+}  // namespace netmount_srv
+
+#endif
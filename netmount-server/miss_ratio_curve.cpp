@@ -0,0 +1,161 @@
+// SPDX-License-Identifier: GPL-2.0-only
+// Copyright 2025-2026 Jaroslav Rohel, jaroslav.rohel@gmail.com
+
+#include "miss_ratio_curve.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace netmount_srv {
+
+namespace {
+
+// Mixes the bits of the key (splitmix64 finalizer), keys that differ in a few bits get unrelated hashes.
+std::uint64_t mix_key(std::uint64_t key) {
+    key ^= key >> 30;
+    key *= 0xBF58476D1CE4E5B9ULL;
+    key ^= key >> 27;
+    key *= 0x94D049BB133111EBULL;
+    key ^= key >> 31;
+    return key;
+}
+
+}  // namespace
+
+
+MissRatioCurve::MissRatioCurve(std::size_t max_sampled_keys)
+    : max_sampled_keys(max_sampled_keys),
+      threshold(1U << HASH_BITS),
+      tree(max_sampled_keys * 4 + 1),
+      histogram(64 * BUCKETS_PER_OCTAVE) {}
+
+
+std::size_t MissRatioCurve::get_bucket(double distance) noexcept {
+    return static_cast<std::size_t>(std::log2(distance + 1) * BUCKETS_PER_OCTAVE);
+}
+
+
+double MissRatioCurve::get_bucket_min_distance(std::size_t bucket) noexcept {
+    return std::exp2(static_cast<double>(bucket) / BUCKETS_PER_OCTAVE) - 1;
+}
+
+
+void MissRatioCurve::tree_add(std::uint32_t time, int value) noexcept {
+    for (; time < tree.size(); time += time & -time) {
+        tree[time] += value;
+    }
+}
+
+
+std::uint32_t MissRatioCurve::tree_prefix_sum(std::uint32_t time) const noexcept {
+    std::uint32_t sum = 0;
+    for (; time > 0; time -= time & -time) {
+        sum += tree[time];
+    }
+    return sum;
+}
+
+
+void MissRatioCurve::compact_times() {
+    std::vector<SampledKey *> keys;
+    keys.reserve(sampled_keys.size());
+    for (auto & [key, sampled_key] : sampled_keys) {
+        keys.push_back(&sampled_key);
+    }
+    std::sort(keys.begin(), keys.end(), [](const auto * a, const auto * b) { return a->time < b->time; });
+
+    std::fill(tree.begin(), tree.end(), 0);
+    current_time = 0;
+    for (auto * sampled_key : keys) {
+        sampled_key->time = ++current_time;
+        tree_add(current_time, 1);
+    }
+}
+
+
+void MissRatioCurve::reduce_sampled_keys() {
+    const double old_rate = get_sampling_rate();
+    while (sampled_keys.size() > max_sampled_keys) {
+        // Remove all keys with the largest hash and lower the threshold to that hash.
+        threshold = keys_by_hash.rbegin()->first;
+        while (!keys_by_hash.empty() && keys_by_hash.rbegin()->first >= threshold) {
+            const auto key = keys_by_hash.rbegin()->second;
+            tree_add(sampled_keys[key].time, -1);
+            sampled_keys.erase(key);
+            keys_by_hash.erase(std::prev(keys_by_hash.end()));
+        }
+    }
+
+    // The accesses recorded so far were sampled at a higher rate. Rescale them so that they have the same
+    // weight as the accesses sampled at the new rate.
+    const double scale = get_sampling_rate() / old_rate;
+    for (auto & count : histogram) {
+        count *= scale;
+    }
+    sampled_accesses *= scale;
+}
+
+
+void MissRatioCurve::access(std::uint64_t key) {
+    ++access_count;
+
+    const auto hash = static_cast<std::uint32_t>(mix_key(key) >> (64 - HASH_BITS));
+    if (hash >= threshold) {
+        return;
+    }
+    sampled_accesses += 1;
+
+    if (current_time + 1 >= tree.size()) {
+        compact_times();
+    }
+    ++current_time;
+
+    const auto [it, inserted] = sampled_keys.try_emplace(key, SampledKey{hash, current_time});
+    if (inserted) {
+        keys_by_hash.emplace(hash, key);
+        tree_add(current_time, 1);
+        if (sampled_keys.size() > max_sampled_keys) {
+            reduce_sampled_keys();
+        }
+        return;
+    }
+
+    // The reuse distance is the number of distinct keys accessed since the last access to `key`.
+    auto & sampled_key = it->second;
+    const auto sampled_distance = tree_prefix_sum(current_time - 1) - tree_prefix_sum(sampled_key.time);
+    const auto bucket = get_bucket(sampled_distance / get_sampling_rate());
+    histogram[std::min(bucket, histogram.size() - 1)] += 1;
+
+    tree_add(sampled_key.time, -1);
+    tree_add(current_time, 1);
+    sampled_key.time = current_time;
+}
+
+
+double MissRatioCurve::get_sampling_rate() const noexcept {
+    return static_cast<double>(threshold) / (1U << HASH_BITS);
+}
+
+
+double MissRatioCurve::get_hit_ratio(std::size_t size) const noexcept {
+    if (sampled_accesses == 0) {
+        return 0;
+    }
+    // An access hits an LRU cache of `size` entries if its reuse distance is less than `size`.
+    double hits = 0;
+    for (std::size_t bucket = 0; bucket < histogram.size(); ++bucket) {
+        if (get_bucket_min_distance(bucket + 1) > size) {
+            // the bucket is partially below `size`, assume uniform distribution inside it
+            const double min_distance = get_bucket_min_distance(bucket);
+            if (min_distance < size) {
+                const double max_distance = get_bucket_min_distance(bucket + 1);
+                hits += histogram[bucket] * (size - min_distance) / (max_distance - min_distance);
+            }
+            break;
+        }
+        hits += histogram[bucket];
+    }
+    return std::min(hits / sampled_accesses, 1.0);
+}
+
+}  // namespace netmount_srv
@@ -0,0 +1,80 @@
+// SPDX-License-Identifier: GPL-2.0-only
+// Copyright 2025-2026 Jaroslav Rohel, jaroslav.rohel@gmail.com
+
+// Online estimation of cache miss ratio curves.
+
+#ifndef _MISS_RATIO_CURVE_HPP_
+#define _MISS_RATIO_CURVE_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <set>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace netmount_srv {
+
+// Estimates the hit ratio of an LRU cache of any size from a stream of accessed keys.
+// Uses spatial sampling (SHARDS): only keys whose hash is below a threshold are tracked, and the reuse distances
+// of the sampled keys are scaled by the sampling rate. The number of tracked keys is limited. When the limit
+// is exceeded, the threshold is lowered and the keys above it are dropped. The memory use is therefore bounded
+// and does not depend on the number of distinct keys. Small working sets are tracked exactly.
+class MissRatioCurve {
+public:
+    explicit MissRatioCurve(std::size_t max_sampled_keys = 8192);
+
+    // Records an access to `key`.
+    void access(std::uint64_t key);
+
+    // Returns the estimated hit ratio (0 - 1) of an LRU cache holding `size` entries.
+    double get_hit_ratio(std::size_t size) const noexcept;
+
+    // Returns the number of recorded accesses.
+    std::uint64_t get_access_count() const noexcept { return access_count; }
+
+    // Returns the current sampling rate (0 - 1].
+    double get_sampling_rate() const noexcept;
+
+private:
+    // Hash values are reduced to this many bits. A key is sampled if its reduced hash is below `threshold`.
+    constexpr static unsigned int HASH_BITS = 24;
+
+    // Reuse distances are counted in buckets, each power of two is split into this many buckets.
+    constexpr static unsigned int BUCKETS_PER_OCTAVE = 32;
+
+    struct SampledKey {
+        std::uint32_t hash;
+        std::uint32_t time;  // logical time of the last access
+    };
+
+    // Returns the histogram bucket for the reuse distance `distance`.
+    static std::size_t get_bucket(double distance) noexcept;
+
+    // Returns the smallest reuse distance counted in `bucket`.
+    static double get_bucket_min_distance(std::size_t bucket) noexcept;
+
+    // Fenwick tree over logical time, it counts the sampled keys whose last access was at or before a given time.
+    void tree_add(std::uint32_t time, int value) noexcept;
+    std::uint32_t tree_prefix_sum(std::uint32_t time) const noexcept;
+
+    // Renumbers the logical times of the sampled keys to 1..n when the time reaches the tree size.
+    void compact_times();
+
+    // Lowers the threshold so that at most `max_sampled_keys` keys are tracked.
+    void reduce_sampled_keys();
+
+    std::size_t max_sampled_keys;
+    std::uint32_t threshold;
+    std::uint32_t current_time{0};
+    std::uint64_t access_count{0};
+    std::unordered_map<std::uint64_t, SampledKey> sampled_keys;
+    std::set<std::pair<std::uint32_t, std::uint64_t>> keys_by_hash;  // to find the sampled keys with largest hash
+    std::vector<std::uint32_t> tree;
+    std::vector<double> histogram;  // number of sampled accesses by reuse distance bucket
+    double sampled_accesses{0};     // number of sampled accesses
+};
+
+}  // namespace netmount_srv
+
+#endif
@@ -4,8 +4,15 @@
 #include "../shared/dos.h"
 #include "../shared/drvproto.h"
 #include "fs.hpp"
+#include "content_cache.hpp"
+#include "lock_manager.hpp"
 #include "logger.hpp"
+#include "miss_ratio_curve.hpp"
+#include "packet_buffer.hpp"
+#include "perf_counters.hpp"
+#include "shared_dir_cache.hpp"
 #include "slip_udp_serial.hpp"
+#include "storage_watchdog.hpp"
 #include "udp_socket.hpp"
 #include "unicode_to_ascii.hpp"
 #include "utils.hpp"
@@ -18,11 +25,18 @@
 
 #include <algorithm>
 #include <array>
+#include <chrono>
+#include <cmath>
 #include <cstdlib>
 #include <filesystem>
+#include <future>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
 
 #define PROGRAM_VERSION "1.8.1"
 
@@ -35,6 +49,37 @@ namespace {
 
 constexpr char DEFAULT_VOLUME_LABEL[] = "NETMOUNT";
 
+// Default maximum age of a directory listing in the cache shared with other instances
+constexpr uint32_t DEFAULT_SHM_CACHE_MAX_AGE = 5;  // seconds
+
+// Limits of the timeouts recommended to clients (NETMOUNT_FEATURE_TIMEOUT_HINTS)
+// The client measures time in units of 4 timer ticks (about 220 ms) and supports timeouts up to 56 seconds.
+constexpr double MIN_TIMEOUT_HINT_MS = 220;
+constexpr double MAX_TIMEOUT_HINT_MS = 56000;
+constexpr double TIMEOUT_HINT_NETWORK_MS = 50;  // allowance for network latency and client processing
+constexpr int MIN_RETRIES_HINT = 4;             // the client default
+constexpr double LOST_REQUEST_PROBABILITY = 1e-6;  // target probability that a request fails after all retries
+
+// Default time without requests after which the locks of a client are released
+constexpr time_t DEFAULT_LOCK_LEASE_TIME = 600;  // seconds
+
+// How often the leases of the locks are checked
+constexpr time_t LOCK_LEASE_CHECK_INTERVAL = 10;  // seconds
+
+// How often the directory listing caches are resized according to the estimated miss ratio curves
+constexpr time_t CACHE_RESIZE_INTERVAL = 60;  // seconds
+
+// How long a request for a drive waits for the initialization of the drive before the client gets
+// the retryable "drive not ready" error
+constexpr auto DRIVE_INIT_WAIT_TIME = std::chrono::milliseconds(500);
+
+// Default time after which an unfinished initialization of a drive is reported, requests for the drive
+// no longer wait for it
+constexpr time_t DEFAULT_DRIVE_INIT_TIMEOUT = 30;  // seconds
+
+// How long a drive whose initialization failed is reported as not ready before the initialization is retried
+constexpr time_t DRIVE_INIT_RETRY_INTERVAL = 10;  // seconds
+
 const std::filesystem::path TRANSLITERATION_MAP_FILE = "netmount-u2a.map";
 
 // Reply cache - contains the last replies sent to clients
@@ -44,19 +89,34 @@ constexpr int REPLY_CACHE_SIZE = 16;
 class ReplyCache {
 public:
     struct ReplyInfo {
-        std::array<uint8_t, 1500> recv_packet;  // entire packet that was received
-        std::array<uint8_t, 1500> send_packet;  // entire packet that was sent
+        PacketBuffer recv_packet;               // entire packet that was received
+        PacketBuffer send_packet;               // entire packet that was sent, may be shared with ResponseMemo
         uint16_t recv_len{0};                   // packet length
         uint16_t send_len{0};                   // packet length
         uint32_t ipv4_addr;                     // remote IP address
         uint16_t udp_port;                      // remote UDP port
         time_t timestamp;                       // time of answer (so if cache full I can drop oldest)
 
+        // Statistics of the client used to compute the recommended timeouts (NETMOUNT_FEATURE_TIMEOUT_HINTS)
+        uint32_t request_count{0};        // number of requests received from the client
+        uint32_t retransmit_count{0};     // number of requests received again (same sequence and content)
+        double service_time_ms{0};        // smoothed time needed to process a request
+        double service_time_dev_ms{0};    // smoothed mean deviation of the service time
+        double max_service_time_ms{0};    // slowly decaying maximum of the service time
+        double transferred_bytes{0};      // smoothed size of request and reply
+
         ReplyInfo() = default;
 
+        // Records a processed request that was not a retransmission.
+        void record_service_time(double time_ms, unsigned int bytes) noexcept;
+
         // ReplyInfo is accessed by reference. Make sure no one copies the ReplyInfo by mistake.
         ReplyInfo(const ReplyInfo &) = delete;
         ReplyInfo & operator=(const ReplyInfo &) = delete;
+
+        // A request processed by a storage worker takes the ReplyInfo for the time of the processing.
+        ReplyInfo(ReplyInfo &&) = default;
+        ReplyInfo & operator=(ReplyInfo &&) = default;
     };
 
     // Finds the cache entry related to given client, or the oldest one for reuse
@@ -83,20 +143,236 @@ ReplyCache::ReplyInfo & ReplyCache::get_reply_info(uint32_t ipv4_addr, uint16_t
     // matching item not found, reuse oldest item
     oldest_item->recv_len = 0;  // invalidate old content by setting length to 0
     oldest_item->send_len = 0;  // invalidate old content by setting length to 0
+    oldest_item->recv_packet.reset();
+    oldest_item->send_packet.reset();
     oldest_item->ipv4_addr = ipv4_addr;
     oldest_item->udp_port = udp_port;
+    oldest_item->request_count = 0;
+    oldest_item->retransmit_count = 0;
+    oldest_item->service_time_ms = 0;
+    oldest_item->service_time_dev_ms = 0;
+    oldest_item->max_service_time_ms = 0;
+    oldest_item->transferred_bytes = 0;
     return *oldest_item;
 }
 
 
+void ReplyCache::ReplyInfo::record_service_time(double time_ms, unsigned int bytes) noexcept {
+    // Smoothing as used for the TCP retransmission timer (RFC 6298)
+    if (request_count == retransmit_count) {
+        service_time_ms = time_ms;
+        service_time_dev_ms = time_ms / 2;
+        transferred_bytes = bytes;
+    } else {
+        service_time_dev_ms = 0.75 * service_time_dev_ms + 0.25 * std::abs(service_time_ms - time_ms);
+        service_time_ms = 0.875 * service_time_ms + 0.125 * time_ms;
+        transferred_bytes = 0.875 * transferred_bytes + 0.125 * bytes;
+    }
+    max_service_time_ms = std::max(time_ms, max_service_time_ms * (63.0 / 64));
+    ++request_count;
+}
+
+
+// Response memo - contains replies to side-effect-free requests (FIND_FIRST, GET_ATTRS, read-only OPEN_FILE)
+// It is shared by all clients. Stations often send byte-identical requests (e.g. during boot). Such a request
+// is answered by a copy of the memoized reply without touching the filesystem.
+// An entry is valid while the generations of the related items (directory, file) are unchanged. Changes made
+// by other programs on the server are not seen by generations, the entry lifetime is therefore limited.
+constexpr int RESPONSE_MEMO_SIZE = 64;
+constexpr time_t RESPONSE_MEMO_TTL = 2;  // seconds
+class ResponseMemo {
+public:
+    // Items on which the reply depends. The reply is valid while their generations are unchanged.
+    struct Validator {
+        uint16_t handle;
+        uint32_t generation;
+    };
+
+    struct Entry {
+        unsigned int drive;
+        uint8_t function;
+        uint32_t request_hash;
+        PacketBuffer request;  // request packet, shared with ReplyCache
+        uint16_t request_data_len;
+        PacketBuffer reply;  // reply packet, shared with ReplyCache
+        uint16_t reply_data_len;
+        uint16_t ax;
+
+        const uint8_t * get_request_data() const noexcept { return request.data() + sizeof(drive_proto_hdr); }
+        const uint8_t * get_reply_data() const noexcept { return reply.data() + sizeof(drive_proto_hdr); }
+        std::array<Validator, 2> validators;
+        uint8_t validators_count{0};
+        time_t timestamp{0};
+    };
+
+    // Returns the valid entry for the request or nullptr. Invalid entries are dropped.
+    // `drive` is the number of the drive `drive_obj`.
+    const Entry * find(
+        unsigned int drive,
+        const Drive & drive_obj,
+        uint8_t function,
+        const uint8_t * request_data,
+        uint16_t request_data_len);
+
+    // Stores the reply. The oldest entry is replaced if the memo is full.
+    // The entry keeps references to the request and reply packets, the packets are not copied.
+    void store(
+        unsigned int drive,
+        uint8_t function,
+        const PacketBuffer & request,
+        uint16_t request_data_len,
+        const PacketBuffer & reply,
+        uint16_t reply_data_len,
+        uint16_t ax,
+        const Validator * validators,
+        uint8_t validators_count);
+
+    uint64_t get_hits() const noexcept { return hits; }
+    uint64_t get_misses() const noexcept { return misses; }
+
+private:
+    static uint32_t hash(const uint8_t * data, uint16_t len) noexcept;
+
+    std::array<Entry, RESPONSE_MEMO_SIZE> entries;
+    uint64_t hits{0};
+    uint64_t misses{0};
+};
+
+
+// FNV-1a hash
+uint32_t ResponseMemo::hash(const uint8_t * data, uint16_t len) noexcept {
+    uint32_t ret = 2166136261U;
+    for (uint16_t i = 0; i < len; ++i) {
+        ret ^= data[i];
+        ret *= 16777619U;
+    }
+    return ret;
+}
+
+
+const ResponseMemo::Entry * ResponseMemo::find(
+    unsigned int drive,
+    const Drive & drive_obj,
+    uint8_t function,
+    const uint8_t * request_data,
+    uint16_t request_data_len) {
+    const auto request_hash = hash(request_data, request_data_len);
+    const auto now = time(NULL);
+    for (auto & entry : entries) {
+        if (entry.timestamp == 0 || entry.request_hash != request_hash || entry.drive != drive ||
+            entry.function != function || entry.request_data_len != request_data_len ||
+            memcmp(entry.get_request_data(), request_data, request_data_len) != 0) {
+            continue;
+        }
+        bool valid = now - entry.timestamp < RESPONSE_MEMO_TTL;
+        for (uint8_t i = 0; valid && i < entry.validators_count; ++i) {
+            const auto & validator = entry.validators[i];
+            valid = drive_obj.get_generation(validator.handle) == validator.generation;
+        }
+        if (!valid) {
+            entry.timestamp = 0;  // invalidate
+            entry.request.reset();
+            entry.reply.reset();
+            break;
+        }
+        ++hits;
+        return &entry;
+    }
+    ++misses;
+    return nullptr;
+}
+
+
+void ResponseMemo::store(
+    unsigned int drive,
+    uint8_t function,
+    const PacketBuffer & request,
+    uint16_t request_data_len,
+    const PacketBuffer & reply,
+    uint16_t reply_data_len,
+    uint16_t ax,
+    const Validator * validators,
+    uint8_t validators_count) {
+    auto * oldest_entry = &entries[0];
+    for (auto & entry : entries) {
+        if (entry.timestamp < oldest_entry->timestamp) {
+            oldest_entry = &entry;
+        }
+    }
+
+    auto & entry = *oldest_entry;
+    entry.drive = drive;
+    entry.function = function;
+    entry.request = request;
+    entry.request_data_len = request_data_len;
+    entry.request_hash = hash(entry.get_request_data(), request_data_len);
+    entry.reply = reply;
+    entry.reply_data_len = reply_data_len;
+    entry.ax = ax;
+    entry.validators_count = std::min<uint8_t>(validators_count, entry.validators.size());
+    std::copy(validators, validators + entry.validators_count, entry.validators.begin());
+    entry.timestamp = time(NULL);
+}
+
+
+// Packet buffers are held by the reply cache (request and reply per client), the response memo (request and
+// reply per entry), and the request being received.
+constexpr std::size_t PACKET_BUFFER_POOL_SIZE = (REPLY_CACHE_SIZE + RESPONSE_MEMO_SIZE) * 2 + 1;
+
 // Define global data
+PacketBufferPool packet_buffer_pool(PACKET_BUFFER_POOL_SIZE);  // must outlive the users of its buffers
 ReplyCache answer_cache;
+ResponseMemo response_memo;
 
 constexpr size_t MAX_DRIVES_COUNT = 'Z' - 'A' + 1;
 std::array<Drive, MAX_DRIVES_COUNT> drives;
 
+// State of the initialization of a shared drive. A drive is initialized in a background thread on the first
+// request for it: the root is resolved and opened, the attribute storage method is checked or detected,
+// the transliteration map and the pinned files are loaded. A slow or hung root delays only its own drive.
+// The state is accessed by the main thread only, the Drive is handed over by the `done` future.
+struct DriveInit {
+    enum class State { UNUSED, DEFINED, INITIALIZING, READY, FAILED };
+
+    State state{State::UNUSED};
+    std::string root_path;   // root path as defined on the command line
+    std::future<void> done;  // becomes ready when the initialization thread ends
+    time_t start_time{0};    // when the last initialization was started
+    time_t failed_time{0};   // when the last initialization failed
+    bool timeout_reported{false};
+};
+std::array<DriveInit, MAX_DRIVES_COUNT> drive_inits;
+
+std::filesystem::path transliteration_map_path = TRANSLITERATION_MAP_FILE;
+std::once_flag transliteration_map_loaded;
+
+time_t drive_init_timeout{DEFAULT_DRIVE_INIT_TIMEOUT};
+
+// Guards the state shared by the requests (reply cache, response memo, locks, packet buffers). The main thread
+// holds it, except while it waits for a packet or for a storage worker. The code of a request processed by
+// a storage worker locks it before touching the shared state.
+std::mutex server_state_mutex;
+
+// Watchdogs of the drives with the `watchdog` option, their workers run the storage operations of the drives
+std::array<std::unique_ptr<StorageWatchdog>, MAX_DRIVES_COUNT> storage_watchdogs;
+
+
+// Returns a lock of the server state for the code of a request. Only a storage worker needs to lock it,
+// the main thread already holds it.
+std::unique_lock<std::mutex> lock_server_state() {
+    if (StorageWatchdog::is_worker_thread()) {
+        return std::unique_lock<std::mutex>(server_state_mutex);
+    }
+    return {};
+}
+
 UdpSocket * udp_socket_ptr{nullptr};
 
+std::unique_ptr<LockManager> lock_manager;
+
+// Time to transfer one byte over the link to clients, 0 if negligible (Ethernet)
+double link_ms_per_byte{0};
+
 // the flag is set when netmount-server is expected to terminate
 sig_atomic_t volatile exit_flag = 0;
 
@@ -211,27 +487,309 @@ uint16_t log_exception_get_dos_err_code(
 }
 
 
+// Returns true if the reply to the request can be stored in the response memo.
+bool is_memoizable_request(int function, const uint8_t * request_data, uint16_t request_data_len) {
+    switch (function) {
+        case INT2F_FIND_FIRST:
+        case INT2F_GET_ATTRS:
+            return true;
+        case INT2F_OPEN_FILE: {
+            if (request_data_len <= sizeof(drive_proto_open_create)) {
+                return false;
+            }
+            // Only read-only opens, other open modes are checked against the attributes of the file.
+            auto * const request = reinterpret_cast<const drive_proto_open_create *>(request_data);
+            return (from_little16(request->attrs) & 0x03) == OPEN_MODE_RDONLY;
+        }
+        default:
+            return false;
+    }
+}
+
+
+// Adds a validator for the item `server_path` to the `validators`.
+void add_memo_validator(
+    Drive & drive,
+    const std::filesystem::path & server_path,
+    std::array<ResponseMemo::Validator, 2> & validators,
+    uint8_t & validators_count) {
+    if (validators_count >= validators.size()) {
+        return;
+    }
+    const auto handle = drive.get_handle(server_path);
+    if (handle == 0xFFFFU) {
+        return;
+    }
+    validators[validators_count++] = {handle, drive.get_generation(handle)};
+}
+
+
+// Computes the timeouts recommended to the client from its statistics.
+// The minimum timeout covers the smoothed service time plus four mean deviations (as the TCP retransmission
+// timer), the transfer time over the link, and the network allowance. The maximum timeout covers the slowest
+// recently seen request. The number of retries grows with the observed retransmission rate so that
+// a request fails after all retries with probability below LOST_REQUEST_PROBABILITY.
+void fill_timeout_hints(const ReplyCache::ReplyInfo & reply_info, drive_proto_timeout_hints_reply & reply) {
+    const double link_ms = reply_info.transferred_bytes * link_ms_per_byte;
+    const double min_timeout = std::clamp(
+        reply_info.service_time_ms + 4 * reply_info.service_time_dev_ms + link_ms + TIMEOUT_HINT_NETWORK_MS,
+        MIN_TIMEOUT_HINT_MS,
+        MAX_TIMEOUT_HINT_MS);
+    const double max_timeout = std::clamp(
+        std::max(4 * min_timeout, 2 * (reply_info.max_service_time_ms + link_ms + TIMEOUT_HINT_NETWORK_MS)),
+        min_timeout,
+        MAX_TIMEOUT_HINT_MS);
+
+    int retries = MIN_RETRIES_HINT;
+    double retransmit_rate = 0;
+    if (reply_info.request_count > 0) {
+        retransmit_rate = static_cast<double>(reply_info.retransmit_count) / reply_info.request_count;
+        if (retransmit_rate >= 1) {
+            retries = 254;
+        } else if (retransmit_rate > 0) {
+            const auto attempts = std::ceil(std::log(LOST_REQUEST_PROBABILITY) / std::log(retransmit_rate));
+            retries = std::clamp(static_cast<int>(attempts) - 1, MIN_RETRIES_HINT, 254);
+        }
+    }
+
+    reply.min_rcv_tmo_ms = to_little16(static_cast<uint16_t>(min_timeout));
+    reply.max_rcv_tmo_ms = to_little16(static_cast<uint16_t>(max_timeout));
+    reply.max_retries = retries;
+    reply.reserved = 0;
+    reply.service_time_ms = to_little16(static_cast<uint16_t>(std::min(reply_info.service_time_ms, 65535.0)));
+    reply.retransmit_permille = to_little16(static_cast<uint16_t>(retransmit_rate * 1000));
+}
+
+
+// Returns a name of the attribute storage method `mode`.
+const char * attrs_mode_name(AttrsMode mode) noexcept {
+    switch (mode) {
+        case AttrsMode::AUTO:
+            return "auto";
+        case AttrsMode::IN_EXTENDED:
+            return "extended";
+        case AttrsMode::NATIVE:
+            return "native";
+        default:
+            return "ignore";
+    }
+}
+
+
+// Initializes the drive `drive_num` with the root `root_path`. Runs in the initialization thread of the drive.
+// Throws exception on error, the drive stays unused.
+void initialize_drive(unsigned int drive_num, const std::string & root_path, const std::filesystem::path & map_path) {
+    auto & drive = drives[drive_num];
+
+    const auto rpath = std::filesystem::canonical(root_path);
+    if (!std::filesystem::is_directory(rpath)) {
+        throw std::runtime_error(std::format("Path \"{}\" is not a directory", root_path));
+    }
+
+    switch (drive.get_attrs_mode()) {
+        case AttrsMode::AUTO:
+#if DOS_ATTRS_NATIVE == 1
+            if (is_dos_attrs_native_supported(rpath)) {
+                drive.set_attrs_mode(AttrsMode::NATIVE);
+                break;
+            }
+#endif
+#if DOS_ATTRS_IN_EXTENDED == 1
+            if (is_dos_attrs_in_extended_supported(rpath)) {
+                drive.set_attrs_mode(AttrsMode::IN_EXTENDED);
+                break;
+            }
+#endif
+            drive.set_attrs_mode(AttrsMode::IGNORE);
+            break;
+#if DOS_ATTRS_NATIVE == 1
+        case AttrsMode::NATIVE:
+            if (!is_dos_attrs_native_supported(rpath)) {
+                throw std::runtime_error(std::format(
+                    "Native storage of DOS attributes was requested, but \"{}\" does not support it", rpath.string()));
+            }
+            break;
+#endif
+#if DOS_ATTRS_IN_EXTENDED == 1
+        case AttrsMode::IN_EXTENDED:
+            if (!is_dos_attrs_in_extended_supported(rpath)) {
+                throw std::runtime_error(std::format(
+                    "Storing DOS attributes in extended attributes was requested, but \"{}\" does not support it",
+                    rpath.string()));
+            }
+            break;
+#endif
+        default:
+            break;
+    }
+
+    if (drive.get_file_name_conversion() != Drive::FileNameConversion::OFF && !map_path.empty()) {
+        try {
+            std::call_once(transliteration_map_loaded, [&map_path]() { load_transliteration_map(map_path); });
+        } catch (const std::exception & ex) {
+            throw std::runtime_error(std::format(
+                "Filename conversion is enabled, but the transliteration map failed to load: {}", ex.what()));
+        }
+    }
+
+    drive.set_root(rpath);
+    drive.load_pinned_files();
+}
+
+
+// Starts the initialization of the drive `drive_num` in a background thread.
+void start_drive_initialization(unsigned int drive_num) {
+    auto & init = drive_inits[drive_num];
+    log(LogLevel::NOTICE,
+        "{}: Initializing drive {:c} path \"{}\"\n",
+        __func__,
+        static_cast<char>('A' + drive_num),
+        init.root_path);
+    std::promise<void> promise;
+    init.done = promise.get_future();
+    init.start_time = time(NULL);
+    init.timeout_reported = false;
+    try {
+        const TerminationSignalsBlocker signals_blocker;
+        std::thread(
+            [drive_num, root_path = init.root_path, map_path = transliteration_map_path, promise = std::move(promise)](
+            ) mutable {
+                try {
+                    initialize_drive(drive_num, root_path, map_path);
+                    promise.set_value();
+                } catch (...) {
+                    promise.set_exception(std::current_exception());
+                }
+            })
+            .detach();
+        init.state = DriveInit::State::INITIALIZING;
+    } catch (const std::system_error & ex) {
+        log(LogLevel::ERROR, "{}: Failed to start the initialization thread: {}\n", __func__, ex.what());
+        init.state = DriveInit::State::FAILED;
+        init.failed_time = time(NULL);
+    }
+}
+
+
+// Returns true if the drive `drive_num` is initialized and serves requests, its storage responds.
+bool is_drive_ready(std::size_t drive_num) {
+    const auto & watchdog = storage_watchdogs[drive_num];
+    return drive_inits[drive_num].state == DriveInit::State::READY && !(watchdog && watchdog->is_degraded());
+}
+
+
+// Makes the defined drive `drive_num` ready for a request. Starts its initialization on the first request,
+// or on a request after DRIVE_INIT_RETRY_INTERVAL when the previous initialization failed, and waits up to
+// DRIVE_INIT_WAIT_TIME for it. Returns false if the drive is not ready.
+bool prepare_drive(unsigned int drive_num) {
+    auto & init = drive_inits[drive_num];
+    const auto drive_char = static_cast<char>('A' + drive_num);
+    switch (init.state) {
+        case DriveInit::State::UNUSED:
+            return false;
+        case DriveInit::State::READY:
+            return true;
+        case DriveInit::State::FAILED:
+            if (time(NULL) - init.failed_time < DRIVE_INIT_RETRY_INTERVAL) {
+                return false;
+            }
+            start_drive_initialization(drive_num);
+            break;
+        case DriveInit::State::DEFINED:
+            start_drive_initialization(drive_num);
+            break;
+        case DriveInit::State::INITIALIZING:
+            break;
+    }
+    if (init.state != DriveInit::State::INITIALIZING) {
+        return false;
+    }
+
+    // An initialization running longer than the timeout is probably blocked by a hung root,
+    // requests no longer wait for it.
+    const bool timed_out = time(NULL) - init.start_time >= drive_init_timeout;
+    if (init.done.wait_for(timed_out ? std::chrono::milliseconds(0) : DRIVE_INIT_WAIT_TIME) !=
+        std::future_status::ready) {
+        if (time(NULL) - init.start_time >= drive_init_timeout && !init.timeout_reported) {
+            log(LogLevel::ERROR,
+                "{}: Initialization of drive {:c} path \"{}\" has not finished in {} seconds\n",
+                __func__,
+                drive_char,
+                init.root_path,
+                drive_init_timeout);
+            init.timeout_reported = true;
+        }
+        return false;
+    }
+
+    try {
+        init.done.get();
+    } catch (const std::exception & ex) {
+        log(LogLevel::CRITICAL,
+            "{}: Initialization of drive {:c} path \"{}\" failed: {}\n",
+            __func__,
+            drive_char,
+            init.root_path,
+            ex.what());
+        init.state = DriveInit::State::FAILED;
+        init.failed_time = time(NULL);
+        return false;
+    }
+    const auto & drive = drives[drive_num];
+    log(LogLevel::NOTICE,
+        "{}: Drive {:c} ready in {} seconds, attrs mode {}, path \"{}\"\n",
+        __func__,
+        drive_char,
+        time(NULL) - init.start_time,
+        attrs_mode_name(drive.get_attrs_mode()),
+        drive.get_root().string());
+    init.state = DriveInit::State::READY;
+    return true;
+}
+
+
+// Refreshes the cached space information of the drives. Called between requests.
+void refresh_drives_space_info(std::unique_lock<std::mutex> & state_lock) {
+    for (std::size_t i = 0; i < drives.size(); ++i) {
+        auto & drive = drives[i];
+        if (!is_drive_ready(i)) {
+            continue;
+        }
+        try {
+            if (auto * const watchdog = storage_watchdogs[i].get()) {
+                watchdog->run([&drive]() { drive.refresh_space_info(); }, state_lock);
+            } else {
+                drive.refresh_space_info();
+            }
+        } catch (const std::runtime_error & ex) {
+            log(LogLevel::WARNING, "{}: Drive {:c}: {}\n", __func__, static_cast<char>('A' + i), ex.what());
+        }
+    }
+}
+
+
 // Processes client requests and prepares responses.
-int process_request(ReplyCache::ReplyInfo & reply_info, const uint8_t * request_packet, int request_packet_len) {
+int process_request(ReplyCache::ReplyInfo & reply_info, const PacketBuffer & request_packet, int request_packet_len) {
 
     // must contain at least the header
     if (request_packet_len < static_cast<int>(sizeof(struct drive_proto_hdr))) {
         return -1;
     }
 
-    auto * const request_header = reinterpret_cast<struct drive_proto_hdr const *>(request_packet);
+    auto * const request_header = reinterpret_cast<struct drive_proto_hdr const *>(request_packet.data());
     auto * const cache_recv_header = reinterpret_cast<struct drive_proto_hdr const *>(reply_info.recv_packet.data());
-    auto * const reply_header = reinterpret_cast<struct drive_proto_hdr *>(reply_info.send_packet.data());
 
     // If the ReplyCache contains the same request (including the same sequence number), send back the response from the ReplyCache.
     if (reply_info.recv_len > 0 && cache_recv_header->sequence == request_header->sequence &&
         reply_info.recv_len == request_packet_len &&
-        memcmp(reply_info.recv_packet.data(), request_packet, request_packet_len) == 0) {
+        memcmp(reply_info.recv_packet.data(), request_packet.data(), request_packet_len) == 0) {
+        ++reply_info.request_count;
+        ++reply_info.retransmit_count;
         if (reply_info.send_len > 0) {
             log(LogLevel::NOTICE,
                 "{}: Using a packet from the reply cache (seq {:d})\n",
                 __func__,
-                reply_header->sequence);
+                request_header->sequence);
             return reply_info.send_len;
         } else {
             log(LogLevel::NOTICE,
@@ -250,6 +808,14 @@ int process_request(ReplyCache::ReplyInfo & reply_info, const uint8_t * request_
     // the CLOSE_FILE reply will clear this flag. In all other responses, the flag remains set.
     bool extended_features_flag_in_reply = true;
 
+    // The previous reply may still be referenced by the response memo, the new one goes to another buffer.
+    {
+        const auto state_lock = lock_server_state();
+        if (!reply_info.send_packet || reply_info.send_packet.is_shared()) {
+            reply_info.send_packet = packet_buffer_pool.acquire();
+        }
+    }
+    auto * const reply_header = reinterpret_cast<struct drive_proto_hdr *>(reply_info.send_packet.data());
     *reply_header = *request_header;
 
     auto const * const request_data = reinterpret_cast<const uint8_t *>(request_header + 1);
@@ -267,7 +833,7 @@ int process_request(ReplyCache::ReplyInfo & reply_info, const uint8_t * request_
 
     // Do I share this drive?
     auto & drive = drives[reqdrv];
-    if (!drive.is_shared()) {
+    if (drive_inits[reqdrv].state == DriveInit::State::UNUSED) {
         log(LogLevel::WARNING,
             "{}: Requested drive is not shared: {:c}: (number {:d})\n",
             __func__,
@@ -276,6 +842,32 @@ int process_request(ReplyCache::ReplyInfo & reply_info, const uint8_t * request_
         return -1;
     }
 
+    // Side-effect-free requests may be answered by a copy of the reply from the response memo.
+    const bool memoizable = is_memoizable_request(function, request_data, request_data_len);
+    if (memoizable) {
+        // Changes of pinned files must be reflected in the generations before the memo is used.
+        drive.process_pinned_files_events();
+        const auto state_lock = lock_server_state();
+        if (const auto * entry = response_memo.find(reqdrv, drive, function, request_data, request_data_len)) {
+            for (uint8_t i = 0; i < entry->validators_count; ++i) {
+                // keeps the related handles from being reused
+                drive.get_handle_path(entry->validators[i].handle);
+            }
+            memcpy(reply_data, entry->get_reply_data(), entry->reply_data_len);
+            reply_header->length_flags = DRIVE_PROTO_FLAG_EXTENDED_FEATURES;
+            reply_header->ax = to_little16(entry->ax);
+            log(LogLevel::DEBUG,
+                "{}: Using a reply from the response memo (function 0x{:02X}, hits {}, misses {})\n",
+                __func__,
+                function,
+                response_memo.get_hits(),
+                response_memo.get_misses());
+            return entry->reply_data_len + sizeof(struct drive_proto_hdr);
+        }
+    }
+    std::array<ResponseMemo::Validator, 2> memo_validators;
+    uint8_t memo_validators_count = 0;
+
     // assume success
     uint16_t return_code = DOS_EXTERR_NO_ERROR;
 
@@ -320,7 +912,7 @@ int process_request(ReplyCache::ReplyInfo & reply_info, const uint8_t * request_
             const auto relative_path = create_relative_path(request_data, request_data_len);
 
             log(LogLevel::DEBUG, "CHANGE_DIR \"{:c}:\\{}\"\n", reqdrv + 'A', relative_path.string());
-            // Try to chdir to this dir
+            // Check that the directory exists
             try {
                 drive.change_dir(relative_path);
             } catch (const std::runtime_error & ex) {
@@ -370,6 +962,25 @@ int process_request(ReplyCache::ReplyInfo & reply_info, const uint8_t * request_
             const uint16_t len = from_little16(request->length);
             log(LogLevel::DEBUG, "READ_FILE handle {}, {} bytes, offset {}\n", handle, len, offset);
             try {
+                const LockManager::Owner owner{reply_info.ipv4_addr, reply_info.udp_port};
+                bool access_allowed = true;
+                {
+                    const auto state_lock = lock_server_state();
+                    if (lock_manager->has_locks()) {
+                        access_allowed =
+                            lock_manager->is_access_allowed(drive.get_handle_path(handle), owner, offset, len);
+                    }
+                }
+                if (!access_allowed) {
+                    log(LogLevel::INFO,
+                        "{}: Drive {:c}: READ_FILE handle {} offset {}: range locked by another client\n",
+                        __func__,
+                        reqdrv + 'A',
+                        handle,
+                        offset);
+                    return_code = DOS_EXTERR_LOCK_VIOLATION;
+                    break;
+                }
                 reply_packet_len = drive.read_file(reply_data, handle, offset, len);
             } catch (const std::runtime_error & ex) {
                 return_code = log_exception_get_dos_err_code("READ_FILE", reqdrv, handle, DOS_EXTERR_ACCESS_DENIED, ex);
@@ -390,6 +1001,28 @@ int process_request(ReplyCache::ReplyInfo & reply_info, const uint8_t * request_
                 request_data_len - sizeof(drive_proto_writef),
                 offset);
             try {
+                const LockManager::Owner owner{reply_info.ipv4_addr, reply_info.udp_port};
+                // A write of 0 bytes truncates the file at `offset`, no range beyond it may be locked.
+                const uint64_t data_len = request_data_len - sizeof(drive_proto_writef);
+                const uint64_t checked_len = data_len != 0 ? data_len : UINT64_MAX - offset;
+                bool access_allowed = true;
+                {
+                    const auto state_lock = lock_server_state();
+                    if (lock_manager->has_locks()) {
+                        access_allowed =
+                            lock_manager->is_access_allowed(drive.get_handle_path(handle), owner, offset, checked_len);
+                    }
+                }
+                if (!access_allowed) {
+                    log(LogLevel::INFO,
+                        "{}: Drive {:c}: WRITE_FILE handle {} offset {}: range locked by another client\n",
+                        __func__,
+                        reqdrv + 'A',
+                        handle,
+                        offset);
+                    return_code = DOS_EXTERR_LOCK_VIOLATION;
+                    break;
+                }
                 const auto write_len = drive.write_file(
                     request_data + sizeof(drive_proto_writef),
                     handle,
@@ -405,38 +1038,64 @@ int process_request(ReplyCache::ReplyInfo & reply_info, const uint8_t * request_
 
         } break;
 
-        case INT2F_LOCK_UNLOCK_FILE: {
+        case INT2F_LOCK_UNLOCK_FILE:
+        case INT2F_UNLOCK_FILE: {
             if (request_data_len < sizeof(drive_proto_lockf)) {
                 return -1;
             }
-            // Only checking the existence of the handle
-            // TODO: Try to lock file?
             auto * const request = reinterpret_cast<const drive_proto_lockf *>(request_data);
+            const uint16_t params_count = from_little16(request->params_count);
             const uint16_t handle = from_little16(request->start_cluster);
-            log(LogLevel::DEBUG, "LOCK_UNLOCK_FILE handle {}\n", handle);
-            try {
-                drive.get_handle_path(handle);
-            } catch (const std::runtime_error & ex) {
-                // TODO: Send error to client?
-                return_code =
-                    log_exception_get_dos_err_code("LOCK_UNLOCK_FILE", reqdrv, handle, DOS_EXTERR_NO_ERROR, ex);
-            }
-        } break;
-
-        case INT2F_UNLOCK_FILE: {
-            if (request_data_len < sizeof(drive_proto_lockf)) {
+            if (request_data_len != sizeof(drive_proto_lockf) + params_count * sizeof(drive_proto_lockf_param)) {
                 return -1;
             }
-            // Only checking the existence of the handle
-            // TODO: Implement unlock after lock.
-            auto * const request = reinterpret_cast<const drive_proto_lockf *>(request_data);
-            const uint16_t handle = from_little16(request->start_cluster);
-            log(LogLevel::DEBUG, "UNLOCK_FILE handle {}\n", handle);
+            auto * const params = reinterpret_cast<const drive_proto_lockf_param *>(request + 1);
+            const bool lock = function == INT2F_LOCK_UNLOCK_FILE;
+            const char * const func_name = lock ? "LOCK_UNLOCK_FILE" : "UNLOCK_FILE";
+            log(LogLevel::DEBUG, "{} handle {}, {} ranges\n", func_name, handle, params_count);
             try {
-                drive.get_handle_path(handle);
+                const auto state_lock = lock_server_state();
+                const auto & path = drive.get_handle_path(handle);
+                const LockManager::Owner owner{reply_info.ipv4_addr, reply_info.udp_port};
+#ifdef _WIN32
+                const LockManager::OpenFileFunction open_file;  // host locks are not supported
+#else
+                // Opened through the drive, the server file must not resolve outside the shared directory.
+                const LockManager::OpenFileFunction open_file = [&drive, &path](int flags) {
+                    return drive.open_item(path, flags).release();
+                };
+#endif
+                for (uint16_t i = 0; i < params_count; ++i) {
+                    const uint32_t offset = from_little32(params[i].offset);
+                    const uint32_t length = from_little32(params[i].length);
+                    const bool success =
+                        lock ? lock_manager->lock(path, owner, offset, length, open_file)
+                             : lock_manager->unlock(path, owner, offset, length);
+                    if (!success) {
+                        log(LogLevel::INFO,
+                            "{}: Drive {:c}: {} handle {} offset {} length {} failed\n",
+                            __func__,
+                            reqdrv + 'A',
+                            func_name,
+                            handle,
+                            offset,
+                            length);
+                        // Roll back the ranges processed so far, the request succeeds or fails as a whole.
+                        for (uint16_t j = 0; j < i; ++j) {
+                            const uint32_t done_offset = from_little32(params[j].offset);
+                            const uint32_t done_length = from_little32(params[j].length);
+                            if (lock) {
+                                lock_manager->unlock(path, owner, done_offset, done_length);
+                            } else {
+                                lock_manager->lock(path, owner, done_offset, done_length, open_file);
+                            }
+                        }
+                        return_code = DOS_EXTERR_LOCK_VIOLATION;
+                        break;
+                    }
+                }
             } catch (const std::runtime_error & ex) {
-                // TODO: Send error to client?
-                return_code = log_exception_get_dos_err_code("UNLOCK_FILE", reqdrv, handle, DOS_EXTERR_NO_ERROR, ex);
+                return_code = log_exception_get_dos_err_code(func_name, reqdrv, handle, DOS_EXTERR_INVALID_HANDLE, ex);
             }
         } break;
 
@@ -549,8 +1208,9 @@ int process_request(ReplyCache::ReplyInfo & reply_info, const uint8_t * request_
 
             log(LogLevel::DEBUG, "GET_ATTRS file \"{:c}:\\{}\"\n", reqdrv + 'A', relative_path.string());
             DosFileProperties properties;
+            std::filesystem::path server_path;
             try {
-                drive.get_dos_properties(relative_path, &properties);
+                drive.get_dos_properties(relative_path, &properties, &server_path);
                 log(LogLevel::DEBUG,
                     "GET_ATTRS \"{:c}:\\{}\" size {} bytes, attr 0x{:02X}\n",
                     reqdrv + 'A',
@@ -564,9 +1224,14 @@ int process_request(ReplyCache::ReplyInfo & reply_info, const uint8_t * request_
                 reply->size_hi = to_little16(properties.size >> 16);
                 reply->attrs = properties.attrs;
                 reply_packet_len = sizeof(drive_proto_get_attrs_reply);
+                add_memo_validator(drive, server_path.parent_path(), memo_validators, memo_validators_count);
             } catch (const std::runtime_error & ex) {
                 return_code =
                     log_exception_get_dos_err_code("GET_ATTRS", reqdrv, relative_path, DOS_EXTERR_FILE_NOT_FOUND, ex);
+                if (return_code == DOS_EXTERR_FILE_NOT_FOUND && !server_path.empty()) {
+                    // the parent directory exists, but the file does not
+                    add_memo_validator(drive, server_path.parent_path(), memo_validators, memo_validators_count);
+                }
             }
         } break;
 
@@ -592,7 +1257,10 @@ int process_request(ReplyCache::ReplyInfo & reply_info, const uint8_t * request_
                 new_relative_path.string());
 
             try {
-                drive.rename_file(old_relative_path, new_relative_path);
+                const auto [old_server_path, new_server_path] = drive.rename_file(old_relative_path, new_relative_path);
+                // The locks follow the renamed file.
+                const auto state_lock = lock_server_state();
+                lock_manager->rename(old_server_path, new_server_path);
             } catch (const std::runtime_error & ex) {
                 return_code = get_dos_err_code(ex, DOS_EXTERR_ACCESS_DENIED);
                 log(LogLevel::WARNING,
@@ -614,7 +1282,11 @@ int process_request(ReplyCache::ReplyInfo & reply_info, const uint8_t * request_
 
             log(LogLevel::DEBUG, "DELETE_FILE \"{:c}:\\{}\"\n", reqdrv + 'A', relative_path.string());
             try {
-                drive.delete_files(relative_path);
+                const auto deleted_paths = drive.delete_files(relative_path);
+                const auto state_lock = lock_server_state();
+                for (const auto & path : deleted_paths) {
+                    lock_manager->remove(path);
+                }
             } catch (const std::runtime_error & ex) {
                 return_code =
                     log_exception_get_dos_err_code("DELETE_FILE", reqdrv, relative_path, DOS_EXTERR_FILE_NOT_FOUND, ex);
@@ -676,6 +1348,9 @@ int process_request(ReplyCache::ReplyInfo & reply_info, const uint8_t * request_
                 reply->dir_entry = to_little16(fpos);
                 reply_packet_len = sizeof(drive_proto_find_reply);
             }
+            if (handle != 0xFFFFU) {
+                memo_validators[memo_validators_count++] = {handle, drive.get_generation(handle)};
+            }
         } break;
 
         case INT2F_FIND_NEXT: {
@@ -797,8 +1472,7 @@ int process_request(ReplyCache::ReplyInfo & reply_info, const uint8_t * request_
                     reqdrv + 'A',
                     relative_path.string(),
                     stack_attr);
-                std::error_code ec;
-                if (!std::filesystem::is_directory(server_directory)) {
+                if (!drive.is_directory(server_directory)) {
                     return_code = DOS_EXTERR_PATH_NOT_FOUND;
                     log(LogLevel::INFO,
                         "OPEN/CREATE/EXTENDED_OPEN_CREATE: ({}) Parent path is not a directory: \"{}\"\n",
@@ -827,7 +1501,7 @@ int process_request(ReplyCache::ReplyInfo & reply_info, const uint8_t * request_
                             "CREATE_FILE \"{}\", stack_attr=0x{:04X}\n",
                             server_path.string(),
                             stack_attr);
-                        const bool file_exists = std::filesystem::exists(server_path);
+                        const bool file_exists = drive.exists(server_path);
                         const uint8_t attr = file_exists ? drive.get_server_path_attrs(server_path) : FAT_ERROR_ATTR;
                         properties = drive.create_or_truncate_file(server_path, stack_attr & 0xFF, attr);
                         if (!file_exists) {
@@ -909,6 +1583,10 @@ int process_request(ReplyCache::ReplyInfo & reply_info, const uint8_t * request_
                     reply->result_code = to_little16(ext_open_create_result_code);
                     reply->mode = result_open_mode;
                     reply_packet_len = sizeof(drive_proto_open_create_reply);
+                    if (memoizable) {
+                        add_memo_validator(drive, server_directory, memo_validators, memo_validators_count);
+                        memo_validators[memo_validators_count++] = {handle, drive.get_generation(handle)};
+                    }
                 }
             } catch (const std::runtime_error & ex) {
                 return_code = get_dos_err_code(ex, DOS_EXTERR_FILE_NOT_FOUND);
@@ -927,8 +1605,18 @@ int process_request(ReplyCache::ReplyInfo & reply_info, const uint8_t * request_
                 return -1;
             }
 
-            // Always returns 0; this server does not implement additional features.
-            return_code = 0;
+            auto const * const request = reinterpret_cast<const drive_proto_netmount_feature *>(request_data);
+            switch (from_little16(request->feature_id)) {
+                case NETMOUNT_FEATURE_TIMEOUT_HINTS: {
+                    auto * const reply = reinterpret_cast<drive_proto_timeout_hints_reply *>(reply_data);
+                    fill_timeout_hints(reply_info, *reply);
+                    reply_packet_len = sizeof(*reply);
+                    return_code = 1;
+                } break;
+
+                default:  // feature not supported
+                    return_code = 0;
+            }
         } break;
 
         default:  // unknown query - ignore
@@ -938,10 +1626,167 @@ int process_request(ReplyCache::ReplyInfo & reply_info, const uint8_t * request_
     reply_header->length_flags = extended_features_flag_in_reply ? DRIVE_PROTO_FLAG_EXTENDED_FEATURES : 0;
     reply_header->ax = to_little16(return_code);
 
+    if (memoizable && memo_validators_count > 0) {
+        const auto state_lock = lock_server_state();
+        response_memo.store(
+            reqdrv,
+            function,
+            request_packet,
+            request_data_len,
+            reply_info.send_packet,
+            reply_packet_len,
+            return_code,
+            memo_validators.data(),
+            memo_validators_count);
+    }
+
     return reply_packet_len + sizeof(struct drive_proto_hdr);
 }
 
 
+// Fills the reply to `request_packet` with the error `dos_err_code` and no data. Returns the reply length.
+int make_error_reply(ReplyCache::ReplyInfo & reply_info, const PacketBuffer & request_packet, uint16_t dos_err_code) {
+    if (!reply_info.send_packet || reply_info.send_packet.is_shared()) {
+        reply_info.send_packet = packet_buffer_pool.acquire();
+    }
+    auto * const reply_header = reinterpret_cast<struct drive_proto_hdr *>(reply_info.send_packet.data());
+    *reply_header = *reinterpret_cast<struct drive_proto_hdr const *>(request_packet.data());
+    reply_header->length_flags = DRIVE_PROTO_FLAG_EXTENDED_FEATURES;
+    reply_header->ax = to_little16(dos_err_code);
+    return sizeof(struct drive_proto_hdr);
+}
+
+
+// Request processed by the storage worker of its drive. The worker keeps it after a timeout.
+struct RequestTask {
+    ReplyCache::ReplyInfo reply_info;
+    PacketBuffer request_packet;
+    int request_packet_len;
+    int reply_len{-1};
+};
+
+// Mutating request of each drive that did not finish in time. Its reply is sent when the client repeats
+// the request, see `handle_request`.
+std::array<std::shared_ptr<RequestTask>, MAX_DRIVES_COUNT> late_requests;
+
+
+// Returns true if the request changes the content of the drive or the state of the server.
+bool is_mutating_request(int function) noexcept {
+    switch (function) {
+        case INT2F_REMOVE_DIR:
+        case INT2F_MAKE_DIR:
+        case INT2F_CLOSE_FILE:
+        case INT2F_WRITE_FILE:
+        case INT2F_LOCK_UNLOCK_FILE:
+        case INT2F_UNLOCK_FILE:
+        case INT2F_SET_ATTRS:
+        case INT2F_RENAME_FILE:
+        case INT2F_DELETE_FILE:
+        case INT2F_CREATE_FILE:
+        case INT2F_EXTENDED_OPEN_CREATE_FILE:
+            return true;
+        default:
+            return false;
+    }
+}
+
+
+// Returns true if `request_packet` repeats the request of `task`. The sequence number and the checksum are
+// not compared, DOS repeats a failed call (the user chooses "Retry") as a new request.
+bool is_repeated_request(const RequestTask & task, const PacketBuffer & request_packet, int request_packet_len) {
+    if (task.request_packet_len != request_packet_len) {
+        return false;
+    }
+    auto * const task_header = reinterpret_cast<struct drive_proto_hdr const *>(task.request_packet.data());
+    auto * const header = reinterpret_cast<struct drive_proto_hdr const *>(request_packet.data());
+    return task_header->drive == header->drive && task_header->function == header->function &&
+           memcmp(
+               task.request_packet.data() + sizeof(struct drive_proto_hdr),
+               request_packet.data() + sizeof(struct drive_proto_hdr),
+               request_packet_len - sizeof(struct drive_proto_hdr)) == 0;
+}
+
+
+// Processes the request, returns the reply length. Requests for a drive that is not initialized yet or whose
+// storage does not respond are answered with the retryable "drive not ready" error. Requests for a drive with
+// a storage watchdog are processed by the worker of the watchdog, `state_lock` is released while waiting.
+// A mutating request that did not finish in time is still completed by the worker. The client got the error,
+// its reply is sent when the client repeats the request, the request is not processed again.
+int handle_request(
+    ReplyCache::ReplyInfo & reply_info,
+    const PacketBuffer & request_packet,
+    int request_packet_len,
+    std::unique_lock<std::mutex> & state_lock) {
+    auto * const request_header = reinterpret_cast<struct drive_proto_hdr const *>(request_packet.data());
+    const unsigned int reqdrv = request_header->drive & 0x1F;
+    if (reqdrv >= drives.size() || drive_inits[reqdrv].state == DriveInit::State::UNUSED) {
+        return process_request(reply_info, request_packet, request_packet_len);
+    }
+
+    // The client retries the request later, other drives are served in the meantime.
+    if (!prepare_drive(reqdrv)) {
+        log(LogLevel::INFO, "{}: Drive {:c} is not ready\n", __func__, 'A' + reqdrv);
+        return make_error_reply(reply_info, request_packet, DOS_EXTERR_DRIVE_NOT_READY);
+    }
+
+    auto * const watchdog = storage_watchdogs[reqdrv].get();
+    if (!watchdog) {
+        return process_request(reply_info, request_packet, request_packet_len);
+    }
+    if (watchdog->is_degraded()) {
+        log(LogLevel::INFO,
+            "{}: Drive {:c}: Storage has not responded for {} ms\n",
+            __func__,
+            'A' + reqdrv,
+            watchdog->get_in_flight_time().count());
+        return make_error_reply(reply_info, request_packet, DOS_EXTERR_DRIVE_NOT_READY);
+    }
+
+    // The drive is not degraded, a late request has finished. It is dropped when its client sends another request.
+    auto & late_request = late_requests[reqdrv];
+    if (late_request && late_request->reply_info.ipv4_addr == reply_info.ipv4_addr &&
+        late_request->reply_info.udp_port == reply_info.udp_port) {
+        const auto late_task = std::exchange(late_request, nullptr);
+        if (late_task->reply_len > 0 && is_repeated_request(*late_task, request_packet, request_packet_len)) {
+            log(LogLevel::NOTICE,
+                "{}: Drive {:c}: Sending the reply of the late request (seq {:d})\n",
+                __func__,
+                'A' + reqdrv,
+                request_header->sequence);
+            reply_info.send_packet = std::move(late_task->reply_info.send_packet);
+            reinterpret_cast<struct drive_proto_hdr *>(reply_info.send_packet.data())->sequence =
+                request_header->sequence;
+            return late_task->reply_len;
+        }
+    }
+
+    auto task = std::make_shared<RequestTask>();
+    task->reply_info = std::move(reply_info);
+    task->request_packet = request_packet;
+    task->request_packet_len = request_packet_len;
+    bool finished;
+    try {
+        finished = watchdog->run(
+            [task]() {
+                task->reply_len = process_request(task->reply_info, task->request_packet, task->request_packet_len);
+            },
+            state_lock);
+    } catch (...) {
+        reply_info = std::move(task->reply_info);
+        throw;
+    }
+    if (!finished) {
+        // The client gets the error and may retry. The reply of a late mutating request is kept for the retry.
+        if (is_mutating_request(request_header->function)) {
+            late_requests[reqdrv] = std::move(task);
+        }
+        return make_error_reply(reply_info, request_packet, DOS_EXTERR_DRIVE_NOT_READY);
+    }
+    reply_info = std::move(task->reply_info);
+    return task->reply_len;
+}
+
+
 // used for debug output of frames on screen
 void dump_packet(const unsigned char * frame, int len) {
     constexpr int LINEWIDTH = 16;
@@ -1001,6 +1846,186 @@ uint16_t bsd_checksum(const void * addr, uint16_t len) {
 }
 
 
+// Prints the estimated hit ratios of the drive caches for several cache sizes.
+void print_cache_statistics() {
+    constexpr std::size_t SIZES[] = {16, 64, 256, 1024, 4096, 16384, 65536};
+    constexpr const char * STREAM_NAMES[] = {"handles", "directory lists", "read blocks"};
+
+    print(stdout, "Estimated LRU cache hit ratios [%] by cache size [entries]:\n");
+    print(stdout, "drive {:<16} {:>10} {:>8}", "cache", "accesses", "sampling");
+    for (const auto size : SIZES) {
+        print(stdout, " {:>6}", size);
+    }
+    print(stdout, "\n");
+
+    for (std::size_t i = 0; i < drives.size(); ++i) {
+        const auto & drive = drives[i];
+        if (!is_drive_ready(i)) {
+            continue;
+        }
+        for (int stream = 0; stream < Drive::CACHE_STREAM_COUNT; ++stream) {
+            const auto * const curve = drive.get_miss_ratio_curve(static_cast<Drive::CacheStream>(stream));
+            if (!curve) {
+                continue;
+            }
+            print(
+                stdout,
+                "  {:c}   {:<16} {:>10} {:>7.2f}%",
+                'A' + i,
+                STREAM_NAMES[stream],
+                curve->get_access_count(),
+                curve->get_sampling_rate() * 100);
+            for (const auto size : SIZES) {
+                print(stdout, " {:>6.1f}", curve->get_hit_ratio(size) * 100);
+            }
+            print(stdout, "\n");
+        }
+        if (drive.get_max_directory_list_count() != 0) {
+            print(stdout, "  {:c}   directory list limit: {}\n", 'A' + i, drive.get_max_directory_list_count());
+        }
+    }
+    std::fflush(stdout);
+}
+
+
+// Logs the accounting of the SLIP link and the link settings recommended for the observed error rate.
+void log_slip_statistics(SlipUdpSerial & slip) {
+    const auto statistics = slip.get_statistics();
+    const auto efficiency = [](std::uint64_t payload_bytes, std::uint64_t wire_bytes) {
+        return wire_bytes > 0 ? static_cast<double>(payload_bytes) / wire_bytes * 100 : 0.0;
+    };
+    log(LogLevel::INFO,
+        "SLIP link: received {} frames, {} bytes on the wire, {} bytes of payload ({:.1f}%), {} escapes, "
+        "{} bytes outside of frames\n",
+        statistics.rx_frames,
+        statistics.rx_wire_bytes,
+        statistics.rx_payload_bytes,
+        efficiency(statistics.rx_payload_bytes, statistics.rx_wire_bytes),
+        statistics.rx_escapes,
+        statistics.rx_ignored_bytes);
+    log(LogLevel::INFO,
+        "SLIP link: sent {} frames, {} bytes on the wire, {} bytes of payload ({:.1f}%), {} escapes\n",
+        statistics.tx_frames,
+        statistics.tx_wire_bytes,
+        statistics.tx_payload_bytes,
+        efficiency(statistics.tx_payload_bytes, statistics.tx_wire_bytes),
+        statistics.tx_escapes);
+    log(LogLevel::INFO,
+        "SLIP link: {} corrupted frames: {} IPv4 header checksum, {} length, {} other header, {} payload errors, "
+        "{} oversized, {} bad escapes, {} timeouts\n",
+        statistics.rx_corrupted_frames(),
+        statistics.rx_checksum_errors,
+        statistics.rx_length_errors,
+        statistics.rx_header_errors,
+        statistics.rx_payload_errors,
+        statistics.rx_oversized_frames,
+        statistics.rx_bad_escapes,
+        statistics.rx_timeouts);
+    if (statistics.port_errors_valid) {
+        log(LogLevel::INFO,
+            "SLIP link: serial port errors: {} overruns, {} framing errors, {} parity errors, {} buffer overruns\n",
+            statistics.port_errors.overruns,
+            statistics.port_errors.frame_errors,
+            statistics.port_errors.parity_errors,
+            statistics.port_errors.buffer_overruns);
+    }
+
+    const auto recommendation = slip.get_recommendation();
+    if (!recommendation.valid) {
+        log(LogLevel::INFO, "SLIP link: too few frames received to estimate the error rate\n");
+        return;
+    }
+    log(LogLevel::INFO,
+        "SLIP link: frame error rate {:.3g}, estimated bit error rate {:.3g}, escape overhead {:.2f}%\n",
+        recommendation.frame_error_rate,
+        recommendation.bit_error_rate,
+        recommendation.escape_ratio * 100);
+    log(LogLevel::INFO,
+        "SLIP link: expected goodput {:.0f} B/s at {} baud with MTU {}; recommended MTU {} ({:.0f} B/s)\n",
+        recommendation.goodput,
+        recommendation.current_baudrate,
+        recommendation.current_mtu,
+        recommendation.mtu,
+        recommendation.mtu_goodput);
+    if (recommendation.try_higher_baudrate) {
+        log(LogLevel::INFO,
+            "SLIP link: no errors observed, baud rate {} may be tried ({:.0f} B/s if error-free)\n",
+            recommendation.baudrate,
+            recommendation.baudrate_goodput);
+    } else if (recommendation.baudrate != recommendation.current_baudrate) {
+        log(LogLevel::INFO,
+            "SLIP link: recommended baud rate {} ({:.0f} B/s if error-free)\n",
+            recommendation.baudrate,
+            recommendation.baudrate_goodput);
+    }
+}
+
+
+// Divides `budget` bytes between the directory listing caches of the shared drives.
+// The memory is allocated in steps (doubling the cache size), each step goes to the drive where it saves
+// the most misses per byte according to the estimated miss ratio curve. A cache does not grow beyond
+// the size at which the hit ratio stops improving.
+void resize_directory_list_caches(std::size_t budget) {
+    // Used when the size of the listings is not known yet
+    constexpr std::size_t DEFAULT_DIRECTORY_LIST_BYTES = 4096;
+    constexpr std::size_t MAX_DIRECTORY_LIST_COUNT = 65535;
+
+    struct Candidate {
+        Drive * drive;
+        const MissRatioCurve * curve;
+        std::size_t entry_bytes;
+        std::size_t count;
+    };
+    std::vector<Candidate> candidates;
+    for (std::size_t i = 0; i < drives.size(); ++i) {
+        auto & drive = drives[i];
+        const auto * const curve = drive.get_miss_ratio_curve(Drive::CacheStream::DIRECTORY_LISTS);
+        if (!is_drive_ready(i) || !curve) {
+            continue;
+        }
+        const auto [count, bytes] = drive.get_directory_lists_usage();
+        const auto entry_bytes = count > 0 ? std::max<std::size_t>(bytes / count, 1) : DEFAULT_DIRECTORY_LIST_BYTES;
+        candidates.push_back({&drive, curve, entry_bytes, 1});
+        budget -= std::min(budget, entry_bytes);
+    }
+
+    while (true) {
+        Candidate * best = nullptr;
+        double best_gain = 0;
+        for (auto & candidate : candidates) {
+            const auto step_bytes = candidate.count * candidate.entry_bytes;
+            if (candidate.count * 2 > MAX_DIRECTORY_LIST_COUNT || step_bytes > budget) {
+                continue;
+            }
+            const double saved_misses =
+                candidate.curve->get_access_count() *
+                (candidate.curve->get_hit_ratio(candidate.count * 2) - candidate.curve->get_hit_ratio(candidate.count));
+            const double gain = saved_misses / step_bytes;
+            if (gain > best_gain) {
+                best_gain = gain;
+                best = &candidate;
+            }
+        }
+        if (!best) {
+            break;
+        }
+        budget -= best->count * best->entry_bytes;
+        best->count *= 2;
+    }
+
+    for (const auto & candidate : candidates) {
+        if (candidate.drive->get_max_directory_list_count() != candidate.count) {
+            log(LogLevel::INFO,
+                "Directory list limit of drive {} set to {} (estimated hit ratio {:.1f}%)\n",
+                candidate.drive->get_root().string(),
+                candidate.count,
+                candidate.curve->get_hit_ratio(candidate.count) * 100);
+            candidate.drive->set_max_directory_list_count(candidate.count);
+        }
+    }
+}
+
+
 void print_help(const char * program_name) {
 #if DOS_ATTRS_NATIVE == 1
 #define NATIVE ", NATIVE"
@@ -1026,10 +2051,15 @@ void print_help(const char * program_name) {
         stdout,
         "{} [--help] [--bind-addr=<IP_ADDR>] [--bind-port=<UDP_PORT>] "
         "[--slip-dev=<SERIAL_DEVICE> --slip-speed=<BAUD_RATE>] [--slip-rts-cts=<ENABLED>] "
-        "[--translit-map-path=<PATH>] [--log-level=<LEVEL>] "
+        "[--translit-map-path=<PATH>] [--log-level=<LEVEL>] [--perf-counters=<ENABLED>] "
+        "[--shm-cache=<NAME>] [--shm-cache-max-age=<SECONDS>] [--cache-stats=<ENABLED>] [--cache-budget=<KIB>] "
+        "[--lock-lease=<SECONDS>] [--host-locks=<ENABLED>] [--content-cache=<MIB>] [--drive-init-timeout=<SECONDS>] "
         "<drive>=<root_path>[,attrs=<storage_method>][,label=<volume_label>][,name_conversion=<method>]"
-        "[,readonly=<MODE>][,client_timestamp=<ENABLED>] [... <drive>=<root_path>[,attrs=<storage_method>]"
-        "[,label=<volume_label>][,name_conversion=<method>][,readonly=<MODE>][,client_timestamp=<ENABLED>]]\n\n",
+        "[,readonly=<MODE>][,client_timestamp=<ENABLED>][,pin=<patterns>][,media=<type>][,quota=<MIB>]"
+        "[,compress_names=<ENABLED>][,watchdog=<SECONDS>] "
+        "[... <drive>=<root_path>[,attrs=<storage_method>][,label=<volume_label>][,name_conversion=<method>]"
+        "[,readonly=<MODE>][,client_timestamp=<ENABLED>][,pin=<patterns>][,media=<type>][,quota=<MIB>]"
+        "[,compress_names=<ENABLED>][,watchdog=<SECONDS>]]\n\n",
         program_name);
 
     print(
@@ -1044,14 +2074,46 @@ void print_help(const char * program_name) {
         "  --slip-rts-cts=<ENABLED>    Enable hardware flow control: 0 = OFF, 1 = ON (default: OFF)\n"
         "  --translit-map-path=<PATH>  Unicode-to-ASCII map file (default: \"netmount-u2a.map\"; empty disables)\n"
         "  --log-level=<LEVEL>         Logging verbosity level: 0 = OFF, 7 = TRACE (default: 3)\n"
+        "  --perf-counters=<ENABLED>   Measure hardware counters per request type, report at exit: 0 = OFF, 1 = ON "
+        "(default: OFF)\n"
+        "  --shm-cache=<NAME>          Share directory listings with other local server instances using\n"
+        "                              the same shared memory segment NAME (default: not shared)\n"
+        "  --shm-cache-max-age=<SECONDS>  Maximum age of a shared directory listing (default: {})\n"
+        "  --cache-stats=<ENABLED>     Estimate cache hit ratios by cache size, report at exit: 0 = OFF, 1 = ON "
+        "(default: OFF)\n"
+        "  --cache-budget=<KIB>        Size the directory listing caches automatically to fit into KIB kilobytes\n"
+        "                              (enables --cache-stats; default: listings are not limited)\n"
+        "  --lock-lease=<SECONDS>      Release the file locks of a client after SECONDS without requests,\n"
+        "                              0 = never (default: {})\n"
+        "  --host-locks=<ENABLED>      Lock the server files, locks are seen by other programs: 0 = OFF, 1 = ON\n"
+        "                              (Linux only, default: OFF)\n"
+        "  --content-cache=<MIB>       Keep the content of small files in MIB mebibytes of memory, identical files\n"
+        "                              share one copy (not supported on Windows, default: OFF)\n"
+        "  --drive-init-timeout=<SECONDS>  Stop waiting for a drive initialization that has not finished\n"
+        "                              in SECONDS, e.g. on a hung mount (default: {})\n"
         "  <drive>=<root_path>         drive - DOS drive C-Z, root_path - path to serve\n"
         "  attrs=<storage_method>      File attribute storage method: AUTO, IGNORE" NATIVE EXTENDED
         " (default: AUTO)\n"
         "  label=<volume_label>        volume label (first 11 chars used, default: {}; use \"--label=\" to remove)\n"
         "  name_conversion=<method>    file name conversion method: OFF, RAM (default: RAM)\n"
         "  readonly=<MODE>             enable read-only sharing: 0 = writable, 1 = read-only (default: writable)\n"
-        "  client_timestamp=<ENABLED>  use client timestamp if present: 0 = OFF, 1 = ON (default: ON)\n",
+        "  client_timestamp=<ENABLED>  use client timestamp if present: 0 = OFF, 1 = ON (default: ON)\n"
+        "  pin=<patterns>              files kept in memory, ':' separated list of paths relative to root_path,\n"
+        "                              '/' separates directories, '*' and '?' wildcards\n"
+        "                              (e.g. \"command.com:drivers/*\")\n"
+        "  media=<type>                storage media: SSD, HDD, OPTICAL; files on HDD and OPTICAL are read ahead\n"
+        "                              in large chunks (default: SSD)\n"
+        "  quota=<MIB>                 report a drive of MIB mebibytes, free space is the quota minus the size\n"
+        "                              of the files on the drive (default: filesystem size and free space)\n"
+        "  compress_names=<ENABLED>    keep the server names of directory listings front-coded, saves memory\n"
+        "                              on large directories with long names: 0 = OFF, 1 = ON (default: OFF)\n"
+        "  watchdog=<SECONDS>          run the storage operations of the drive in a worker thread, a drive whose\n"
+        "                              storage does not respond in SECONDS is reported as not ready until\n"
+        "                              it responds, 0 = OFF (default: OFF)\n",
         DRIVE_PROTO_UDP_PORT,
+        DEFAULT_SHM_CACHE_MAX_AGE,
+        DEFAULT_LOCK_LEASE_TIME,
+        DEFAULT_DRIVE_INIT_TIMEOUT,
         DEFAULT_VOLUME_LABEL);
 
 #undef EXTENDED
@@ -1097,24 +2159,18 @@ int parse_share_definition(std::string_view share) {
         return -1;
     }
     auto & drive = drives.at(drive_char - 'A');
-    if (drive.is_shared()) {
+    auto & init = drive_inits.at(drive_char - 'A');
+    if (init.state != DriveInit::State::UNUSED) {
         print(stdout, "Drive \"{:c}\" already in use.\n", drive_char);
         return -1;
     }
 
+    // The root is resolved and opened when the drive is initialized, on the first request for it.
     std::size_t offset = 2;
     auto root_path = get_token(share, ',', offset);
-    std::filesystem::path rpath;
-    try {
-        rpath = std::filesystem::canonical(root_path);
-        if (!std::filesystem::is_directory(rpath)) {
-            log(LogLevel::CRITICAL, "Path \"{}\" is not a directory\n", root_path);
-            return 1;
-        }
-        drive.set_root(rpath);
-    } catch (const std::exception & ex) {
-        log(LogLevel::CRITICAL, "Failed to resolve path \"{}\": {}\n", root_path, ex.what());
-        return 1;
+    if (root_path.empty()) {
+        print(stdout, "Missing root path for drive \"{:c}\"\n", drive_char);
+        return -1;
     }
 
     bool is_volume_label_defined = false;
@@ -1134,15 +2190,6 @@ int parse_share_definition(std::string_view share) {
             }
             if (upper_value == "NATIVE") {
 #if DOS_ATTRS_NATIVE == 1
-                if (!is_dos_attrs_native_supported(drive.get_root())) {
-                    print(
-                        stdout,
-                        "Native storage of DOS attributes was requested for drive \"{:c}\", but \"{}\" does not "
-                        "support it\n",
-                        drive_char,
-                        drive.get_root().string());
-                    return -1;
-                }
                 drive.set_attrs_mode(AttrsMode::NATIVE);
                 continue;
 #else
@@ -1155,15 +2202,6 @@ int parse_share_definition(std::string_view share) {
             }
             if (upper_value == "EXTENDED") {
 #if DOS_ATTRS_IN_EXTENDED == 1
-                if (!is_dos_attrs_in_extended_supported(drive.get_root())) {
-                    print(
-                        stdout,
-                        "Storing DOS attributes in extended attributes was requested for drive \"{:c}\", but \"{}\" "
-                        "does not support it\n",
-                        drive_char,
-                        drive.get_root().string());
-                    return -1;
-                }
                 drive.set_attrs_mode(AttrsMode::IN_EXTENDED);
                 continue;
 #else
@@ -1192,7 +2230,7 @@ int parse_share_definition(std::string_view share) {
             log(LogLevel::NOTICE,
                 "Set filename conversion method for drive \"{:c}\" path \"{}\" to \"{}\"\n",
                 drive_char,
-                drive.get_root().string(),
+                root_path,
                 upper_value);
             if (upper_value == "OFF") {
                 drive.set_file_name_conversion(Drive::FileNameConversion::OFF);
@@ -1210,7 +2248,7 @@ int parse_share_definition(std::string_view share) {
             log(LogLevel::NOTICE,
                 "Set read-only mode for drive \"{:c}\" path \"{}\" to \"{}\"\n",
                 drive_char,
-                drive.get_root().string(),
+                root_path,
                 value);
             if (value == "0") {
                 drive.set_read_only(false);
@@ -1229,7 +2267,7 @@ int parse_share_definition(std::string_view share) {
                 "Client timestamp is {} for drive \"{:c}\" path \"{}\"",
                 drive.get_use_client_timestamp() ? "enabled" : "disabled",
                 drive_char,
-                drive.get_root().string());
+                root_path);
             if (value == "0") {
                 drive.set_use_client_timestamp(false);
                 continue;
@@ -1241,10 +2279,106 @@ int parse_share_definition(std::string_view share) {
             print(stdout, "Unknown client_timestamp mode \"{}\"\n", value);
             return -1;
         }
+        if (option == "pin") {
+            const auto value = get_token(share, ',', ++offset);
+            std::vector<std::string> patterns;
+            std::size_t pattern_offset = 0;
+            while (pattern_offset < value.length()) {
+                auto pattern = get_token(value, ':', pattern_offset);
+                ++pattern_offset;
+                if (!pattern.empty()) {
+                    patterns.push_back(std::move(pattern));
+                }
+            }
+            log(LogLevel::NOTICE,
+                "Set {} pin patterns for drive \"{:c}\" path \"{}\"\n",
+                patterns.size(),
+                drive_char,
+                root_path);
+            drive.set_pin_patterns(std::move(patterns));
+            continue;
+        }
+        if (option == "media") {
+            const auto value = get_token(share, ',', ++offset);
+            auto upper_value = string_ascii_to_upper(value);
+            log(LogLevel::NOTICE,
+                "Set media type for drive \"{:c}\" path \"{}\" to \"{}\"\n",
+                drive_char,
+                root_path,
+                upper_value);
+            if (upper_value == "SSD") {
+                drive.set_media_type(Drive::MediaType::SSD);
+                continue;
+            }
+            if (upper_value == "HDD") {
+                drive.set_media_type(Drive::MediaType::HDD);
+                continue;
+            }
+            if (upper_value == "OPTICAL") {
+                drive.set_media_type(Drive::MediaType::OPTICAL);
+                continue;
+            }
+            print(stdout, "Unknown media type \"{}\"\n", value);
+            return -1;
+        }
+        if (option == "quota") {
+            const auto value = get_token(share, ',', ++offset);
+            char * end = nullptr;
+            const auto quota_mib = std::strtoll(value.c_str(), &end, 10);
+            if (quota_mib <= 0 || quota_mib > 0xFFFFFFFFLL || *end != '\0') {
+                print(stdout, "Invalid quota \"{}\". Valid values are in the 1 - {} range.\n", value, 0xFFFFFFFFLL);
+                return -1;
+            }
+            log(LogLevel::NOTICE,
+                "Set quota for drive \"{:c}\" path \"{}\" to {} MiB\n",
+                drive_char,
+                root_path,
+                quota_mib);
+            drive.set_quota(static_cast<uint64_t>(quota_mib) << 20);
+            continue;
+        }
+        if (option == "compress_names") {
+            const auto value = get_token(share, ',', ++offset);
+            if (value != "0" && value != "1") {
+                print(stdout, "Unknown compress_names mode \"{}\"\n", value);
+                return -1;
+            }
+            drive.set_compress_names(value == "1");
+            log(LogLevel::NOTICE,
+                "Name compression is {} for drive \"{:c}\" path \"{}\"\n",
+                drive.get_compress_names() ? "enabled" : "disabled",
+                drive_char,
+                root_path);
+            continue;
+        }
+        if (option == "watchdog") {
+            const auto value = get_token(share, ',', ++offset);
+            char * end = nullptr;
+            const auto timeout = std::strtol(value.c_str(), &end, 10);
+            if (timeout < 0 || timeout > 3600 || end == value.c_str() || *end != '\0') {
+                print(stdout, "Invalid watchdog timeout \"{}\". Valid values are in the 0 - 3600 range.\n", value);
+                return -1;
+            }
+            log(LogLevel::NOTICE,
+                "Set storage watchdog timeout for drive \"{:c}\" path \"{}\" to {} seconds\n",
+                drive_char,
+                root_path,
+                timeout);
+            auto & watchdog = storage_watchdogs[drive_char - 'A'];
+            watchdog.reset();
+            if (timeout > 0) {
+                watchdog = std::make_unique<StorageWatchdog>(
+                    std::format("Drive {:c}", drive_char), server_state_mutex, std::chrono::seconds(timeout));
+            }
+            continue;
+        }
         print(stdout, "Unknown argument \"{}\"\n", option);
         return -1;
     }
 
+    init.root_path = std::move(root_path);
+    init.state = DriveInit::State::DEFINED;
+
     if (!is_volume_label_defined) {
         log(LogLevel::NOTICE, "Using default volume label \"{}\" for drive {:c}\n", DEFAULT_VOLUME_LABEL, drive_char);
         drive.set_volume_label(DEFAULT_VOLUME_LABEL);
@@ -1266,7 +2400,14 @@ int main(int argc, char ** argv) {
     std::string slip_dev;
     uint32_t slip_speed{0};
     bool slip_hw_flow_control{false};
-    std::filesystem::path transliteration_map_path = TRANSLITERATION_MAP_FILE;
+    bool perf_counters_enabled{false};
+    std::string shm_cache_name;
+    uint32_t shm_cache_max_age{DEFAULT_SHM_CACHE_MAX_AGE};
+    bool cache_stats_enabled{false};
+    std::size_t cache_budget{0};
+    time_t lock_lease_time{DEFAULT_LOCK_LEASE_TIME};
+    bool host_locks{false};
+    std::size_t content_cache_size{0};
 
     for (int i = 1; i < argc; ++i) {
         std::string_view arg(argv[i]);
@@ -1317,6 +2458,97 @@ int main(int argc, char ** argv) {
             }
             continue;
         }
+        if (arg.starts_with("--perf-counters=")) {
+            perf_counters_enabled = argv[i][16] == '1';
+            if ((!perf_counters_enabled && argv[i][16] != '0') || argv[i][17] != '\0') {
+                print(stdout, "Invalid perf counters mode \"{}\". Valid values are 1 and 0.\n", argv[i] + 16);
+                return -1;
+            }
+            continue;
+        }
+        if (arg.starts_with("--shm-cache=")) {
+            shm_cache_name = arg.substr(12);
+            continue;
+        }
+        if (arg.starts_with("--shm-cache-max-age=")) {
+            char * end = nullptr;
+            auto max_age = std::strtol(argv[i] + 20, &end, 10);
+            if (max_age < 0 || max_age > 3600 || end == argv[i] + 20 || *end != '\0') {
+                print(
+                    stdout,
+                    "Invalid shared cache maximum age \"{}\". Valid values are in the 0 - 3600 range.\n",
+                    argv[i] + 20);
+                return -1;
+            }
+            shm_cache_max_age = max_age;
+            continue;
+        }
+        if (arg.starts_with("--cache-stats=")) {
+            cache_stats_enabled = argv[i][14] == '1';
+            if ((!cache_stats_enabled && argv[i][14] != '0') || argv[i][15] != '\0') {
+                print(stdout, "Invalid cache stats mode \"{}\". Valid values are 1 and 0.\n", argv[i] + 14);
+                return -1;
+            }
+            continue;
+        }
+        if (arg.starts_with("--cache-budget=")) {
+            char * end = nullptr;
+            auto budget = std::strtol(argv[i] + 15, &end, 10);
+            if (budget <= 0 || budget > 0x3FFFFF || *end != '\0') {
+                print(
+                    stdout,
+                    "Invalid cache budget \"{}\". Valid values are in the 1 - {} range.\n",
+                    argv[i] + 15,
+                    0x3FFFFF);
+                return -1;
+            }
+            cache_budget = static_cast<std::size_t>(budget) * 1024;
+            continue;
+        }
+        if (arg.starts_with("--lock-lease=")) {
+            char * end = nullptr;
+            auto lease = std::strtol(argv[i] + 13, &end, 10);
+            if (lease < 0 || lease > 86400 || end == argv[i] + 13 || *end != '\0') {
+                print(stdout, "Invalid lock lease \"{}\". Valid values are in the 0 - 86400 range.\n", argv[i] + 13);
+                return -1;
+            }
+            lock_lease_time = lease;
+            continue;
+        }
+        if (arg.starts_with("--host-locks=")) {
+            host_locks = argv[i][13] == '1';
+            if ((!host_locks && argv[i][13] != '0') || argv[i][14] != '\0') {
+                print(stdout, "Invalid host locks mode \"{}\". Valid values are 1 and 0.\n", argv[i] + 13);
+                return -1;
+            }
+            continue;
+        }
+        if (arg.starts_with("--content-cache=")) {
+            char * end = nullptr;
+            auto size = std::strtol(argv[i] + 16, &end, 10);
+            if (size <= 0 || size > 65536 || *end != '\0') {
+                print(
+                    stdout,
+                    "Invalid content cache size \"{}\". Valid values are in the 1 - 65536 range.\n",
+                    argv[i] + 16);
+                return -1;
+            }
+            content_cache_size = static_cast<std::size_t>(size) * 1024 * 1024;
+            continue;
+        }
+        if (arg.starts_with("--drive-init-timeout=")) {
+            char * end = nullptr;
+            auto timeout = std::strtol(argv[i] + 21, &end, 10);
+            if (timeout <= 0 || timeout > 3600 || *end != '\0') {
+                print(
+                    stdout,
+                    "Invalid drive initialization timeout \"{}\". Valid values are in the 1 - 3600 range.\n",
+                    argv[i] + 21);
+                return -1;
+            }
+            drive_init_timeout = timeout;
+            continue;
+        }
         if (arg.starts_with("--log-level=")) {
             constexpr auto MAX_LOG_LEVEL = static_cast<long>(LogLevel::TRACE);
             char * end = nullptr;
@@ -1365,27 +2597,8 @@ int main(int argc, char ** argv) {
     }
 
     bool drives_defined = false;
-    for (auto & drive : drives) {
-        if (drive.is_shared()) {
-            drives_defined = true;
-            if (drive.get_attrs_mode() == AttrsMode::AUTO) {
-#if DOS_ATTRS_NATIVE == 1
-                if (is_dos_attrs_native_supported(drive.get_root())) {
-                    drive.set_attrs_mode(AttrsMode::NATIVE);
-                    continue;
-                }
-#endif
-
-#if DOS_ATTRS_IN_EXTENDED == 1
-                if (is_dos_attrs_in_extended_supported(drive.get_root())) {
-                    drive.set_attrs_mode(AttrsMode::IN_EXTENDED);
-                    continue;
-                }
-#endif
-
-                drive.set_attrs_mode(AttrsMode::IGNORE);
-            }
-        }
+    for (const auto & init : drive_inits) {
+        drives_defined |= init.state != DriveInit::State::UNUSED;
     }
     if (!drives_defined) {
         print(stdout, "None shared drive defined. Use \"--help\" to display help.\n");
@@ -1409,12 +2622,35 @@ int main(int argc, char ** argv) {
         try {
             slip.reset(new SlipUdpSerial(slip_dev));
             slip->setup(slip_speed, slip_hw_flow_control);
+            link_ms_per_byte = 10000.0 / slip_speed;  // 8 data bits, start and stop bit
         } catch (const std::runtime_error & ex) {
             log(LogLevel::CRITICAL, "SlipUdpSerial initialization failed: {}\n", ex.what());
             return -1;
         }
     }
 
+    // Attach to the directory cache shared with other instances
+    std::unique_ptr<SharedDirectoryCache> shared_directory_cache;
+    if (!shm_cache_name.empty()) {
+        try {
+            shared_directory_cache = std::make_unique<SharedDirectoryCache>(shm_cache_name, shm_cache_max_age);
+        } catch (const std::runtime_error & ex) {
+            log(LogLevel::CRITICAL, "SharedDirectoryCache initialization failed: {}\n", ex.what());
+            return -1;
+        }
+        for (auto & drive : drives) {
+            drive.set_shared_directory_cache(shared_directory_cache.get());
+        }
+    }
+
+    std::unique_ptr<ContentCache> content_cache;
+    if (content_cache_size > 0) {
+        content_cache = std::make_unique<ContentCache>(content_cache_size);
+        for (auto & drive : drives) {
+            drive.set_content_cache(content_cache.get());
+        }
+    }
+
     // setup signals handler
     signal(SIGTERM, signal_handler);
 #ifdef SIGQUIT
@@ -1422,58 +2658,80 @@ int main(int argc, char ** argv) {
 #endif
     signal(SIGINT, signal_handler);
 
-    bool is_file_name_conversion_active = false;
-
-    // Print table with shared drives
+    // Print table with shared drives, they are initialized on the first request.
+    // The attrs mode is the configured one, "auto" is resolved and logged when the drive is initialized.
     bool print_header = true;
     for (std::size_t i = 0; i < drives.size(); ++i) {
         const auto & drive = drives[i];
 
-        if (!drive.is_shared()) {
+        if (drive_inits[i].state == DriveInit::State::UNUSED) {
             continue;
         }
 
         if (print_header) {
-            print(stdout, "attrs mode |   access   | drive | path\n");
+            print(stdout, "attrs config |   access   | drive | path\n");
             print_header = false;
         }
 
-        is_file_name_conversion_active |= drive.get_file_name_conversion() != Drive::FileNameConversion::OFF;
-
-        const auto attrs_mode = drive.get_attrs_mode();
         const auto read_only = drive.is_read_only();
         print(
             stdout,
-            "{:^11}|{:^12}|   {:c}   | {}\n",
-            attrs_mode == AttrsMode::IN_EXTENDED ? "extended" : (attrs_mode == AttrsMode::NATIVE ? "native" : "ignore"),
+            "{:^13}|{:^12}|   {:c}   | {}\n",
+            attrs_mode_name(drive.get_attrs_mode()),
             read_only ? "read-only" : "read/write",
             'A' + i,
-            drive.get_root().string());
+            drive_inits[i].root_path);
     }
     std::fflush(stdout);
 
-    if (is_file_name_conversion_active && !transliteration_map_path.empty()) {
-        try {
-            load_transliteration_map(transliteration_map_path);
-        } catch (const std::exception & ex) {
-            log(LogLevel::CRITICAL,
-                "Filename conversion is enabled, but the transliteration map failed to load: {}\n",
-                ex.what());
-            exit_flag = 1;
+    std::unique_ptr<PerfCounters> perf_counters;
+    if (perf_counters_enabled) {
+        perf_counters = std::make_unique<PerfCounters>();
+    }
+
+    if (cache_stats_enabled || cache_budget > 0) {
+        for (std::size_t i = 0; i < drives.size(); ++i) {
+            if (drive_inits[i].state != DriveInit::State::UNUSED) {
+                drives[i].enable_cache_statistics();
+            }
         }
     }
+    time_t next_cache_resize_time = time(NULL) + CACHE_RESIZE_INTERVAL;
+
+    lock_manager = std::make_unique<LockManager>(lock_lease_time, host_locks);
+    time_t next_lock_lease_check_time = time(NULL) + LOCK_LEASE_CHECK_INTERVAL;
+
+    // The storage workers of the drives touch the server state only while the main thread waits.
+    std::unique_lock server_state_lock(server_state_mutex);
 
     // main loop
     try {
-        uint8_t request_packet[2048];
+        PacketBuffer request_packet;
         while (exit_flag == 0) {
+            if (cache_budget > 0 && time(NULL) >= next_cache_resize_time) {
+                resize_directory_list_caches(cache_budget);
+                next_cache_resize_time = time(NULL) + CACHE_RESIZE_INTERVAL;
+            }
+            refresh_drives_space_info(server_state_lock);
+            if (time(NULL) >= next_lock_lease_check_time) {
+                lock_manager->expire_leases();
+                next_lock_lease_check_time = time(NULL) + LOCK_LEASE_CHECK_INTERVAL;
+            }
+
+            // The previous request buffer was adopted by the reply cache, or it is reused after a dropped packet.
+            if (!request_packet) {
+                request_packet = packet_buffer_pool.acquire();
+            }
+
             std::uint16_t request_packet_len;
             std::uint32_t last_remote_ip;
             std::uint16_t last_remote_port;
             std::string last_remote_ip_str;
 
             if (sock) {
+                server_state_lock.unlock();
                 const auto wait_result = sock->wait_for_data(10000);
+                server_state_lock.lock();
                 switch (wait_result) {
                     case UdpSocket::WaitResult::TIMEOUT:
                         log(LogLevel::DEBUG, "sock->wait_for_data(): Timeout\n");
@@ -1485,13 +2743,15 @@ int main(int argc, char ** argv) {
                         break;
                 }
 
-                request_packet_len = sock->receive(request_packet, sizeof(request_packet));
+                request_packet_len = sock->receive(request_packet.data(), PacketBuffer::SIZE);
 
                 last_remote_ip = sock->get_last_remote_ip();
                 last_remote_port = sock->get_last_remote_port();
                 last_remote_ip_str = sock->get_last_remote_ip_str();
             } else {
+                server_state_lock.unlock();
                 request_packet_len = slip->receive();
+                server_state_lock.lock();
                 if (request_packet_len == 0) {
                     log(LogLevel::DEBUG, "slip->receive(): Timeout\n");
                     continue;
@@ -1504,7 +2764,7 @@ int main(int argc, char ** argv) {
                         bind_port);
                     continue;
                 }
-                memcpy(request_packet, slip->get_last_rx_data(), request_packet_len);
+                memcpy(request_packet.data(), slip->get_last_rx_data(), request_packet_len);
 
                 last_remote_ip = slip->get_last_remote_ip();
                 last_remote_port = slip->get_last_remote_port();
@@ -1523,18 +2783,24 @@ int main(int argc, char ** argv) {
                         "received a truncated/malformed packet from {}:{}\n",
                         last_remote_ip_str,
                         last_remote_port);
+                    if (slip) {
+                        slip->report_payload_error();
+                    }
                     continue;
                 }
             }
 
             // check the protocol version
-            auto * const header = reinterpret_cast<const drive_proto_hdr *>(request_packet);
+            auto * const header = reinterpret_cast<const drive_proto_hdr *>(request_packet.data());
             if (header->version != DRIVE_PROTO_VERSION) {
                 log(LogLevel::WARNING,
                     "unsupported protocol version {:d} from {}:{}\n",
                     header->version,
                     last_remote_ip_str,
                     last_remote_port);
+                if (slip) {
+                    slip->report_payload_error();
+                }
                 continue;
             }
 
@@ -1546,6 +2812,9 @@ int main(int argc, char ** argv) {
                     "received a malformed packet from {}:{}\n",
                     last_remote_ip_str,
                     last_remote_port);
+                if (slip) {
+                    slip->report_payload_error();
+                }
                 continue;
             }
             if (length_from_header > request_packet_len) {
@@ -1554,6 +2823,9 @@ int main(int argc, char ** argv) {
                     "received a truncated packet from {}:{}\n",
                     last_remote_ip_str,
                     last_remote_port);
+                if (slip) {
+                    slip->report_payload_error();
+                }
                 continue;
             } else {
                 if (request_packet_len != length_from_header) {
@@ -1574,7 +2846,7 @@ int main(int argc, char ** argv) {
                 request_packet_len,
                 (checksum_present) ? "ENABLED" : "DISABLED");
             if (global_log_level >= LogLevel::TRACE) {
-                dump_packet(request_packet, request_packet_len);
+                dump_packet(request_packet.data(), request_packet_len);
             }
 
 #ifdef SIMULATE_PACKET_LOSS
@@ -1597,6 +2869,9 @@ int main(int argc, char ** argv) {
                         "CHECKSUM MISMATCH! Computed: 0x{:04X} Received: 0x{:04X}\n",
                         cksum_mine,
                         cksum_remote);
+                    if (slip) {
+                        slip->report_payload_error();
+                    }
                     continue;
                 }
             } else {
@@ -1606,15 +2881,37 @@ int main(int argc, char ** argv) {
                         "Bad MAGIC! Expected: 0x{:04X} Received: 0x{:04X}\n",
                         DRIVE_PROTO_MAGIC,
                         recv_magic);
+                    if (slip) {
+                        slip->report_payload_error();
+                    }
                     continue;
                 }
             }
 
             auto & reply_info = answer_cache.get_reply_info(last_remote_ip, last_remote_port);
-            const int send_msg_len = process_request(reply_info, request_packet, request_packet_len);
-
-            // update reply cache entry
-            memcpy(reply_info.recv_packet.data(), request_packet, request_packet_len);
+            lock_manager->touch({last_remote_ip, last_remote_port});
+            const auto retransmit_count = reply_info.retransmit_count;
+            const auto start_time = std::chrono::steady_clock::now();
+            // The counters measure the main thread, the requests processed by a storage worker are not measured.
+            const unsigned int request_drive = header->drive & 0x1F;
+            const bool measure = perf_counters &&
+                                 (request_drive >= storage_watchdogs.size() || !storage_watchdogs[request_drive]);
+            if (measure) {
+                perf_counters->start();
+            }
+            const int send_msg_len = handle_request(reply_info, request_packet, request_packet_len, server_state_lock);
+            if (measure) {
+                perf_counters->stop(header->function, request_drive);
+            }
+            if (reply_info.retransmit_count == retransmit_count) {
+                const std::chrono::duration<double, std::milli> service_time =
+                    std::chrono::steady_clock::now() - start_time;
+                reply_info.record_service_time(
+                    service_time.count(), request_packet_len + std::max(send_msg_len, 0));
+            }
+
+            // update reply cache entry, it adopts the request buffer
+            reply_info.recv_packet = std::move(request_packet);
             reply_info.recv_len = request_packet_len;
             reply_info.send_len = send_msg_len > 0 ? send_msg_len : 0;
             reply_info.timestamp = time(NULL);
@@ -1678,6 +2975,97 @@ int main(int argc, char ** argv) {
     } catch (const std::runtime_error & ex) {
         log(LogLevel::CRITICAL, "Exception: {}\n", ex.what());
     }
+    if (!server_state_lock.owns_lock()) {
+        server_state_lock.lock();
+    }
+
+    if (perf_counters) {
+        perf_counters->report();
+    }
+
+    if (cache_stats_enabled) {
+        print_cache_statistics();
+    }
+
+    if (shared_directory_cache) {
+        const auto [hits, misses] = shared_directory_cache->get_hits_misses();
+        log(LogLevel::INFO, "Shared directory cache: {} hits, {} misses\n", hits, misses);
+    }
+
+    if (content_cache) {
+        const auto statistics = content_cache->get_statistics();
+        log(LogLevel::INFO,
+            "Content cache: {} hits ({} bytes, {} bytes of shared content), {} misses, {} evictions; "
+            "{} files with {} distinct contents in {} bytes held, {} bytes saved by sharing\n",
+            statistics.hits,
+            statistics.hit_bytes,
+            statistics.shared_hit_bytes,
+            statistics.misses,
+            statistics.evictions,
+            statistics.files,
+            statistics.contents,
+            statistics.bytes,
+            statistics.shared_bytes);
+    }
+
+    const auto packet_statistics = packet_buffer_pool.get_statistics();
+    log(LogLevel::INFO,
+        "Packet buffers: {} acquired, {} allocated, {} in use, peak {} in use\n",
+        packet_statistics.acquired,
+        packet_statistics.allocated,
+        packet_statistics.in_use,
+        packet_statistics.peak_in_use);
+
+    const auto lock_statistics = lock_manager->get_statistics();
+    log(LogLevel::INFO,
+        "Locks: {} lock and {} unlock requests, {} conflicts, {} expired; {} locks of {} clients in {} files held\n",
+        lock_statistics.lock_requests,
+        lock_statistics.unlock_requests,
+        lock_statistics.conflicts,
+        lock_statistics.expired_locks,
+        lock_statistics.locks,
+        lock_statistics.owners,
+        lock_statistics.files);
+    lock_manager.reset();
+
+    if (slip) {
+        log_slip_statistics(*slip);
+    }
+
+    for (std::size_t i = 0; i < drives.size(); ++i) {
+        const auto & drive = drives[i];
+        if (!is_drive_ready(i) || !drive.get_compress_names()) {
+            continue;
+        }
+        const auto & statistics = drive.get_compressed_names_statistics();
+        log(LogLevel::INFO,
+            "Drive {:c}: {} names in {} listings held compressed from {} to {} bytes ({:.1f}%); {} decodes of {} "
+            "names, {:.0f} ns average, {} ns max\n",
+            'A' + i,
+            statistics.names,
+            statistics.lists,
+            statistics.raw_bytes,
+            statistics.stored_bytes,
+            statistics.raw_bytes > 0 ? static_cast<double>(statistics.stored_bytes) / statistics.raw_bytes * 100 : 0.0,
+            statistics.decodes,
+            statistics.decode_steps,
+            statistics.decodes > 0 ? static_cast<double>(statistics.decode_time_ns) / statistics.decodes : 0.0,
+            statistics.max_decode_time_ns);
+    }
+
+    for (std::size_t i = 0; i < storage_watchdogs.size(); ++i) {
+        if (!storage_watchdogs[i]) {
+            continue;
+        }
+        const auto statistics = storage_watchdogs[i]->get_statistics();
+        log(LogLevel::INFO,
+            "Drive {:c}: {} storage operations, {} timed out, longest {} ms, degraded for {} ms\n",
+            'A' + i,
+            statistics.operations,
+            statistics.timeouts,
+            statistics.max_time_ms,
+            statistics.degraded_time_ms);
+    }
 
     // setup default signal handlers
     signal(SIGTERM, SIG_DFL);
@@ -1688,5 +3076,23 @@ int main(int argc, char ** argv) {
 
     udp_socket_ptr = nullptr;
 
+    // A drive initialization or a storage operation blocked by a hung root cannot be interrupted, the process
+    // ends without destroying the drive used by the blocked thread.
+    for (std::size_t i = 0; i < drive_inits.size(); ++i) {
+        auto & init = drive_inits[i];
+        const bool init_blocked = init.state == DriveInit::State::INITIALIZING &&
+                                  init.done.wait_for(std::chrono::seconds(0)) != std::future_status::ready;
+        const bool storage_blocked = storage_watchdogs[i] && storage_watchdogs[i]->is_degraded();
+        if (init_blocked || storage_blocked) {
+            log(LogLevel::WARNING,
+                "{} of drive {:c} path \"{}\" has not finished, exiting without cleanup\n",
+                init_blocked ? "Initialization" : "Storage operation",
+                static_cast<char>('A' + i),
+                init.root_path);
+            std::fflush(nullptr);
+            std::_Exit(0);
+        }
+    }
+
     return 0;
 }
@@ -0,0 +1,88 @@
+// SPDX-License-Identifier: GPL-2.0-only
+// Copyright 2025-2026 Jaroslav Rohel, jaroslav.rohel@gmail.com
+
+#include "packet_buffer.hpp"
+
+#include <algorithm>
+
+namespace netmount_srv {
+
+PacketBuffer::PacketBuffer(const PacketBuffer & other) noexcept : block(other.block) {
+    if (block) {
+        ++block->ref_count;
+    }
+}
+
+
+PacketBuffer & PacketBuffer::operator=(const PacketBuffer & other) noexcept {
+    if (other.block) {
+        ++other.block->ref_count;
+    }
+    reset();
+    block = other.block;
+    return *this;
+}
+
+
+PacketBuffer & PacketBuffer::operator=(PacketBuffer && other) noexcept {
+    if (this != &other) {
+        reset();
+        block = other.block;
+        other.block = nullptr;
+    }
+    return *this;
+}
+
+
+void PacketBuffer::reset() noexcept {
+    if (block && --block->ref_count == 0) {
+        block->pool->release(block);
+    }
+    block = nullptr;
+}
+
+
+PacketBufferPool::PacketBufferPool(std::size_t initial_count) {
+    blocks.reserve(initial_count);
+    free_blocks.reserve(initial_count);
+    for (std::size_t i = 0; i < initial_count; ++i) {
+        allocate_block();
+    }
+}
+
+
+void PacketBufferPool::allocate_block() {
+    auto block = std::make_unique<PacketBuffer::Block>();
+    block->pool = this;
+    block->ref_count = 0;
+    free_blocks.reserve(blocks.size() + 1);  // `release` must not allocate
+    free_blocks.push_back(block.get());
+    blocks.push_back(std::move(block));
+}
+
+
+PacketBuffer PacketBufferPool::acquire() {
+    if (free_blocks.empty()) {
+        allocate_block();
+    }
+    auto * const block = free_blocks.back();
+    free_blocks.pop_back();
+    block->ref_count = 1;
+
+    ++acquired;
+    peak_in_use = std::max(peak_in_use, blocks.size() - free_blocks.size());
+    return PacketBuffer(block);
+}
+
+
+void PacketBufferPool::release(PacketBuffer::Block * block) noexcept {
+    // `free_blocks` has capacity for all blocks
+    free_blocks.push_back(block);
+}
+
+
+PacketBufferPool::Statistics PacketBufferPool::get_statistics() const noexcept {
+    return {acquired, blocks.size(), blocks.size() - free_blocks.size(), peak_in_use};
+}
+
+}  // namespace netmount_srv
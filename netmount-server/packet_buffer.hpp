@@ -0,0 +1,102 @@
+// SPDX-License-Identifier: GPL-2.0-only
+// Copyright 2025-2026 Jaroslav Rohel, jaroslav.rohel@gmail.com
+
+// Reference-counted packet buffers allocated from a pool.
+
+#ifndef _PACKET_BUFFER_HPP_
+#define _PACKET_BUFFER_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace netmount_srv {
+
+class PacketBufferPool;
+
+// Reference to a packet buffer from a PacketBufferPool.
+// Copying the reference shares the buffer. The buffer returns to the pool when the last reference is released.
+// A buffer that is shared must not be modified, see `is_shared`.
+class PacketBuffer {
+public:
+    // Large enough for any packet: the length field of the protocol header has 11 bits.
+    constexpr static std::size_t SIZE = 2048;
+
+    PacketBuffer() noexcept = default;
+    PacketBuffer(const PacketBuffer & other) noexcept;
+    PacketBuffer(PacketBuffer && other) noexcept : block(other.block) { other.block = nullptr; }
+    PacketBuffer & operator=(const PacketBuffer & other) noexcept;
+    PacketBuffer & operator=(PacketBuffer && other) noexcept;
+    ~PacketBuffer() { reset(); }
+
+    // Returns true if the reference refers to a buffer.
+    explicit operator bool() const noexcept { return block != nullptr; }
+
+    std::uint8_t * data() noexcept { return block ? block->data : nullptr; }
+    const std::uint8_t * data() const noexcept { return block ? block->data : nullptr; }
+
+    // Returns true if the buffer is referenced by more than one reference.
+    bool is_shared() const noexcept { return block && block->ref_count > 1; }
+
+    // Releases the reference.
+    void reset() noexcept;
+
+private:
+    friend class PacketBufferPool;
+
+    // Aligned to the cache line, a packet starts at the beginning of a line.
+    struct alignas(64) Block {
+        std::uint8_t data[SIZE];
+        PacketBufferPool * pool;
+        std::uint32_t ref_count;
+    };
+
+    explicit PacketBuffer(Block * block) noexcept : block(block) {}
+
+    Block * block{nullptr};
+};
+
+
+// Pool of packet buffers used by the receive path, the reply cache, the response memo and the transmit path.
+// A received packet stays in the buffer it was received into. The reply cache and the response memo keep
+// references to the buffers instead of copies of the packets. Buffers are allocated when the pool is created;
+// if they are all in use, more are allocated and kept in the pool.
+// The pool must outlive all references to its buffers. Not thread-safe.
+class PacketBufferPool {
+public:
+    struct Statistics {
+        std::uint64_t acquired{0};  // number of `acquire` calls
+        std::size_t allocated{0};   // number of buffers owned by the pool
+        std::size_t in_use{0};      // number of buffers referenced now
+        std::size_t peak_in_use{0};
+    };
+
+    explicit PacketBufferPool(std::size_t initial_count);
+
+    PacketBufferPool(const PacketBufferPool &) = delete;
+    PacketBufferPool & operator=(const PacketBufferPool &) = delete;
+
+    // Returns a reference to an unused buffer. The content of the buffer is undefined.
+    PacketBuffer acquire();
+
+    Statistics get_statistics() const noexcept;
+
+private:
+    friend class PacketBuffer;
+
+    // Returns the buffer to the pool, called when its last reference is released.
+    void release(PacketBuffer::Block * block) noexcept;
+
+    // Allocates a new buffer and adds it to the free buffers.
+    void allocate_block();
+
+    std::vector<std::unique_ptr<PacketBuffer::Block>> blocks;
+    std::vector<PacketBuffer::Block *> free_blocks;
+    std::uint64_t acquired{0};
+    std::size_t peak_in_use{0};
+};
+
+}  // namespace netmount_srv
+
+#endif
@@ -0,0 +1,191 @@
+// SPDX-License-Identifier: GPL-2.0-only
+// Copyright 2025-2026 Jaroslav Rohel, jaroslav.rohel@gmail.com
+
+#include "perf_counters.hpp"
+
+#include "logger.hpp"
+#include "utils.hpp"
+
+#ifdef __linux__
+#include <errno.h>
+#include <linux/perf_event.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+
+namespace netmount_srv {
+
+namespace {
+
+constexpr const char * COUNTER_NAMES[] = {"cycles", "instructions", "cache misses", "branch misses", "wall [ns]"};
+
+#ifdef __linux__
+constexpr uint64_t PERF_EVENT_CONFIGS[] = {
+    PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES};
+
+int perf_event_open(struct perf_event_attr * attr, int group_fd) {
+    return syscall(SYS_perf_event_open, attr, 0, -1, group_fd, PERF_FLAG_FD_CLOEXEC);
+}
+#endif
+
+}  // namespace
+
+
+PerfCounters::PerfCounters() {
+    fds.fill(-1);
+    read_index.fill(-1);
+
+#ifdef __linux__
+    for (int counter = 0; counter < WALL_TIME_NS; ++counter) {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = PERF_EVENT_CONFIGS[counter];
+        attr.read_format = PERF_FORMAT_GROUP;
+        attr.disabled = group_fd == -1 ? 1 : 0;  // the group is enabled by its leader
+        attr.exclude_kernel = 1;                 // allowed by the default perf_event_paranoid setting
+        attr.exclude_hv = 1;
+        const int fd = perf_event_open(&attr, group_fd);
+        if (fd == -1) {
+            log(LogLevel::WARNING,
+                "PerfCounters: Counter \"{}\" is not available: {}\n",
+                COUNTER_NAMES[counter],
+                strerror(errno));
+            continue;
+        }
+        fds[counter] = fd;
+        read_index[counter] = group_size++;
+        if (group_fd == -1) {
+            group_fd = fd;
+        }
+    }
+
+    if (group_fd != -1) {
+        ioctl(group_fd, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+        ioctl(group_fd, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    }
+#else
+    log(LogLevel::WARNING, "PerfCounters: Hardware counters are not supported, only wall time is measured\n");
+#endif
+}
+
+
+PerfCounters::~PerfCounters() {
+#ifdef __linux__
+    for (const auto fd : fds) {
+        if (fd != -1) {
+            close(fd);
+        }
+    }
+#endif
+}
+
+
+bool PerfCounters::is_available(Counter counter) const noexcept {
+    return counter == WALL_TIME_NS || (counter < WALL_TIME_NS && fds[counter] != -1);
+}
+
+
+void PerfCounters::read_values(Values & values) const noexcept {
+    values[WALL_TIME_NS] = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                               std::chrono::steady_clock::now().time_since_epoch())
+                               .count();
+
+#ifdef __linux__
+    if (group_fd == -1) {
+        return;
+    }
+    // PERF_FORMAT_GROUP: number of values followed by the values in the order the counters were added
+    uint64_t buffer[1 + WALL_TIME_NS];
+    if (read(group_fd, buffer, sizeof(buffer)) < static_cast<ssize_t>((1 + group_size) * sizeof(uint64_t))) {
+        return;
+    }
+    for (int counter = 0; counter < WALL_TIME_NS; ++counter) {
+        if (read_index[counter] != -1) {
+            values[counter] = buffer[1 + read_index[counter]];
+        }
+    }
+#endif
+}
+
+
+void PerfCounters::start() noexcept { read_values(start_values); }
+
+
+void PerfCounters::stop(std::uint8_t function, std::uint8_t drive) {
+    Values values{};
+    read_values(values);
+    for (int counter = 0; counter < COUNTER_COUNT; ++counter) {
+        values[counter] -= start_values[counter];
+    }
+
+    auto & item = stats[{function, drive}];
+    ++item.count;
+    for (int counter = 0; counter < COUNTER_COUNT; ++counter) {
+        item.sums[counter] += values[counter];
+    }
+
+    // reservoir sampling keeps a uniform sample of all requests
+    if (item.samples.size() < MAX_SAMPLES) {
+        item.samples.push_back(values);
+    } else {
+        // xorshift64
+        random_state ^= random_state << 13;
+        random_state ^= random_state >> 7;
+        random_state ^= random_state << 17;
+        const auto index = random_state % item.count;
+        if (index < MAX_SAMPLES) {
+            item.samples[index] = values;
+        }
+    }
+}
+
+
+void PerfCounters::report() const {
+    print(stdout, "Performance counters per request:\n");
+    for (const auto & [key, item] : stats) {
+        const auto [function, drive] = key;
+        print(
+            stdout,
+            "function 0x{:02X} drive {:c}: {} requests\n"
+            "  {:>14} {:>12} {:>12} {:>12} {:>12}\n",
+            function,
+            drive + 'A',
+            item.count,
+            "",
+            "avg",
+            "p50",
+            "p90",
+            "p99");
+
+        std::vector<uint64_t> values(item.samples.size());
+        for (int counter = 0; counter < COUNTER_COUNT; ++counter) {
+            if (!is_available(static_cast<Counter>(counter))) {
+                continue;
+            }
+            for (std::size_t i = 0; i < item.samples.size(); ++i) {
+                values[i] = item.samples[i][counter];
+            }
+            std::sort(values.begin(), values.end());
+            const auto percentile = [&values](unsigned int percent) {
+                return values[(values.size() - 1) * percent / 100];
+            };
+            print(
+                stdout,
+                "  {:>14} {:>12} {:>12} {:>12} {:>12}\n",
+                COUNTER_NAMES[counter],
+                item.sums[counter] / item.count,
+                percentile(50),
+                percentile(90),
+                percentile(99));
+        }
+    }
+    std::fflush(stdout);
+}
+
+}  // namespace netmount_srv
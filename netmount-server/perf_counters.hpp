@@ -0,0 +1,70 @@
+// SPDX-License-Identifier: GPL-2.0-only
+// Copyright 2025-2026 Jaroslav Rohel, jaroslav.rohel@gmail.com
+
+// Measures hardware performance counters and wall time of request processing.
+
+#ifndef _PERF_COUNTERS_HPP_
+#define _PERF_COUNTERS_HPP_
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <utility>
+#include <vector>
+
+namespace netmount_srv {
+
+// Samples CPU cycles, instructions, cache misses and branch misses (using perf_event_open on Linux) and wall
+// time around request processing. Results are attributed per INT2F function and drive.
+// If the hardware counters are not available (other OS, no permission, virtualized CPU), the unavailable
+// counters are skipped and at least wall time is measured.
+class PerfCounters {
+public:
+    enum Counter { CYCLES, INSTRUCTIONS, CACHE_MISSES, BRANCH_MISSES, WALL_TIME_NS, COUNTER_COUNT };
+
+    PerfCounters();
+    ~PerfCounters();
+
+    PerfCounters(const PerfCounters &) = delete;
+    PerfCounters & operator=(const PerfCounters &) = delete;
+
+    // Returns true if the counter is available.
+    bool is_available(Counter counter) const noexcept;
+
+    // Starts the measurement of a request.
+    void start() noexcept;
+
+    // Stops the measurement started by `start` and attributes it to `function` and `drive`.
+    void stop(std::uint8_t function, std::uint8_t drive);
+
+    // Prints per-request averages and percentiles for each function and drive.
+    void report() const;
+
+private:
+    // Maximum number of samples kept per function and drive for percentiles (reservoir sampling).
+    constexpr static std::size_t MAX_SAMPLES = 1024;
+
+    using Values = std::array<std::uint64_t, COUNTER_COUNT>;
+
+    struct Stats {
+        std::uint64_t count{0};
+        Values sums{};
+        std::vector<Values> samples;
+    };
+
+    // Reads the current values of the counters.
+    void read_values(Values & values) const noexcept;
+
+    std::array<int, WALL_TIME_NS> fds;         // perf event descriptors, -1 if the counter is not available
+    std::array<int, WALL_TIME_NS> read_index;  // index of the counter value in the group read, -1 if not available
+    int group_fd{-1};                          // leader of the event group
+    int group_size{0};                         // number of counters in the group
+    Values start_values{};
+    std::map<std::pair<std::uint8_t, std::uint8_t>, Stats> stats;  // key is (function, drive)
+    std::uint64_t random_state{0x9E3779B97F4A7C15ULL};
+};
+
+}  // namespace netmount_srv
+
+#endif
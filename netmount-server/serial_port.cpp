@@ -8,6 +8,11 @@
 #include <termios.h>
 #include <unistd.h>
 
+#ifdef __linux__
+#include <linux/serial.h>
+#include <sys/ioctl.h>
+#endif
+
 #include <stdexcept>
 
 class SerialPort::Impl {
@@ -109,6 +114,24 @@ public:
         return bytes_written;
     }
 
+    bool get_error_counters(ErrorCounters & counters) {
+#ifdef TIOCGICOUNT
+        struct serial_icounter_struct icount{};
+        if (ioctl(fd, TIOCGICOUNT, &icount) == -1) {
+            // e.g. a pseudo terminal or a USB adapter without the counters
+            return false;
+        }
+        counters.overruns = static_cast<unsigned>(icount.overrun);
+        counters.frame_errors = static_cast<unsigned>(icount.frame);
+        counters.parity_errors = static_cast<unsigned>(icount.parity);
+        counters.buffer_overruns = static_cast<unsigned>(icount.buf_overrun);
+        return true;
+#else
+        (void)counters;
+        return false;
+#endif
+    }
+
 private:
     static constexpr int INVALID_FD = -1;
     int fd{INVALID_FD};
@@ -128,3 +151,5 @@ void SerialPort::setup(std::uint32_t baudrate, bool hw_flow_control) { p_impl->s
 ssize_t SerialPort::read_byte(std::uint8_t & byte) { return p_impl->read_byte(byte); }
 
 ssize_t SerialPort::write_bytes(const std::uint8_t * data, size_t size) { return p_impl->write_bytes(data, size); }
+
+bool SerialPort::get_error_counters(ErrorCounters & counters) { return p_impl->get_error_counters(counters); }
@@ -10,6 +10,14 @@
 
 class SerialPort {
 public:
+    // Receive errors counted by the serial port driver.
+    struct ErrorCounters {
+        std::uint64_t overruns{0};         // characters lost in the UART
+        std::uint64_t frame_errors{0};     // characters with a missing stop bit
+        std::uint64_t parity_errors{0};    // characters with a wrong parity bit
+        std::uint64_t buffer_overruns{0};  // characters lost because the driver buffer was full
+    };
+
     SerialPort(const std::string & device);
     ~SerialPort();
 
@@ -25,6 +33,10 @@ public:
     /// Throws std::runtime_error exception in case of an error.
     ssize_t write_bytes(const std::uint8_t * data, size_t size);
 
+    /// Reads the receive error counters of the driver. The counters are cumulative since the driver was loaded.
+    /// Returns false if the driver or the platform does not provide them.
+    bool get_error_counters(ErrorCounters & counters);
+
 private:
     class Impl;
     std::unique_ptr<Impl> p_impl;
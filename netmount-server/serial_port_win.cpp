@@ -63,6 +63,12 @@ public:
         return bytes_written;
     }
 
+    bool get_error_counters(ErrorCounters & counters) {
+        // ClearCommError() reports only error flags, not counts.
+        (void)counters;
+        return false;
+    }
+
 private:
     HANDLE h_serial{INVALID_HANDLE_VALUE};
 
@@ -96,3 +102,5 @@ void SerialPort::setup(std::uint32_t baudrate, bool hw_flow_control) { p_impl->s
 ssize_t SerialPort::read_byte(std::uint8_t & byte) { return p_impl->read_byte(byte); }
 
 ssize_t SerialPort::write_bytes(const std::uint8_t * data, size_t size) { return p_impl->write_bytes(data, size); }
+
+bool SerialPort::get_error_counters(ErrorCounters & counters) { return p_impl->get_error_counters(counters); }
@@ -0,0 +1,404 @@
+// SPDX-License-Identifier: GPL-2.0-only
+// Copyright 2025-2026 Jaroslav Rohel, jaroslav.rohel@gmail.com
+
+#include "shared_dir_cache.hpp"
+
+#include "logger.hpp"
+
+#ifndef _WIN32
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <atomic>
+#include <ctime>
+#include <format>
+#include <stdexcept>
+
+namespace netmount_srv {
+
+namespace {
+
+constexpr std::uint32_t SEGMENT_MAGIC = 0x43444D4E;  // "NMDC"
+constexpr std::uint32_t SEGMENT_VERSION = 2;
+constexpr std::uint32_t SLOT_COUNT = 1024;
+constexpr std::uint32_t SLOT_SIZE = 32 * 1024;
+constexpr std::uint32_t SLOT_WAYS = 4;  // a directory may be stored in any slot of its set of SLOT_WAYS slots
+
+// Serialized entry: fcb_name (11), attrs (1), size (4), time_date (4), name length (2), name
+constexpr std::uint32_t ENTRY_HEADER_SIZE = 22;
+
+struct SegmentHeader {
+    std::atomic<std::uint32_t> magic;  // written last by the creator of the segment
+    std::uint32_t version;
+    std::uint32_t slot_count;
+    std::uint32_t slot_size;
+    std::uint8_t reserved[48];
+};
+
+struct SlotHeader {
+    std::atomic<std::uint32_t> sequence;  // odd while the slot is being written
+    std::uint32_t entry_count;
+    std::atomic<std::uint64_t> owner;     // writer holding the lock (process ID and lock number), 0 - unlocked
+    std::uint64_t dev;
+    std::uint64_t ino;
+    std::int64_t mtime_ns;
+    std::int64_t ctime_ns;
+    std::uint64_t settings;
+    std::int64_t stored_time;  // 0 - the slot is empty
+    std::uint32_t data_size;
+    std::uint32_t reserved;
+};
+
+static_assert(std::atomic<std::uint32_t>::is_always_lock_free && std::atomic<std::uint64_t>::is_always_lock_free);
+static_assert(sizeof(SegmentHeader) == 64 && sizeof(SlotHeader) == 72);
+
+constexpr std::size_t SEGMENT_SIZE = sizeof(SegmentHeader) + static_cast<std::size_t>(SLOT_COUNT) * SLOT_SIZE;
+constexpr std::uint32_t SLOT_DATA_SIZE = SLOT_SIZE - sizeof(SlotHeader);
+
+
+SlotHeader & get_slot(void * segment, std::uint32_t index) {
+    auto * const slots = static_cast<std::uint8_t *>(segment) + sizeof(SegmentHeader);
+    return *reinterpret_cast<SlotHeader *>(slots + static_cast<std::size_t>(index) * SLOT_SIZE);
+}
+
+
+std::uint8_t * get_slot_data(SlotHeader & slot) { return reinterpret_cast<std::uint8_t *>(&slot + 1); }
+
+
+// Returns the index of the first slot of the set for the directory `dev`, `ino`.
+std::uint32_t get_set_index(std::uint64_t dev, std::uint64_t ino) {
+    std::uint64_t hash = (dev * 0x9E3779B97F4A7C15ULL) ^ ino;
+    hash ^= hash >> 33;
+    hash *= 0xFF51AFD7ED558CCDULL;
+    hash ^= hash >> 33;
+    return static_cast<std::uint32_t>(hash % (SLOT_COUNT / SLOT_WAYS)) * SLOT_WAYS;
+}
+
+
+// Slot lock held by a writer.
+struct SlotLock {
+    std::uint64_t owner;     // value stored in `SlotHeader::owner`, 0 - the lock is not held
+    std::uint32_t sequence;  // locked (odd) sequence
+};
+
+
+// Returns a new owner value for a slot lock. The process ID identifies the writer for the takeover of its locks,
+// the lock number distinguishes the writers of one process (storage workers of the drives).
+std::uint64_t make_lock_owner() noexcept {
+    static std::atomic<std::uint32_t> lock_number{0};
+    return static_cast<std::uint64_t>(getpid()) << 32 | ++lock_number;
+}
+
+
+// Returns true if the process that holds the lock `owner` no longer exists. Its lock is then never released.
+bool is_lock_owner_dead(std::uint64_t owner) noexcept {
+    return kill(static_cast<pid_t>(owner >> 32), 0) == -1 && errno == ESRCH;
+}
+
+
+// Tries to lock the slot for writing. The lock of a writer that has exited (crashed while writing) is taken over.
+// Returns a lock with `owner` 0 if the slot is locked by another writer.
+SlotLock lock_slot(SlotHeader & slot) {
+    const auto owner = make_lock_owner();
+    auto current_owner = slot.owner.load(std::memory_order_relaxed);
+    if (current_owner != 0 && !is_lock_owner_dead(current_owner)) {
+        return {0, 0};
+    }
+    if (!slot.owner.compare_exchange_strong(current_owner, owner, std::memory_order_acquire)) {
+        return {0, 0};
+    }
+
+    // Only the owner changes the sequence, it only grows. The sequence of a slot whose writer exited while
+    // writing is odd, it is advanced so that the readers that saw it before the writer exited notice the change.
+    const auto sequence = slot.sequence.load(std::memory_order_relaxed);
+    const std::uint32_t locked_sequence = sequence + ((sequence & 1) ? 2 : 1);
+    slot.sequence.store(locked_sequence, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    return {owner, locked_sequence};
+}
+
+
+void unlock_slot(SlotHeader & slot, const SlotLock & lock) {
+    if (slot.owner.load(std::memory_order_relaxed) != lock.owner) {
+        // must not happen, the lock of a running writer is not taken over
+        log(LogLevel::ERROR, "SharedDirectoryCache: Slot lock was taken over, the slot is left locked\n");
+        return;
+    }
+    slot.sequence.store(lock.sequence + 1, std::memory_order_release);
+    slot.owner.store(0, std::memory_order_release);
+}
+
+
+bool is_key_equal(const SlotHeader & slot, const SharedDirectoryCache::Key & key) {
+    return slot.dev == key.dev && slot.ino == key.ino && slot.mtime_ns == key.mtime_ns &&
+           slot.ctime_ns == key.ctime_ns && slot.settings == key.settings;
+}
+
+}  // namespace
+
+
+#ifdef _WIN32
+
+SharedDirectoryCache::SharedDirectoryCache(const std::string & name, std::uint32_t max_age)
+    : name(name), max_age(max_age) {
+    throw std::runtime_error("Shared directory cache is not supported on this platform");
+}
+
+
+SharedDirectoryCache::~SharedDirectoryCache() = default;
+
+
+bool SharedDirectoryCache::find(const Key &, std::vector<DosFileProperties> &) { return false; }
+
+
+void SharedDirectoryCache::store(const Key &, const std::vector<DosFileProperties> &) {}
+
+
+void SharedDirectoryCache::invalidate(std::uint64_t, std::uint64_t) {}
+
+#else
+
+SharedDirectoryCache::SharedDirectoryCache(const std::string & name, std::uint32_t max_age)
+    : name(name.starts_with('/') ? name : '/' + name), max_age(max_age) {
+    bool created = true;
+    int fd = shm_open(this->name.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+    if (fd == -1 && errno == EEXIST) {
+        created = false;
+        fd = shm_open(this->name.c_str(), O_RDWR | O_CLOEXEC, 0);
+    }
+    if (fd == -1) {
+        throw std::runtime_error(
+            std::format("Cannot open shared memory segment \"{}\": {}", this->name, strerror(errno)));
+    }
+
+    if (created) {
+        if (ftruncate(fd, SEGMENT_SIZE) == -1) {
+            const auto orig_errno = errno;
+            close(fd);
+            shm_unlink(this->name.c_str());
+            throw std::runtime_error(
+                std::format("Cannot resize shared memory segment \"{}\": {}", this->name, strerror(orig_errno)));
+        }
+    } else {
+        // The segment may be just being created by another instance, wait for it to be resized.
+        for (int i = 0;; ++i) {
+            struct stat st;
+            if (fstat(fd, &st) == -1) {
+                const auto orig_errno = errno;
+                close(fd);
+                throw std::runtime_error(
+                    std::format("Cannot stat shared memory segment \"{}\": {}", this->name, strerror(orig_errno)));
+            }
+            if (static_cast<std::size_t>(st.st_size) == SEGMENT_SIZE) {
+                break;
+            }
+            if (i == 100 || st.st_size > 0) {
+                close(fd);
+                throw std::runtime_error(
+                    std::format("Shared memory segment \"{}\" has unexpected size {}", this->name, st.st_size));
+            }
+            usleep(10000);
+        }
+    }
+
+    segment = mmap(nullptr, SEGMENT_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    const auto orig_errno = errno;
+    close(fd);
+    if (segment == MAP_FAILED) {
+        segment = nullptr;
+        throw std::runtime_error(
+            std::format("Cannot map shared memory segment \"{}\": {}", this->name, strerror(orig_errno)));
+    }
+
+    // A newly created segment is zero-filled, which means all slots are empty and unlocked.
+    auto & header = *static_cast<SegmentHeader *>(segment);
+    if (created) {
+        header.version = SEGMENT_VERSION;
+        header.slot_count = SLOT_COUNT;
+        header.slot_size = SLOT_SIZE;
+        header.magic.store(SEGMENT_MAGIC, std::memory_order_release);
+    } else {
+        for (int i = 0; header.magic.load(std::memory_order_acquire) != SEGMENT_MAGIC; ++i) {
+            if (i == 100) {
+                munmap(segment, SEGMENT_SIZE);
+                segment = nullptr;
+                throw std::runtime_error(std::format("Shared memory segment \"{}\" is not initialized", this->name));
+            }
+            usleep(10000);
+        }
+        if (header.version != SEGMENT_VERSION || header.slot_count != SLOT_COUNT || header.slot_size != SLOT_SIZE) {
+            munmap(segment, SEGMENT_SIZE);
+            segment = nullptr;
+            throw std::runtime_error(
+                std::format("Shared memory segment \"{}\" was created by an incompatible version", this->name));
+        }
+    }
+
+    log(LogLevel::INFO,
+        "SharedDirectoryCache: {} shared memory segment \"{}\"\n",
+        created ? "Created" : "Attached to",
+        this->name);
+}
+
+
+SharedDirectoryCache::~SharedDirectoryCache() {
+    // The segment is not unlinked, other instances may use it.
+    if (segment) {
+        munmap(segment, SEGMENT_SIZE);
+    }
+}
+
+
+bool SharedDirectoryCache::find(const Key & key, std::vector<DosFileProperties> & directory_list) {
+    const std::int64_t now = std::time(nullptr);
+    const auto set_index = get_set_index(key.dev, key.ino);
+    for (std::uint32_t way = 0; way < SLOT_WAYS; ++way) {
+        auto & slot = get_slot(segment, set_index + way);
+
+        const auto sequence = slot.sequence.load(std::memory_order_acquire);
+        if (sequence & 1) {
+            continue;
+        }
+        if (slot.stored_time == 0 || !is_key_equal(slot, key) || now - slot.stored_time > max_age) {
+            continue;
+        }
+        const auto entry_count = slot.entry_count;
+        const auto data_size = slot.data_size;
+        // A torn read or a corrupted segment must not cause a huge allocation.
+        if (data_size > SLOT_DATA_SIZE || entry_count > data_size / ENTRY_HEADER_SIZE) {
+            continue;
+        }
+
+        // Parse the entries. The slot may be changed by a writer meanwhile, the result is then discarded.
+        // Therefore, all offsets are checked against the slot size.
+        const auto * const data = get_slot_data(slot);
+        directory_list.resize(entry_count);
+        std::uint32_t offset = 0;
+        bool valid = true;
+        for (auto & entry : directory_list) {
+            if (offset + ENTRY_HEADER_SIZE > data_size) {
+                valid = false;
+                break;
+            }
+            std::uint16_t name_len;
+            memcpy(&entry.fcb_name, data + offset, 11);
+            entry.attrs = data[offset + 11];
+            memcpy(&entry.size, data + offset + 12, 4);
+            memcpy(&entry.time_date, data + offset + 16, 4);
+            memcpy(&name_len, data + offset + 20, 2);
+            offset += ENTRY_HEADER_SIZE;
+            if (offset + name_len > data_size) {
+                valid = false;
+                break;
+            }
+            entry.server_name = std::string(reinterpret_cast<const char *>(data + offset), name_len);
+            offset += name_len;
+        }
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (!valid || slot.sequence.load(std::memory_order_relaxed) != sequence) {
+            // raced with a writer
+            break;
+        }
+        ++hits;
+        return true;
+    }
+
+    ++misses;
+    return false;
+}
+
+
+void SharedDirectoryCache::store(const Key & key, const std::vector<DosFileProperties> & directory_list) {
+    std::uint32_t data_size = 0;
+    for (const auto & entry : directory_list) {
+        data_size += ENTRY_HEADER_SIZE + entry.server_name.native().size();
+        if (data_size > SLOT_DATA_SIZE) {
+            log(LogLevel::DEBUG, "SharedDirectoryCache: Directory listing is too large to be shared\n");
+            return;
+        }
+    }
+
+    // Use the slot with the same directory, or an empty slot, or the oldest slot of the set.
+    const std::int64_t now = std::time(nullptr);
+    const auto set_index = get_set_index(key.dev, key.ino);
+    std::uint32_t slot_index = set_index;
+    for (std::uint32_t way = 0; way < SLOT_WAYS; ++way) {
+        const auto & slot = get_slot(segment, set_index + way);
+        if (slot.dev == key.dev && slot.ino == key.ino) {
+            slot_index = set_index + way;
+            break;
+        }
+        if (slot.stored_time < get_slot(segment, slot_index).stored_time) {
+            slot_index = set_index + way;
+        }
+    }
+
+    auto & slot = get_slot(segment, slot_index);
+    const auto lock = lock_slot(slot);
+    if (lock.owner == 0) {
+        // another instance is writing the slot
+        return;
+    }
+
+    auto * const data = get_slot_data(slot);
+    std::uint32_t offset = 0;
+    for (const auto & entry : directory_list) {
+        const auto & name = entry.server_name.native();
+        const auto name_len = static_cast<std::uint16_t>(name.size());
+        const auto attrs = static_cast<std::uint8_t>(entry.attrs);
+        memcpy(data + offset, &entry.fcb_name, 11);
+        data[offset + 11] = attrs;
+        memcpy(data + offset + 12, &entry.size, 4);
+        memcpy(data + offset + 16, &entry.time_date, 4);
+        memcpy(data + offset + 20, &name_len, 2);
+        memcpy(data + offset + ENTRY_HEADER_SIZE, name.data(), name_len);
+        offset += ENTRY_HEADER_SIZE + name_len;
+    }
+    slot.entry_count = directory_list.size();
+    slot.data_size = data_size;
+    slot.dev = key.dev;
+    slot.ino = key.ino;
+    slot.mtime_ns = key.mtime_ns;
+    slot.ctime_ns = key.ctime_ns;
+    slot.settings = key.settings;
+    slot.stored_time = now;
+
+    unlock_slot(slot, lock);
+}
+
+
+void SharedDirectoryCache::invalidate(std::uint64_t dev, std::uint64_t ino) {
+    const auto set_index = get_set_index(dev, ino);
+    for (std::uint32_t way = 0; way < SLOT_WAYS; ++way) {
+        auto & slot = get_slot(segment, set_index + way);
+        // A writer holds the lock only while copying a listing, wait for it. The listing must not stay valid
+        // for the other instances, the wait is not abandoned. The lock of an exited writer is taken over.
+        SlotLock lock;
+        for (int i = 0; (lock = lock_slot(slot)).owner == 0; ++i) {
+            if (i < 1000) {
+                sched_yield();
+                continue;
+            }
+            if (i == 1000) {
+                log(LogLevel::WARNING, "SharedDirectoryCache: Waiting for the writer of slot {}\n", set_index + way);
+            }
+            usleep(1000);
+        }
+        if (slot.dev == dev && slot.ino == ino) {
+            slot.stored_time = 0;
+        }
+        unlock_slot(slot, lock);
+    }
+}
+
+#endif
+
+}  // namespace netmount_srv
@@ -0,0 +1,74 @@
+// SPDX-License-Identifier: GPL-2.0-only
+// Copyright 2025-2026 Jaroslav Rohel, jaroslav.rohel@gmail.com
+
+// Directory listings shared between server instances running on the same host.
+
+#ifndef _SHARED_DIR_CACHE_HPP_
+#define _SHARED_DIR_CACHE_HPP_
+
+#include "fs.hpp"
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace netmount_srv {
+
+// Cache of directory listings (server names, 8.3 aliases, sizes, timestamps and attributes) in a named
+// POSIX shared memory segment. All instances that attach to the same segment share the listings, so
+// a directory scanned by one instance is not scanned again by the others.
+// The segment is divided into fixed-size slots. Each slot is protected by a sequence lock. Readers never
+// block and never write to the segment, a reader that races with a writer treats the slot as a miss.
+// A writer locks a slot by storing its process ID in the slot. The lock of a writer that has exited is taken
+// over by the next writer.
+// A listing is keyed by the device and inode of the directory and is valid only while the modification
+// and change times of the directory are unchanged and the listing is not older than `max_age` seconds.
+// Changes of files inside the directory do not change the directory times, the instances therefore
+// invalidate the listing when they modify the directory content. Changes made by other programs
+// are visible after at most `max_age` seconds.
+// Not supported on Windows.
+class SharedDirectoryCache {
+public:
+    struct Key {
+        std::uint64_t dev;       // device of the directory
+        std::uint64_t ino;       // inode of the directory
+        std::int64_t mtime_ns;   // modification time of the directory
+        std::int64_t ctime_ns;   // status change time of the directory
+        std::uint64_t settings;  // hash of the drive settings that affect the listing
+    };
+
+    // Attaches to the shared memory segment `name`, the segment is created if it does not exist.
+    // Throws exception on error.
+    SharedDirectoryCache(const std::string & name, std::uint32_t max_age);
+    ~SharedDirectoryCache();
+
+    SharedDirectoryCache(const SharedDirectoryCache &) = delete;
+    SharedDirectoryCache & operator=(const SharedDirectoryCache &) = delete;
+
+    // Fills `directory_list` with the cached listing for `key`.
+    // Returns false if the listing is not cached, `directory_list` is undefined then.
+    bool find(const Key & key, std::vector<DosFileProperties> & directory_list);
+
+    // Stores the listing for `key`. Listings that do not fit into a slot are not stored.
+    void store(const Key & key, const std::vector<DosFileProperties> & directory_list);
+
+    // Removes the listing of the directory `dev`, `ino`.
+    void invalidate(std::uint64_t dev, std::uint64_t ino);
+
+    // Returns the number of lookups served from the segment and the number of misses.
+    std::pair<std::uint64_t, std::uint64_t> get_hits_misses() const noexcept { return {hits.load(), misses.load()}; }
+
+private:
+    std::string name;
+    std::uint32_t max_age;
+    void * segment{nullptr};
+    // updated concurrently by the storage workers of the drives
+    std::atomic<std::uint64_t> hits{0};
+    std::atomic<std::uint64_t> misses{0};
+};
+
+}  // namespace netmount_srv
+
+#endif
@@ -6,8 +6,11 @@
 #include "logger.hpp"
 #include "utils.hpp"
 
+#include <algorithm>
+#include <cmath>
 #include <cstring>
 #include <format>
+#include <iterator>
 #include <stdexcept>
 
 namespace {
@@ -21,6 +24,15 @@ constexpr uint8_t SLIP_ESC_ESC = 0xDD;
 
 constexpr uint8_t IPV4_PROTOCOL_UDP = 17;
 
+// A byte on the line takes 10 bits: start bit, 8 data bits, stop bit.
+constexpr unsigned BITS_PER_BYTE = 10;
+
+// The error rate is not estimated from fewer received frames.
+constexpr uint64_t MIN_FRAMES_FOR_RECOMMENDATION = 100;
+
+// Baud rates supported by SerialPort.
+constexpr uint32_t BAUDRATES[] = {1200, 2400, 4800, 9600, 19200, 38400, 57600, 115200, 230400};
+
 // structs are packed
 #pragma pack(push, 1)
 
@@ -146,9 +158,24 @@ size_t encode_slip(
     return tx_len;
 }
 
+
+// Returns the expected UDP payload bytes per second of a link sending frames of `mtu` bytes back to back.
+// Each bit is assumed to be corrupted independently with probability `bit_error_rate`, a corrupted frame is lost.
+double expected_goodput(double baudrate, double bit_error_rate, double escape_ratio, unsigned mtu) {
+    const double wire_bytes = mtu * (1 + escape_ratio) + 2;  // escaped frame with two SLIP_END
+    const double frame_ok_probability = std::pow(1 - bit_error_rate, BITS_PER_BYTE * wire_bytes);
+    return baudrate / BITS_PER_BYTE * (mtu - sizeof(net_headers)) * frame_ok_probability / wire_bytes;
+}
+
 }  // namespace
 
 
+std::uint64_t SlipUdpSerial::Statistics::rx_corrupted_frames() const noexcept {
+    return rx_oversized_frames + rx_bad_escapes + rx_timeouts + rx_header_errors + rx_checksum_errors +
+           rx_length_errors + rx_payload_errors;
+}
+
+
 SlipUdpSerial::SlipUdpSerial(const std::string & device) : serial{device} {
     rx_buffer.resize(MTU);
     tx_buffer.resize(MTU * 2);
@@ -157,7 +184,12 @@ SlipUdpSerial::SlipUdpSerial(const std::string & device) : serial{device} {
 SlipUdpSerial::~SlipUdpSerial() = default;
 
 
-void SlipUdpSerial::setup(unsigned int baudrate, bool hw_flow_control) { serial.setup(baudrate, hw_flow_control); }
+void SlipUdpSerial::setup(unsigned int baudrate, bool hw_flow_control) {
+    serial.setup(baudrate, hw_flow_control);
+    this->baudrate = baudrate;
+    statistics = {};
+    statistics.port_errors_valid = serial.get_error_counters(port_errors_at_setup);
+}
 
 
 void SlipUdpSerial::send(
@@ -181,6 +213,14 @@ void SlipUdpSerial::send(
     if (written != static_cast<int>(tx_buffer_length)) {
         throw std::runtime_error("SlipUdpSerial::send: Sent a different number of bytes than requested");
     }
+
+    const auto packet_length = static_cast<std::uint16_t>(sizeof(headers) + length);
+    ++statistics.tx_frames;
+    statistics.tx_wire_bytes += tx_buffer_length;
+    statistics.tx_escapes += tx_buffer_length - 2 - packet_length;  // each escape adds one byte
+    statistics.tx_packet_bytes += packet_length;
+    statistics.tx_payload_bytes += length;
+    statistics.tx_max_packet_bytes = std::max(statistics.tx_max_packet_bytes, packet_length);
 }
 
 
@@ -214,17 +254,111 @@ const std::string & SlipUdpSerial::get_last_dst_ip_str() const { return last_dst
 std::uint16_t SlipUdpSerial::get_last_dst_port() const { return last_dst_port; }
 
 
+void SlipUdpSerial::report_payload_error() noexcept {
+    ++statistics.rx_payload_errors;
+    --statistics.rx_good_frames;
+    statistics.rx_payload_bytes -= last_udp_data_len;
+}
+
+
+SlipUdpSerial::Statistics SlipUdpSerial::get_statistics() {
+    auto ret = statistics;
+    SerialPort::ErrorCounters counters;
+    if (ret.port_errors_valid && serial.get_error_counters(counters)) {
+        ret.port_errors.overruns = counters.overruns - port_errors_at_setup.overruns;
+        ret.port_errors.frame_errors = counters.frame_errors - port_errors_at_setup.frame_errors;
+        ret.port_errors.parity_errors = counters.parity_errors - port_errors_at_setup.parity_errors;
+        ret.port_errors.buffer_overruns = counters.buffer_overruns - port_errors_at_setup.buffer_overruns;
+    } else {
+        ret.port_errors_valid = false;
+    }
+    return ret;
+}
+
+
+SlipUdpSerial::Recommendation SlipUdpSerial::get_recommendation() {
+    const auto stats = get_statistics();
+    Recommendation ret;
+
+    const auto packet_bytes = stats.rx_packet_bytes + stats.tx_packet_bytes;
+    if (packet_bytes > 0) {
+        ret.escape_ratio = static_cast<double>(stats.rx_escapes + stats.tx_escapes) / packet_bytes;
+    }
+    // The server replies fill the client MTU, the biggest sent frame is the best available estimate.
+    ret.current_mtu = stats.tx_max_packet_bytes >= MIN_CLIENT_MTU ? stats.tx_max_packet_bytes : MAX_CLIENT_MTU;
+    ret.mtu = ret.current_mtu;
+    ret.current_baudrate = baudrate;
+    ret.baudrate = baudrate;
+    if (stats.rx_frames < MIN_FRAMES_FOR_RECOMMENDATION || baudrate == 0) {
+        return ret;
+    }
+    ret.valid = true;
+
+    // A frame is received correctly if none of its bits is corrupted:
+    // frame_error_rate = 1 - (1 - bit_error_rate) ^ frame_bits
+    const auto corrupted_frames = stats.rx_corrupted_frames();
+    ret.frame_error_rate = static_cast<double>(corrupted_frames) / stats.rx_frames;
+    const double avg_frame_bits =
+        static_cast<double>(BITS_PER_BYTE) * (stats.rx_wire_bytes - stats.rx_ignored_bytes) / stats.rx_frames;
+    ret.bit_error_rate = 1 - std::pow(1 - ret.frame_error_rate, 1 / avg_frame_bits);
+
+    // Bigger frames have less header overhead but a higher probability of being corrupted.
+    ret.goodput = expected_goodput(baudrate, ret.bit_error_rate, ret.escape_ratio, ret.current_mtu);
+    for (unsigned mtu = MIN_CLIENT_MTU; mtu <= MAX_CLIENT_MTU; ++mtu) {
+        const auto goodput = expected_goodput(baudrate, ret.bit_error_rate, ret.escape_ratio, mtu);
+        if (goodput > ret.mtu_goodput) {
+            ret.mtu = mtu;
+            ret.mtu_goodput = goodput;
+        }
+    }
+    ret.baudrate_goodput = ret.mtu_goodput;
+
+    // The errors are usually caused by the baud rate being too high for the line. The next lower rate is
+    // assumed to be error-free, it is recommended if it is expected to transfer more than the current one.
+    // Without any errors, the next higher rate may be tried.
+    const bool port_errors = stats.port_errors_valid &&
+                             (stats.port_errors.overruns > 0 || stats.port_errors.frame_errors > 0 ||
+                              stats.port_errors.parity_errors > 0 || stats.port_errors.buffer_overruns > 0);
+    if (corrupted_frames > 0) {
+        for (auto it = std::rbegin(BAUDRATES); it != std::rend(BAUDRATES); ++it) {
+            if (*it < baudrate) {
+                const auto goodput = expected_goodput(*it, 0, ret.escape_ratio, MAX_CLIENT_MTU);
+                if (goodput > ret.baudrate_goodput) {
+                    ret.baudrate = *it;
+                    ret.baudrate_goodput = goodput;
+                }
+                break;
+            }
+        }
+    } else if (!port_errors) {
+        for (const auto rate : BAUDRATES) {
+            if (rate > baudrate) {
+                ret.baudrate = rate;
+                ret.baudrate_goodput = expected_goodput(rate, 0, ret.escape_ratio, MAX_CLIENT_MTU);
+                ret.try_higher_baudrate = true;
+                break;
+            }
+        }
+    }
+    return ret;
+}
+
+
 uint16_t SlipUdpSerial::recv_decode_slip() {
     uint16_t len = 0;
 
     bool started = false;
+    bool completed = false;
+    bool bad_escape = false;
     uint8_t rcv_byte;
     while (serial.read_byte(rcv_byte) == 1) {
+        ++statistics.rx_wire_bytes;
         if (rcv_byte == SLIP_END) {
             log(LogLevel::DEBUG,
                 "SlipUdpSerial::recv_decode_slip: recv_decode_slip: Receive SLIP_END: len = {}\n",
                 len);
             if (started && len > 0) {
+                completed = true;
                 break;
             } else {
                 started = true;
@@ -233,12 +367,15 @@ uint16_t SlipUdpSerial::recv_decode_slip() {
         }
 
         if (!started) {
+            ++statistics.rx_ignored_bytes;
             log(LogLevel::DEBUG,
                 "SlipUdpSerial::recv_decode_slip: Received character ignored, waiting for SLIP_END character\n");
             continue;
         }
 
         if (len == rx_buffer.size()) {
+            ++statistics.rx_frames;
+            ++statistics.rx_oversized_frames;
             log(LogLevel::WARNING,
                 "SlipUdpSerial::recv_decode_slip: Received data length bigger than buffer size (MTU = {})\n",
                 MTU);
@@ -250,22 +387,46 @@ uint16_t SlipUdpSerial::recv_decode_slip() {
             if (serial.read_byte(rcv_byte) != 1) {
                 break;
             }
+            ++statistics.rx_wire_bytes;
+            ++statistics.rx_escapes;
             if (rcv_byte == SLIP_ESC_END) {
                 rx_buffer[len++] = SLIP_END;
             } else if (rcv_byte == SLIP_ESC_ESC) {
                 rx_buffer[len++] = SLIP_ESC;
+            } else {
+                bad_escape = true;
             }
         } else {
             rx_buffer[len++] = rcv_byte;
         }
     }
 
+    if (!completed) {
+        if (len > 0) {
+            ++statistics.rx_frames;
+            ++statistics.rx_timeouts;
+            log(LogLevel::WARNING,
+                "SlipUdpSerial::recv_decode_slip: Timeout, incomplete frame of {} bytes discarded\n",
+                len);
+        }
+        return 0;
+    }
+
+    ++statistics.rx_frames;
+    statistics.rx_packet_bytes += len;
+    if (bad_escape) {
+        ++statistics.rx_bad_escapes;
+        log(LogLevel::WARNING, "SlipUdpSerial::recv_decode_slip: Invalid escape sequence, frame discarded\n");
+        return 0;
+    }
+
     return len;
 }
 
 
 std::uint16_t SlipUdpSerial::parse_udp_packet(std::uint16_t rx_packet_len) {
     if (rx_packet_len < sizeof(net_headers)) {
+        ++statistics.rx_header_errors;
         log(LogLevel::INFO, "SlipUdpSerial::parse_udp_packet: Short datagram received\n");
         return 0;
     }
@@ -273,10 +434,12 @@ std::uint16_t SlipUdpSerial::parse_udp_packet(std::uint16_t rx_packet_len) {
     auto * headers = reinterpret_cast<const net_headers *>(rx_buffer.data());
 
     if ((headers->ipv4.version_ihl & 0xF0) != (4 << 4)) {
+        ++statistics.rx_header_errors;
         log(LogLevel::INFO, "SlipUdpSerial::parse_udp_packet: Received datagram is not a IPv4 packet\n");
         return 0;
     }
     if ((headers->ipv4.version_ihl & 0x0F) != (sizeof(ipv4_hdr) / 4)) {
+        ++statistics.rx_header_errors;
         log(LogLevel::WARNING,
             "SlipUdpSerial::parse_udp_packet: Received datagram has unsupported IPv4 header length\n");
         return 0;
@@ -284,17 +447,20 @@ std::uint16_t SlipUdpSerial::parse_udp_packet(std::uint16_t rx_packet_len) {
 
     // The IP header checksum is mandatory. It must always be sent.
     if (internet_checksum(&headers->ipv4, sizeof(ipv4_hdr)) != 0) {
+        ++statistics.rx_checksum_errors;
         log(LogLevel::WARNING,
             "SlipUdpSerial::parse_udp_packet: Received datagram has an invalid IPv4 header checksum\n");
         return 0;
     }
 
     if (headers->ipv4.protocol != IPV4_PROTOCOL_UDP) {
+        ++statistics.rx_other_frames;
         log(LogLevel::INFO, "SlipUdpSerial::parse_udp_packet: Received datagram is not a UDP packet\n");
         return 0;
     }
 
     if (rx_packet_len < from_big16(headers->ipv4.total_len)) {
+        ++statistics.rx_length_errors;
         log(LogLevel::WARNING,
             "SlipUdpSerial::parse_udp_packet: Corrupted datagram received, length shorter than ipv4.total_len\n");
         return 0;
@@ -309,11 +475,13 @@ std::uint16_t SlipUdpSerial::parse_udp_packet(std::uint16_t rx_packet_len) {
     // headers->udp.checksum is ignored
 
     if (udp_len < sizeof(udp_hdr)) {
+        ++statistics.rx_length_errors;
         log(LogLevel::WARNING, "SlipUdpSerial::parse_udp_packet: Corrupted datagram received, short udp.length\n");
         return 0;
     }
 
     if (rx_packet_len < sizeof(ipv4_hdr) + udp_len) {
+        ++statistics.rx_length_errors;
         log(LogLevel::WARNING,
             "SlipUdpSerial::parse_udp_packet: Corrupted datagram received, length shorter than udp.length plus IPv4 "
             "header length\n");
@@ -329,5 +497,7 @@ std::uint16_t SlipUdpSerial::parse_udp_packet(std::uint16_t rx_packet_len) {
     const std::uint16_t data_len = udp_len - sizeof(udp_hdr);
     last_rx_udp_data = rx_buffer.data() + sizeof(net_headers);
     last_udp_data_len = data_len;
+    ++statistics.rx_good_frames;
+    statistics.rx_payload_bytes += data_len;
     return data_len;
 }
@@ -14,6 +14,56 @@
 
 class SlipUdpSerial {
 public:
+    // Link accounting since `setup`.
+    struct Statistics {
+        std::uint64_t rx_wire_bytes{0};         // bytes read from the serial port
+        std::uint64_t rx_ignored_bytes{0};      // bytes outside of frames (line noise, lost SLIP_END)
+        std::uint64_t rx_escapes{0};            // escape sequences in the received frames
+        std::uint64_t rx_frames{0};             // received frames including the corrupted ones
+        std::uint64_t rx_packet_bytes{0};       // decoded size of the received frames
+        std::uint64_t rx_good_frames{0};        // frames delivered to the application and not rejected by it
+        std::uint64_t rx_payload_bytes{0};      // UDP payload of `rx_good_frames`
+        std::uint64_t rx_oversized_frames{0};   // frames bigger than MTU (usually a lost SLIP_END)
+        std::uint64_t rx_bad_escapes{0};        // frames with an invalid escape sequence
+        std::uint64_t rx_timeouts{0};           // frames not completed within the serial port timeout
+        std::uint64_t rx_header_errors{0};      // frames with a short or invalid IPv4 header
+        std::uint64_t rx_checksum_errors{0};    // frames with a bad IPv4 header checksum
+        std::uint64_t rx_length_errors{0};      // frames whose length does not match the IPv4 or UDP length
+        std::uint64_t rx_other_frames{0};       // valid IPv4 frames that are not UDP
+        std::uint64_t rx_payload_errors{0};     // frames rejected by the application, see `report_payload_error`
+        std::uint64_t tx_wire_bytes{0};         // bytes written to the serial port
+        std::uint64_t tx_escapes{0};            // escape sequences in the sent frames
+        std::uint64_t tx_frames{0};             // sent frames
+        std::uint64_t tx_packet_bytes{0};       // size of the sent frames before encoding
+        std::uint64_t tx_payload_bytes{0};      // UDP payload of the sent frames
+        std::uint16_t tx_max_packet_bytes{0};   // size of the biggest sent frame before encoding
+        bool port_errors_valid{false};          // the serial port driver provides the counters below
+        SerialPort::ErrorCounters port_errors;  // receive errors counted by the serial port driver
+
+        // Returns the number of received frames that were dropped because they were corrupted.
+        std::uint64_t rx_corrupted_frames() const noexcept;
+    };
+
+    // Link settings that maximize the goodput for the observed error rate.
+    struct Recommendation {
+        bool valid{false};                  // false if too few frames were received to estimate the error rate
+        double frame_error_rate{0};         // ratio of the corrupted frames to the received frames
+        double bit_error_rate{0};           // estimated from `frame_error_rate` and the average frame size
+        double escape_ratio{0};             // escape sequences per byte of the frames
+        std::uint32_t current_baudrate{0};  // baud rate of the serial port
+        std::uint16_t current_mtu{0};       // the client MTU, estimated from the biggest sent frame
+        double goodput{0};                  // expected UDP payload bytes per second at the current settings
+        std::uint16_t mtu{0};               // MTU with the highest expected goodput
+        double mtu_goodput{0};              // expected goodput with `mtu`
+        std::uint32_t baudrate{0};          // recommended baud rate, the current one if no change is suggested
+        double baudrate_goodput{0};         // expected goodput with `baudrate` if error-free
+        bool try_higher_baudrate{false};    // no errors were observed, `baudrate` is a higher rate worth trying
+    };
+
+    // The MTU range of the client, see /MTU in the client documentation.
+    constexpr static std::uint16_t MIN_CLIENT_MTU = 560;
+    constexpr static std::uint16_t MAX_CLIENT_MTU = 1500;
+
     SlipUdpSerial(const std::string & device);
     ~SlipUdpSerial();
 
@@ -42,6 +92,15 @@ public:
     const std::string & get_last_dst_ip_str() const;
     std::uint16_t get_last_dst_port() const;
 
+    // Counts the last received frame as corrupted. Called by the application when the frame passed
+    // the IPv4 and UDP checks but its payload was rejected (e.g. a bad NetMount checksum).
+    void report_payload_error() noexcept;
+
+    Statistics get_statistics();
+
+    // Returns the recommended link settings for the observed error rate.
+    Recommendation get_recommendation();
+
 private:
     SerialPort serial;
     std::vector<std::uint8_t> rx_buffer;
@@ -61,6 +120,10 @@ private:
 
     std::uint16_t last_sent_packet_id{0};
 
+    unsigned int baudrate{0};
+    Statistics statistics;
+    SerialPort::ErrorCounters port_errors_at_setup;
+
     std::uint16_t recv_decode_slip();
     std::uint16_t parse_udp_packet(std::uint16_t rx_packet_len);
 };
@@ -0,0 +1,144 @@
+// SPDX-License-Identifier: GPL-2.0-only
+// Copyright 2025-2026 Jaroslav Rohel, jaroslav.rohel@gmail.com
+
+#include "storage_watchdog.hpp"
+
+#include "logger.hpp"
+#include "utils.hpp"
+
+#include <algorithm>
+#include <utility>
+
+namespace netmount_srv {
+
+namespace {
+
+thread_local bool in_worker_thread = false;
+
+
+std::uint64_t elapsed_ms(std::chrono::steady_clock::time_point since) noexcept {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - since).count();
+}
+
+}  // namespace
+
+
+StorageWatchdog::StorageWatchdog(std::string name, std::mutex & state_mutex, std::chrono::milliseconds timeout)
+    : name(std::move(name)), state_mutex(state_mutex), timeout(timeout) {
+    const TerminationSignalsBlocker signals_blocker;
+    worker = std::thread(&StorageWatchdog::worker_loop, this);
+}
+
+
+StorageWatchdog::~StorageWatchdog() {
+    bool blocked;
+    {
+        std::lock_guard lock(mutex);
+        stop = true;
+        blocked = running;
+    }
+    cv.notify_all();
+    if (blocked) {
+        worker.detach();
+    } else {
+        worker.join();
+    }
+}
+
+
+bool StorageWatchdog::run(std::function<void()> operation, std::unique_lock<std::mutex> & state_lock) {
+    std::unique_lock lock(mutex);
+    if (running) {
+        return false;
+    }
+    this->operation = std::move(operation);
+    running = true;
+    start_time = std::chrono::steady_clock::now();
+    ++statistics.operations;
+    cv.notify_all();
+
+    state_lock.unlock();
+    const bool finished = cv.wait_for(lock, timeout, [this] { return !running; });
+    if (!finished) {
+        degraded = true;
+        ++statistics.timeouts;
+        log(LogLevel::ERROR,
+            "{}: {}: Storage operation has not finished in {} ms, the drive is degraded\n",
+            __func__,
+            name,
+            timeout.count());
+    }
+    const auto operation_exception = std::exchange(exception, nullptr);
+    lock.unlock();
+    state_lock.lock();
+
+    if (operation_exception) {
+        std::rethrow_exception(operation_exception);
+    }
+    return finished;
+}
+
+
+bool StorageWatchdog::is_degraded() const {
+    std::lock_guard lock(mutex);
+    return degraded;
+}
+
+
+std::chrono::milliseconds StorageWatchdog::get_in_flight_time() const {
+    std::lock_guard lock(mutex);
+    return running ? std::chrono::milliseconds(elapsed_ms(start_time)) : std::chrono::milliseconds(0);
+}
+
+
+StorageWatchdog::Statistics StorageWatchdog::get_statistics() const {
+    std::lock_guard lock(mutex);
+    return statistics;
+}
+
+
+bool StorageWatchdog::is_worker_thread() noexcept { return in_worker_thread; }
+
+
+void StorageWatchdog::worker_loop() {
+    in_worker_thread = true;
+    std::unique_lock lock(mutex);
+    while (true) {
+        cv.wait(lock, [this] { return stop || operation; });
+        if (stop) {
+            return;
+        }
+        auto current_operation = std::exchange(operation, nullptr);
+        lock.unlock();
+
+        std::exception_ptr operation_exception;
+        try {
+            current_operation();
+        } catch (...) {
+            operation_exception = std::current_exception();
+        }
+
+        // The operation may hold references to the shared state, it is released under the state mutex.
+        std::lock_guard state_lock(state_mutex);
+        current_operation = nullptr;
+        lock.lock();
+        const auto time_ms = elapsed_ms(start_time);
+        statistics.max_time_ms = std::max(statistics.max_time_ms, time_ms);
+        if (degraded) {
+            // nobody waits for the result
+            degraded = false;
+            statistics.degraded_time_ms += time_ms - std::min<std::uint64_t>(time_ms, timeout.count());
+            log(LogLevel::NOTICE,
+                "{}: {}: Storage responded after {} ms, the drive recovered\n",
+                __func__,
+                name,
+                time_ms);
+        } else {
+            exception = operation_exception;
+        }
+        running = false;
+        cv.notify_all();
+    }
+}
+
+}  // namespace netmount_srv
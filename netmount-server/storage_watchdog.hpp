@@ -0,0 +1,82 @@
+// SPDX-License-Identifier: GPL-2.0-only
+// Copyright 2025-2026 Jaroslav Rohel, jaroslav.rohel@gmail.com
+
+// Watchdog of the storage operations of a drive.
+
+#ifndef _STORAGE_WATCHDOG_HPP_
+#define _STORAGE_WATCHDOG_HPP_
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+
+namespace netmount_srv {
+
+// Runs the storage operations of a drive in a worker thread, the caller waits for an operation up to a timeout.
+// An operation that does not finish in time (e.g. a stat() on a hung network mount) is left running in the worker
+// and the drive is degraded: further operations are refused until the late one finishes, then the drive recovers.
+// The caller and the worker share the state guarded by `state_mutex`. The caller holds the mutex and releases it
+// while it waits for an operation. An operation must lock it before it touches the shared state (see
+// `is_worker_thread`), the worker locks it to release a finished operation.
+class StorageWatchdog {
+public:
+    struct Statistics {
+        std::uint64_t operations{0};        // operations started
+        std::uint64_t timeouts{0};          // operations that did not finish in time
+        std::uint64_t max_time_ms{0};       // the longest finished operation
+        std::uint64_t degraded_time_ms{0};  // total time the drive was degraded, without the current period
+    };
+
+    // `name` - used in the log messages, `timeout` - how long the caller waits for an operation
+    StorageWatchdog(std::string name, std::mutex & state_mutex, std::chrono::milliseconds timeout);
+
+    // The worker thread is left running if it is blocked in an operation.
+    ~StorageWatchdog();
+
+    StorageWatchdog(const StorageWatchdog &) = delete;
+    StorageWatchdog & operator=(const StorageWatchdog &) = delete;
+
+    // Runs `operation` in the worker thread. `state_lock` holds `state_mutex`, it is released while waiting.
+    // Returns true if the operation finished in time, an exception thrown by the operation is rethrown.
+    // Returns false if the operation did not finish in time, or it was not started because the drive is degraded.
+    bool run(std::function<void()> operation, std::unique_lock<std::mutex> & state_lock);
+
+    // Returns true while an operation that did not finish in time is running.
+    bool is_degraded() const;
+
+    // Returns how long the running operation has been running, 0 if no operation is running.
+    std::chrono::milliseconds get_in_flight_time() const;
+
+    Statistics get_statistics() const;
+
+    // Returns true if called from a worker thread of a watchdog.
+    static bool is_worker_thread() noexcept;
+
+private:
+    void worker_loop();
+
+    const std::string name;
+    std::mutex & state_mutex;
+    const std::chrono::milliseconds timeout;
+
+    mutable std::mutex mutex;         // guards the members below
+    std::condition_variable cv;       // signals a new operation to the worker and a finished one to the caller
+    std::function<void()> operation;  // the operation to be started by the worker
+    std::exception_ptr exception;     // exception thrown by the last operation the caller waited for
+    std::chrono::steady_clock::time_point start_time;
+    bool running{false};   // an operation is running
+    bool degraded{false};  // the running operation did not finish in time
+    bool stop{false};
+    Statistics statistics;
+
+    std::thread worker;
+};
+
+}  // namespace netmount_srv
+
+#endif
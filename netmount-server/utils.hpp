@@ -9,6 +9,10 @@
 #include <cstdio>
 #include <format>
 
+#ifndef _WIN32
+#include <signal.h>
+#endif
+
 // Enables packet loss simulation (for tests)
 //#define SIMULATE_PACKET_LOSS
 
@@ -108,4 +112,35 @@ inline std::uint32_t from_big32(std::uint32_t little_value) {
     return byte_swap32(little_value);
 }
 
+
+// Blocks the termination signals in the calling thread while the object exists, then restores the signal mask.
+// Threads started meanwhile inherit the blocked signals, the signals then always interrupt the main thread.
+class TerminationSignalsBlocker {
+public:
+    TerminationSignalsBlocker() noexcept {
+#ifndef _WIN32
+        sigset_t signals;
+        sigemptyset(&signals);
+        sigaddset(&signals, SIGTERM);
+        sigaddset(&signals, SIGQUIT);
+        sigaddset(&signals, SIGINT);
+        pthread_sigmask(SIG_BLOCK, &signals, &old_mask);
+#endif
+    }
+
+    ~TerminationSignalsBlocker() {
+#ifndef _WIN32
+        pthread_sigmask(SIG_SETMASK, &old_mask, nullptr);
+#endif
+    }
+
+    TerminationSignalsBlocker(const TerminationSignalsBlocker &) = delete;
+    TerminationSignalsBlocker & operator=(const TerminationSignalsBlocker &) = delete;
+
+private:
+#ifndef _WIN32
+    sigset_t old_mask;
+#endif
+};
+
 #endif
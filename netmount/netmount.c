@@ -1206,6 +1206,8 @@ static void handle_request_for_our_drive(void) {
                     &ax,
                     &flag_ext_features) != 0) {
                 set_error(r, DOS_EXTERR_FILE_NOT_FOUND);
+            } else if (ax != 0) {
+                set_error(r, ax);  // e.g. DOS_EXTERR_LOCK_VIOLATION
             }
         } break;
 
@@ -72,6 +72,13 @@ struct drive_proto_lockf {
 };
 
 
+// Followed drive_proto_lockf, params_count times
+struct drive_proto_lockf_param {
+    uint32_t offset;
+    uint32_t length;
+};
+
+
 struct drive_proto_disk_info_reply {
     uint16_t total_clusters;
     uint16_t bytes_per_sector;
@@ -161,6 +168,21 @@ struct drive_proto_netmount_feature {
     uint16_t feature_id;
 };
 
+// Feature IDs for INT2F_NETMOUNT_FEATURE_QUERY
+// The server replies AX = 1 if it supports the feature, AX = 0 otherwise.
+#define NETMOUNT_FEATURE_TIMEOUT_HINTS 0x0001U  // recommended timeouts, reply: drive_proto_timeout_hints_reply
+
+// Timeouts recommended by the server for the requesting client. They are derived from the time the server
+// needs to process the requests of the client, the link speed and the rate of retransmitted requests.
+struct drive_proto_timeout_hints_reply {
+    uint16_t min_rcv_tmo_ms;       // recommended minimum (initial) response timeout in milliseconds
+    uint16_t max_rcv_tmo_ms;       // recommended maximum response timeout in milliseconds
+    uint8_t max_retries;           // recommended maximum number of request retries
+    uint8_t reserved;              // 0
+    uint16_t service_time_ms;      // smoothed time the server needs to process a request of the client
+    uint16_t retransmit_permille;  // requests of the client received again, per 1000 requests
+};
+
 #pragma pack(pop)
 
 #endif